@@ -73,6 +73,8 @@
 #define  KVM_MEMSLOTS_NR_ALLOC_DEFAULT                      16
 /* Default max allowed memslots if kernel reported nothing */
 #define  KVM_MEMSLOTS_NR_MAX_DEFAULT                        32
+/* Dirty ring harvesting interval of the reaper during migration */
+#define  KVM_DIRTY_RING_HARVEST_INTERVAL_US                 (100 * 1000)
 
 struct KVMParkedVcpu {
     unsigned long vcpu_id;
@@ -700,6 +702,33 @@ static void kvm_slot_sync_dirty_pages(KVMSlot *slot)
 static void kvm_slot_reset_dirty_pages(KVMSlot *slot)
 {
     memset(slot->dirty_bmap, 0, slot->dirty_bmap_size);
+    slot->dirty_start = slot->dirty_end = 0;
+}
+
+/*
+ * Publish only the part of the slot dirty bitmap that was touched by the
+ * dirty rings since the last sync, and reset it.  Should be with all
+ * slots_lock held for the address spaces.
+ */
+static void kvm_slot_sync_dirty_range(KVMSlot *slot)
+{
+    ram_addr_t pages = slot->memory_size / qemu_real_host_page_size();
+    unsigned long first = slot->dirty_start / BITS_PER_LONG;
+    unsigned long last = DIV_ROUND_UP(slot->dirty_end, BITS_PER_LONG);
+
+    if (slot->dirty_start == slot->dirty_end) {
+        return;
+    }
+
+    cpu_physical_memory_set_dirty_lebitmap(slot->dirty_bmap + first,
+                                           slot->ram_start_offset +
+                                           first * BITS_PER_LONG *
+                                           qemu_real_host_page_size(),
+                                           MIN(pages - first * BITS_PER_LONG,
+                                               (last - first) * BITS_PER_LONG));
+    memset(slot->dirty_bmap + first, 0,
+           (last - first) * sizeof(unsigned long));
+    slot->dirty_start = slot->dirty_end = 0;
 }
 
 #define ALIGN(x, y)  (((x)+(y)-1) & ~((y)-1))
@@ -778,6 +807,14 @@ static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
     }
 
     set_bit(offset, mem->dirty_bmap);
+
+    if (mem->dirty_start == mem->dirty_end) {
+        mem->dirty_start = offset;
+        mem->dirty_end = offset + 1;
+    } else {
+        mem->dirty_start = MIN(mem->dirty_start, offset);
+        mem->dirty_end = MAX(mem->dirty_end, offset + 1);
+    }
 }
 
 static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
@@ -911,6 +948,38 @@ static uint64_t kvm_dirty_ring_reap(KVMState *s, CPUState *cpu)
     return total;
 }
 
+/*
+ * While migration is tracking dirty pages, the reaper thread harvests the
+ * dirty rings continuously and publishes the collected pages straight to
+ * the RAM dirty bitmaps, so that a bitmap sync does not have to wait for
+ * every vcpu to be kicked out and all the rings to be reaped at once.
+ */
+static bool kvm_dirty_ring_harvesting(void)
+{
+    return qatomic_read(&global_dirty_tracking) & GLOBAL_DIRTY_MIGRATION;
+}
+
+/* Must be with all slots_lock held for the address spaces */
+static void kvm_dirty_ring_publish_locked(KVMState *s)
+{
+    KVMMemoryListener *kml;
+    int i, j;
+
+    for (i = 0; i < s->nr_as; i++) {
+        kml = s->as[i].ml;
+        if (!kml) {
+            continue;
+        }
+        for (j = 0; j < kml->nr_slots_allocated; j++) {
+            KVMSlot *mem = &kml->slots[j];
+
+            if (mem->memory_size && mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
+                kvm_slot_sync_dirty_range(mem);
+            }
+        }
+    }
+}
+
 static void do_kvm_cpu_synchronize_kick(CPUState *cpu, run_on_cpu_data arg)
 {
     /* No need to do anything */
@@ -1506,6 +1575,7 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
             /* unregister the slot */
             g_free(mem->dirty_bmap);
             mem->dirty_bmap = NULL;
+            mem->dirty_start = mem->dirty_end = 0;
             mem->memory_size = 0;
             mem->flags = 0;
             err = kvm_set_user_memory_region(kml, mem, false);
@@ -1574,7 +1644,11 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
         /*
          * TODO: provide a smarter timeout rather than a constant?
          */
-        sleep(1);
+        if (kvm_dirty_ring_harvesting()) {
+            g_usleep(KVM_DIRTY_RING_HARVEST_INTERVAL_US);
+        } else {
+            sleep(1);
+        }
 
         /* keep sleeping so that dirtylimit not be interfered by reaper */
         if (dirtylimit_in_service()) {
@@ -1586,6 +1660,11 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
 
         bql_lock();
         kvm_dirty_ring_reap(s, NULL);
+        if (kvm_dirty_ring_harvesting()) {
+            kvm_slots_lock();
+            kvm_dirty_ring_publish_locked(s);
+            kvm_slots_unlock();
+        }
         bql_unlock();
 
         r->reaper_iteration++;
@@ -1778,6 +1857,27 @@ static void kvm_log_sync_global(MemoryListener *l, bool last_stage)
     KVMSlot *mem;
     int i;
 
+    if (!last_stage && runstate_is_running() && kvm_dirty_ring_harvesting()) {
+        /*
+         * The reaper publishes dirty pages continuously, so only pick up
+         * what is left in the rings without kicking all the vcpus.  Pages
+         * still in hardware buffers are reported by a later sync, and the
+         * final one flushes everything.  A sync while the VM is stopped
+         * (e.g. postcopy sending its discard bitmap) may be the last one
+         * before the guest runs elsewhere, so it must flush as well.
+         */
+        kvm_slots_lock();
+        kvm_dirty_ring_reap_locked(s, NULL);
+        for (i = 0; i < kml->nr_slots_allocated; i++) {
+            mem = &kml->slots[i];
+            if (mem->memory_size && mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
+                kvm_slot_sync_dirty_range(mem);
+            }
+        }
+        kvm_slots_unlock();
+        return;
+    }
+
     /* Flush all kernel dirty addresses into KVMSlot dirty bitmap */
     kvm_dirty_ring_flush();
 
@@ -421,6 +421,9 @@ BlockDriverState *bdrv_new(void)
         QLIST_INIT(&bs->op_blockers[i]);
     }
     qemu_mutex_init(&bs->reqs_lock);
+    for (i = 0; i < BDRV_TRACKED_SHARDS; i++) {
+        qemu_mutex_init(&bs->tracked_shards[i].lock);
+    }
     qemu_mutex_init(&bs->dirty_bitmap_mutex);
     bs->refcnt = 1;
     bs->aio_context = qemu_get_aio_context();
@@ -5534,6 +5537,8 @@ int bdrv_replace_child_bs(BdrvChild *child, BlockDriverState *new_bs,
 
 static void bdrv_delete(BlockDriverState *bs)
 {
+    int i;
+
     assert(bdrv_op_blocker_is_empty(bs));
     assert(!bs->refcnt);
     GLOBAL_STATE_CODE();
@@ -5547,6 +5552,9 @@ static void bdrv_delete(BlockDriverState *bs)
     bdrv_close(bs);
 
     qemu_mutex_destroy(&bs->reqs_lock);
+    for (i = 0; i < BDRV_TRACKED_SHARDS; i++) {
+        qemu_mutex_destroy(&bs->tracked_shards[i].lock);
+    }
 
     g_free(bs);
 }
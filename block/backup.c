@@ -156,7 +156,7 @@ static int coroutine_fn backup_loop(BackupBlockJob *job)
         job->bg_bcs_call = s = block_copy_async(job->bcs, 0,
                 QEMU_ALIGN_UP(job->len, job->cluster_size),
                 job->perf.max_workers, job->perf.max_chunk,
-                backup_block_copy_callback, job);
+                job->perf.adaptive, backup_block_copy_callback, job);
 
         while (!block_copy_call_finished(s) &&
                !job_is_cancelled(&job->common.job))
@@ -336,6 +336,28 @@ static bool backup_cancel(Job *job, bool force)
     return true;
 }
 
+static void backup_query(BlockJob *job, BlockJobInfo *info)
+{
+    BackupBlockJob *s = container_of(job, BackupBlockJob, common);
+
+    info->u.backup = (BlockJobInfoBackup) { 0 };
+    if (s->bcs) {
+        block_copy_get_dedup_stats(s->bcs, &info->u.backup.dedup_bytes,
+                                   &info->u.backup.zero_bytes);
+        if (s->perf.adaptive) {
+            int workers;
+
+            block_copy_get_adaptive_limits(s->bcs, &workers,
+                                           &info->u.backup.chunk);
+            info->u.backup.workers = MIN(workers, s->perf.max_workers);
+            info->u.backup.chunk = MIN_NON_ZERO(info->u.backup.chunk,
+                                                s->perf.max_chunk);
+            info->u.backup.has_workers = true;
+            info->u.backup.has_chunk = true;
+        }
+    }
+}
+
 static const BlockJobDriver backup_job_driver = {
     .job_driver = {
         .instance_size          = sizeof(BackupBlockJob),
@@ -350,6 +372,7 @@ static const BlockJobDriver backup_job_driver = {
         .cancel                 = backup_cancel,
     },
     .set_speed = backup_set_speed,
+    .query     = backup_query,
 };
 
 BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
@@ -493,6 +516,7 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
     job->perf = *perf;
 
     block_copy_set_copy_opts(bcs, perf->use_copy_range, compress);
+    block_copy_set_dedup(bcs, perf->dedup);
     block_copy_set_progress_meter(bcs, &job->common.job.progress);
     block_copy_set_speed(bcs, speed);
 
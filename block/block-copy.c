@@ -28,6 +28,9 @@
 #include "block/aio_task.h"
 #include "qemu/error-report.h"
 #include "qemu/memalign.h"
+#include "qemu/cutils.h"
+#include "qemu/stats64.h"
+#include "qemu/xxhash.h"
 
 #define BLOCK_COPY_MAX_COPY_RANGE (16 * MiB)
 #define BLOCK_COPY_MAX_BUFFER (1 * MiB)
@@ -35,6 +38,9 @@
 #define BLOCK_COPY_MAX_WORKERS 64
 #define BLOCK_COPY_SLICE_TIME 100000000ULL /* ns */
 #define BLOCK_COPY_CLUSTER_SIZE_DEFAULT (1 << 16)
+#define BLOCK_COPY_DEDUP_MAX_ENTRIES (1 << 20)
+#define BLOCK_COPY_ADAPT_WINDOW_NS 100000000LL /* ns */
+#define BLOCK_COPY_ADAPT_INITIAL_WORKERS 4
 
 typedef enum {
     COPY_READ_WRITE_CLUSTER,
@@ -53,6 +59,7 @@ typedef struct BlockCopyCallState {
     int64_t bytes;
     int max_workers;
     int64_t max_chunk;
+    bool adaptive;
     bool ignore_ratelimit;
     BlockCopyAsyncCallbackFunc cb;
     void *cb_opaque;
@@ -107,6 +114,36 @@ typedef struct BlockCopyTask {
     BlockReq req;
 } BlockCopyTask;
 
+/*
+ * Entry of the dedup index: the target offset of the first cluster written
+ * with content hashing to @hash.  The index is direct-mapped, so a new entry
+ * simply evicts an older one that shares its slot.  @offset is -1 for unused
+ * slots.
+ */
+typedef struct BlockCopyDedupEntry {
+    uint64_t hash;
+    int64_t offset;
+} BlockCopyDedupEntry;
+
+/*
+ * State of the controller that sizes adaptive block-copy calls (see
+ * block_copy_adapt()).  The numbers of workers and the chunk size are written
+ * with lock held and may be read atomically without it.
+ */
+typedef struct BlockCopyAdaptState {
+    int workers;
+    int chunk;
+
+    /* Measurement window: completed tasks since @window_start */
+    int64_t window_start;
+    int64_t window_tasks;
+    int64_t window_bytes;
+    int64_t window_latency; /* sum of task latencies in ns */
+
+    uint64_t last_throughput; /* bytes per second in the previous window */
+    uint64_t min_latency; /* lowest ns per KiB seen in any window */
+} BlockCopyAdaptState;
+
 static int64_t task_end(BlockCopyTask *task)
 {
     return task->req.offset + task->req.bytes;
@@ -155,11 +192,30 @@ typedef struct BlockCopyState {
      * block_copy_reset_unallocated() every time it does.
      */
     bool skip_unallocated; /* atomic */
+    /*
+     * dedup_index:
+     *
+     * Set by block_copy_set_dedup().  Buffered copies skip writing clusters
+     * that are all zeroes and look up the remaining ones in dedup_index: if
+     * an earlier cluster with identical content was already written to the
+     * target, the new one is created as a copy_range of that cluster, which
+     * allows targets to share the data instead of storing it again.
+     *
+     * Entries are only hints; the content of the earlier cluster is compared
+     * before it is referenced.  dedup_ref is cleared when the target does not
+     * support copy_range, in which case only zero clusters are skipped.
+     */
+    BlockCopyDedupEntry *dedup_index;
+    uint64_t dedup_mask;
+    bool dedup_ref; /* atomic */
+    BlockCopyAdaptState adapt;
     /* State fields that use a thread-safe API */
     BdrvDirtyBitmap *copy_bitmap;
     ProgressMeter *progress;
     SharedResource *mem;
     RateLimit rate_limit;
+    Stat64 dedup_bytes;
+    Stat64 zero_bytes;
 } BlockCopyState;
 
 /* Called with lock held */
@@ -181,6 +237,91 @@ static int64_t block_copy_chunk_size(BlockCopyState *s)
     }
 }
 
+/* Called with lock held */
+static int64_t block_copy_call_chunk_size(BlockCopyState *s,
+                                          BlockCopyCallState *call_state)
+{
+    if (call_state->adaptive && s->method != COPY_READ_WRITE_CLUSTER) {
+        return MIN_NON_ZERO(MIN(s->adapt.chunk, s->max_transfer),
+                            call_state->max_chunk);
+    }
+
+    return MIN_NON_ZERO(block_copy_chunk_size(s), call_state->max_chunk);
+}
+
+static int block_copy_call_workers(BlockCopyState *s,
+                                   BlockCopyCallState *call_state)
+{
+    if (call_state->adaptive) {
+        return MIN(qatomic_read(&s->adapt.workers), call_state->max_workers);
+    }
+
+    return call_state->max_workers;
+}
+
+/*
+ * Account a completed task of @bytes that took @latency ns to an adaptive
+ * call, and resize the call at the end of each measurement window, AIMD style:
+ *
+ * - if throughput improved, add one worker and double the chunk size;
+ * - if throughput did not improve and the latency per byte is more than twice
+ *   the lowest seen so far, requests are just queueing up in the source or
+ *   target, so halve both;
+ * - otherwise keep the current size.
+ *
+ * Called with lock held.
+ */
+static void block_copy_adapt(BlockCopyState *s, BlockCopyCallState *call_state,
+                             int64_t bytes, int64_t latency)
+{
+    BlockCopyAdaptState *a = &s->adapt;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t elapsed = now - a->window_start;
+    uint64_t throughput, byte_latency;
+    int workers = a->workers;
+    int chunk = a->chunk;
+
+    a->window_tasks++;
+    a->window_bytes += bytes;
+    a->window_latency += latency;
+
+    if (a->window_tasks < workers || elapsed < BLOCK_COPY_ADAPT_WINDOW_NS) {
+        return;
+    }
+
+    throughput = a->window_bytes * 1000 / (elapsed / SCALE_MS);
+    byte_latency = a->window_latency / MAX(a->window_bytes / KiB, 1);
+    if (!a->min_latency || byte_latency < a->min_latency) {
+        a->min_latency = byte_latency;
+    }
+
+    if (throughput > a->last_throughput + a->last_throughput / 20) {
+        workers = MIN(workers + 1, call_state->max_workers);
+        chunk = MIN(chunk * 2,
+                    MAX(BLOCK_COPY_MAX_COPY_RANGE, s->cluster_size));
+    } else if (byte_latency > 2 * a->min_latency) {
+        workers = MAX(workers / 2, 1);
+        chunk = MAX(chunk / 2, s->cluster_size);
+    }
+
+    trace_block_copy_adapt(s, throughput, byte_latency, workers, chunk);
+
+    qatomic_set(&a->workers, workers);
+    qatomic_set(&a->chunk, chunk);
+    a->last_throughput = throughput;
+    a->window_start = now;
+    a->window_tasks = 0;
+    a->window_bytes = 0;
+    a->window_latency = 0;
+}
+
+void block_copy_get_adaptive_limits(BlockCopyState *s, int *workers,
+                                    int64_t *chunk)
+{
+    *workers = qatomic_read(&s->adapt.workers);
+    *chunk = qatomic_read(&s->adapt.chunk);
+}
+
 /*
  * Search for the first dirty area in offset/bytes range and create task at
  * the beginning of it.
@@ -193,7 +334,7 @@ block_copy_task_create(BlockCopyState *s, BlockCopyCallState *call_state,
     int64_t max_chunk;
 
     QEMU_LOCK_GUARD(&s->lock);
-    max_chunk = MIN_NON_ZERO(block_copy_chunk_size(s), call_state->max_chunk);
+    max_chunk = block_copy_call_chunk_size(s, call_state);
     if (!bdrv_dirty_bitmap_next_dirty_area(s->copy_bitmap,
                                            offset, offset + bytes,
                                            max_chunk, &offset, &bytes))
@@ -272,6 +413,7 @@ void block_copy_state_free(BlockCopyState *s)
     ratelimit_destroy(&s->rate_limit);
     bdrv_release_dirty_bitmap(s->copy_bitmap);
     shres_destroy(s->mem);
+    g_free(s->dedup_index);
     g_free(s);
 }
 
@@ -309,6 +451,37 @@ void block_copy_set_copy_opts(BlockCopyState *s, bool use_copy_range,
     }
 }
 
+/* Only set before running the job, no need for locking. */
+void block_copy_set_dedup(BlockCopyState *s, bool dedup)
+{
+    uint64_t entries, i;
+
+    g_free(s->dedup_index);
+    s->dedup_index = NULL;
+    s->dedup_mask = 0;
+    s->dedup_ref = false;
+
+    if (!dedup) {
+        return;
+    }
+
+    entries = MIN(pow2ceil(DIV_ROUND_UP(s->len, s->cluster_size)),
+                  BLOCK_COPY_DEDUP_MAX_ENTRIES);
+    s->dedup_index = g_new(BlockCopyDedupEntry, entries);
+    for (i = 0; i < entries; i++) {
+        s->dedup_index[i].offset = -1;
+    }
+    s->dedup_mask = entries - 1;
+    s->dedup_ref = true;
+}
+
+void block_copy_get_dedup_stats(BlockCopyState *s, uint64_t *dedup_bytes,
+                                uint64_t *zero_bytes)
+{
+    *dedup_bytes = stat64_get(&s->dedup_bytes);
+    *zero_bytes = stat64_get(&s->zero_bytes);
+}
+
 static int64_t block_copy_calculate_cluster_size(BlockDriverState *target,
                                                  int64_t min_cluster_size,
                                                  Error **errp)
@@ -439,6 +612,9 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
     s->discard_source = discard_source;
     block_copy_set_copy_opts(s, false, false);
 
+    s->adapt.workers = BLOCK_COPY_ADAPT_INITIAL_WORKERS;
+    s->adapt.chunk = MAX(s->cluster_size, BLOCK_COPY_MAX_BUFFER);
+
     ratelimit_init(&s->rate_limit);
     qemu_co_mutex_init(&s->lock);
     QLIST_INIT(&s->reqs);
@@ -485,6 +661,189 @@ static coroutine_fn int block_copy_task_run(AioTaskPool *pool,
     return 0;
 }
 
+/*
+ * xxh64 of a whole cluster.  The four lanes are independent until the final
+ * merge, so the main loop pipelines (and vectorizes where 64-bit multiplies
+ * are available) well.  @len must be a multiple of 32.
+ */
+static uint64_t block_copy_dedup_hash(const uint8_t *buf, int64_t len)
+{
+    uint64_t v1 = QEMU_XXHASH_SEED + XXH_PRIME64_1 + XXH_PRIME64_2;
+    uint64_t v2 = QEMU_XXHASH_SEED + XXH_PRIME64_2;
+    uint64_t v3 = QEMU_XXHASH_SEED + 0;
+    uint64_t v4 = QEMU_XXHASH_SEED - XXH_PRIME64_1;
+    int64_t i;
+
+    assert(QEMU_IS_ALIGNED(len, 32));
+    for (i = 0; i < len; i += 32) {
+        v1 = XXH64_round(v1, ldq_le_p(buf + i));
+        v2 = XXH64_round(v2, ldq_le_p(buf + i + 8));
+        v3 = XXH64_round(v3, ldq_le_p(buf + i + 16));
+        v4 = XXH64_round(v4, ldq_le_p(buf + i + 24));
+    }
+
+    return XXH64_avalanche(XXH64_mergerounds(v1, v2, v3, v4) + len);
+}
+
+static void coroutine_fn block_copy_dedup_insert(BlockCopyState *s,
+                                                 uint64_t hash, int64_t offset)
+{
+    QEMU_LOCK_GUARD(&s->lock);
+    s->dedup_index[hash & s->dedup_mask] = (BlockCopyDedupEntry) {
+        .hash = hash,
+        .offset = offset,
+    };
+}
+
+/*
+ * Try to create the cluster at @offset, with content @buf and hash @hash, as a
+ * reference to an identical cluster already written to the target.
+ *
+ * Returns 1 if the cluster was referenced, 0 if it still has to be written.
+ * Failures are not fatal: the caller just writes the cluster instead.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+block_copy_dedup_ref(BlockCopyState *s, int64_t offset, const uint8_t *buf,
+                     uint64_t hash, uint8_t **verify_buf)
+{
+    BlockCopyDedupEntry *entry;
+    int64_t src = -1;
+    int ret;
+
+    WITH_QEMU_LOCK_GUARD(&s->lock) {
+        entry = &s->dedup_index[hash & s->dedup_mask];
+        if (entry->hash == hash) {
+            src = entry->offset;
+        }
+    }
+    if (src < 0 || src == offset) {
+        return 0;
+    }
+
+    if (!*verify_buf) {
+        *verify_buf = qemu_blockalign(s->target->bs, s->cluster_size);
+    }
+    ret = bdrv_co_pread(s->target, src, s->cluster_size, *verify_buf, 0);
+    if (ret < 0 || memcmp(*verify_buf, buf, s->cluster_size)) {
+        return 0;
+    }
+
+    ret = bdrv_co_copy_range(s->target, src, s->target, offset,
+                             s->cluster_size, 0,
+                             s->write_flags & ~BDRV_REQ_WRITE_COMPRESSED);
+    if (ret < 0) {
+        /* Don't bother hashing if the target can't share clusters anyway */
+        trace_block_copy_dedup_ref_fail(s, offset, ret);
+        qatomic_set(&s->dedup_ref, false);
+        return 0;
+    }
+
+    trace_block_copy_dedup_ref(s, offset, src);
+    stat64_add(&s->dedup_bytes, s->cluster_size);
+    return 1;
+}
+
+/*
+ * Write clusters @first to @end (exclusive) of the @bytes long request at
+ * @offset to the target as data, and add those that were hashed to the dedup
+ * index.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+block_copy_dedup_flush(BlockCopyState *s, int64_t offset, int64_t bytes,
+                       uint8_t *buf, uint64_t *hashes, int64_t first,
+                       int64_t end)
+{
+    int64_t pos = offset + first * s->cluster_size;
+    int64_t len = MIN(end * s->cluster_size, bytes) - first * s->cluster_size;
+    int64_t i;
+    int ret;
+
+    if (first >= end) {
+        return 0;
+    }
+
+    ret = bdrv_co_pwrite(s->target, pos, len, buf + first * s->cluster_size,
+                         s->write_flags);
+    if (ret < 0) {
+        trace_block_copy_write_fail(s, pos, ret);
+        return ret;
+    }
+
+    for (i = first; i < end; i++) {
+        if (hashes[i]) {
+            block_copy_dedup_insert(s, hashes[i], offset + i * s->cluster_size);
+        }
+    }
+    return 0;
+}
+
+/*
+ * Write the @bytes at @offset, whose content is in @buf, to the target: zero
+ * clusters are written as zeroes, duplicates of clusters already in the target
+ * are referenced if possible, and the remaining clusters are written in runs
+ * as long as possible.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+block_copy_dedup_write(BlockCopyState *s, int64_t offset, int64_t bytes,
+                       uint8_t *buf)
+{
+    int64_t nb_clusters = DIV_ROUND_UP(bytes, s->cluster_size);
+    g_autofree uint64_t *hashes = g_new0(uint64_t, nb_clusters);
+    uint8_t *verify_buf = NULL;
+    int64_t run = 0; /* first cluster not written yet */
+    int64_t i;
+    int ret = 0;
+
+    for (i = 0; i < nb_clusters; i++) {
+        int64_t pos = offset + i * s->cluster_size;
+        uint8_t *cluster = buf + i * s->cluster_size;
+
+        if (bytes - i * s->cluster_size < s->cluster_size) {
+            /* Partial tail cluster, always written as data */
+            break;
+        }
+
+        if (buffer_is_zero(cluster, s->cluster_size)) {
+            ret = block_copy_dedup_flush(s, offset, bytes, buf, hashes, run, i);
+            if (ret < 0) {
+                goto out;
+            }
+            run = i + 1;
+
+            ret = bdrv_co_pwrite_zeroes(s->target, pos, s->cluster_size,
+                                        s->write_flags &
+                                        ~BDRV_REQ_WRITE_COMPRESSED);
+            if (ret < 0) {
+                trace_block_copy_write_zeroes_fail(s, pos, ret);
+                goto out;
+            }
+            stat64_add(&s->zero_bytes, s->cluster_size);
+            continue;
+        }
+
+        if (!qatomic_read(&s->dedup_ref)) {
+            continue;
+        }
+
+        hashes[i] = block_copy_dedup_hash(cluster, s->cluster_size);
+        if (block_copy_dedup_ref(s, pos, cluster, hashes[i], &verify_buf)) {
+            hashes[i] = 0;
+            ret = block_copy_dedup_flush(s, offset, bytes, buf, hashes, run, i);
+            if (ret < 0) {
+                goto out;
+            }
+            run = i + 1;
+        }
+    }
+
+    ret = block_copy_dedup_flush(s, offset, bytes, buf, hashes, run,
+                                 nb_clusters);
+
+out:
+    qemu_vfree(verify_buf);
+    return ret;
+}
+
 /*
  * block_copy_do_copy
  *
@@ -559,6 +918,14 @@ block_copy_do_copy(BlockCopyState *s, int64_t offset, int64_t bytes,
             goto out;
         }
 
+        if (s->dedup_index) {
+            ret = block_copy_dedup_write(s, offset, nbytes, bounce_buffer);
+            if (ret < 0) {
+                *error_is_read = false;
+            }
+            goto out;
+        }
+
         ret = bdrv_co_pwrite(s->target, offset, nbytes, bounce_buffer,
                              s->write_flags);
         if (ret < 0) {
@@ -584,6 +951,7 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
     BlockCopyState *s = t->s;
     bool error_is_read = false;
     BlockCopyMethod method = t->method;
+    int64_t start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     int ret = -1;
 
     WITH_GRAPH_RDLOCK_GUARD() {
@@ -596,6 +964,13 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
             s->method = method;
         }
 
+        /* Zero writes say nothing about the cost of copying data */
+        if (ret == 0 && t->call_state->adaptive &&
+            t->method != COPY_WRITE_ZEROES) {
+            block_copy_adapt(s, t->call_state, t->req.bytes,
+                             qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start);
+        }
+
         if (ret < 0) {
             if (!t->call_state->ret) {
                 t->call_state->ret = ret;
@@ -765,6 +1140,15 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
     assert(QEMU_IS_ALIGNED(offset, s->cluster_size));
     assert(QEMU_IS_ALIGNED(bytes, s->cluster_size));
 
+    if (call_state->adaptive) {
+        WITH_QEMU_LOCK_GUARD(&s->lock) {
+            s->adapt.window_start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+            s->adapt.window_tasks = 0;
+            s->adapt.window_bytes = 0;
+            s->adapt.window_latency = 0;
+        }
+    }
+
     while (bytes && aio_task_pool_status(aio) == 0 &&
            !qatomic_read(&call_state->cancelled)) {
         BlockCopyTask *task;
@@ -822,7 +1206,10 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
         bytes = end - offset;
 
         if (!aio && bytes) {
-            aio = aio_task_pool_new(call_state->max_workers);
+            aio = aio_task_pool_new(block_copy_call_workers(s, call_state));
+        } else if (aio && call_state->adaptive) {
+            aio_task_pool_set_max_busy_tasks(aio,
+                    block_copy_call_workers(s, call_state));
         }
 
         ret = block_copy_task_run(aio, task);
@@ -972,6 +1359,7 @@ int coroutine_fn block_copy(BlockCopyState *s, int64_t start, int64_t bytes,
 BlockCopyCallState *block_copy_async(BlockCopyState *s,
                                      int64_t offset, int64_t bytes,
                                      int max_workers, int64_t max_chunk,
+                                     bool adaptive,
                                      BlockCopyAsyncCallbackFunc cb,
                                      void *cb_opaque)
 {
@@ -983,6 +1371,7 @@ BlockCopyCallState *block_copy_async(BlockCopyState *s,
         .bytes = bytes,
         .max_workers = max_workers,
         .max_chunk = max_chunk,
+        .adaptive = adaptive,
         .cb = cb,
         .cb_opaque = cb_opaque,
 
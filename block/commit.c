@@ -20,6 +20,7 @@
 #include "qapi/error.h"
 #include "qemu/ratelimit.h"
 #include "qemu/memalign.h"
+#include "qemu/stats64.h"
 #include "sysemu/block-backend.h"
 
 enum {
@@ -29,6 +30,12 @@ enum {
      * contiguous regions of the image is efficient.
      */
     COMMIT_BUFFER_SIZE = 512 * 1024, /* in bytes */
+
+    /*
+     * Maximum size of an offloaded copy.  Offloaded copies need no buffer, so
+     * they can cover whole runs of allocated clusters.
+     */
+    COMMIT_OFFLOAD_SIZE = 64 * 1024 * 1024, /* in bytes */
 };
 
 typedef struct CommitBlockJob {
@@ -43,6 +50,16 @@ typedef struct CommitBlockJob {
     bool chain_frozen;
     char *backing_file_str;
     bool backing_mask_protocol;
+
+    /*
+     * Try copy offloading; cleared after the first copy that top and base
+     * can't offload.
+     */
+    bool copy_offload;
+    bool copy_offload_requested;
+    /* Bytes copied with copy offloading, and with read/write */
+    Stat64 offloaded_bytes;
+    Stat64 copied_bytes;
 } CommitBlockJob;
 
 static int commit_prepare(Job *job)
@@ -167,11 +184,26 @@ static int coroutine_fn commit_run(Job *job, Error **errp)
             break;
         }
         /* Copy if allocated above the base */
-        ret = blk_co_is_allocated_above(s->top, s->base_overlay, true,
-                                        offset, COMMIT_BUFFER_SIZE, &n);
+        ret = blk_co_is_allocated_above(s->top, s->base_overlay, true, offset,
+                                        s->copy_offload ? COMMIT_OFFLOAD_SIZE
+                                                        : COMMIT_BUFFER_SIZE,
+                                        &n);
         copy = (ret > 0);
         trace_commit_one_iteration(s, offset, n, ret);
-        if (copy) {
+        if (copy && s->copy_offload) {
+            ret = blk_co_copy_range(s->top, offset, s->base, offset, n, 0, 0);
+            if (ret < 0) {
+                /*
+                 * Fall back to read/write from now on.  If this was a real
+                 * I/O error, the retry with buffers will report it.
+                 */
+                trace_commit_copy_offload_fail(s, offset, ret);
+                s->copy_offload = false;
+                n = 0;
+                continue;
+            }
+            stat64_add(&s->offloaded_bytes, n);
+        } else if (copy) {
             assert(n < SIZE_MAX);
 
             ret = blk_co_pread(s->top, offset, n, buf, 0);
@@ -179,6 +211,8 @@ static int coroutine_fn commit_run(Job *job, Error **errp)
                 ret = blk_co_pwrite(s->base, offset, n, buf, 0);
                 if (ret < 0) {
                     error_in_source = false;
+                } else {
+                    stat64_add(&s->copied_bytes, n);
                 }
             }
         }
@@ -204,6 +238,18 @@ static int coroutine_fn commit_run(Job *job, Error **errp)
     return 0;
 }
 
+static void commit_query(BlockJob *job, BlockJobInfo *info)
+{
+    CommitBlockJob *s = container_of(job, CommitBlockJob, common);
+
+    info->u.commit = (BlockJobInfoCommit) {
+        .has_offloaded_bytes = s->copy_offload_requested,
+        .offloaded_bytes = stat64_get(&s->offloaded_bytes),
+        .has_copied_bytes = s->copy_offload_requested,
+        .copied_bytes = stat64_get(&s->copied_bytes),
+    };
+}
+
 static const BlockJobDriver commit_job_driver = {
     .job_driver = {
         .instance_size = sizeof(CommitBlockJob),
@@ -215,6 +261,7 @@ static const BlockJobDriver commit_job_driver = {
         .abort         = commit_abort,
         .clean         = commit_clean
     },
+    .query = commit_query,
 };
 
 static int coroutine_fn GRAPH_RDLOCK
@@ -257,7 +304,8 @@ void commit_start(const char *job_id, BlockDriverState *bs,
                   int creation_flags, int64_t speed,
                   BlockdevOnError on_error, const char *backing_file_str,
                   bool backing_mask_protocol,
-                  const char *filter_node_name, Error **errp)
+                  const char *filter_node_name, bool copy_offload,
+                  Error **errp)
 {
     CommitBlockJob *s;
     BlockDriverState *iter;
@@ -413,6 +461,8 @@ void commit_start(const char *job_id, BlockDriverState *bs,
     s->backing_file_str = g_strdup(backing_file_str);
     s->backing_mask_protocol = backing_mask_protocol;
     s->on_error = on_error;
+    s->copy_offload = copy_offload;
+    s->copy_offload_requested = copy_offload;
 
     trace_commit_start(bs, base, top, s);
     job_start(&s->common.job);
@@ -38,6 +38,7 @@
 #include "block/raw-aio.h"
 #include "qapi/qmp/qdict.h"
 #include "qapi/qmp/qstring.h"
+#include "exec/memory.h" /* for ram_block_discard_disable() */
 
 #include "scsi/pr-manager.h"
 #include "scsi/constants.h"
@@ -134,6 +135,34 @@
 #define RAW_LOCK_PERM_BASE             100
 #define RAW_LOCK_SHARED_BASE           200
 
+/* Number of extents kept in the extent cache */
+#define RAW_EXTENT_CACHE_SIZE 256
+
+/* Number of extents looked up on a cache miss */
+#define RAW_EXTENT_CACHE_FILL 8
+
+typedef struct RawExtent {
+    int64_t start;
+    int64_t end; /* INT64_MAX for a trailing hole */
+    bool data;
+} RawExtent;
+
+/*
+ * Window of consecutive data and hole extents found with SEEK_DATA/SEEK_HOLE,
+ * so that block-status queries inside it need no system calls.
+ *
+ * The window is dropped whenever this node modifies an overlapping part of
+ * the file.  @gen is incremented for each modification, so that a fill that
+ * raced with one is not installed.
+ */
+typedef struct RawExtentCache {
+    bool enabled;
+    QemuMutex lock;
+    uint64_t gen;
+    RawExtent *extents; /* RAW_EXTENT_CACHE_SIZE entries */
+    int nb_extents;
+} RawExtentCache;
+
 typedef struct BDRVRawState {
     int fd;
     bool use_lock;
@@ -154,13 +183,17 @@ typedef struct BDRVRawState {
 
     int perm_change_fd;
     int perm_change_flags;
+    int luring_fixed_fd; /* see luring_register_fd() */
     BDRVReopenState *reopen_state;
 
     bool has_discard:1;
     bool has_write_zeroes:1;
+    bool has_clone_range:1;
     bool use_linux_aio:1;
     bool has_laio_fdsync:1;
     bool use_linux_io_uring:1;
+    bool use_linux_io_uring_iopoll:1;
+    bool use_linux_io_uring_fixed_bufs:1;
     int page_cache_inconsistent; /* errno from fdatasync failure */
     bool has_fallocate;
     bool needs_alignment;
@@ -174,6 +207,7 @@ typedef struct BDRVRawState {
     } stats;
 
     PRManager *pr_mgr;
+    RawExtentCache extent_cache;
 } BDRVRawState;
 
 typedef struct BDRVRawReopenState {
@@ -194,6 +228,8 @@ static int fd_open(BlockDriverState *bs)
 }
 
 static int64_t raw_getlength(BlockDriverState *bs);
+static void raw_extent_cache_invalidate(BDRVRawState *s, int64_t offset,
+                                        int64_t bytes);
 
 typedef struct RawPosixAIOData {
     BlockDriverState *bs;
@@ -561,6 +597,16 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "AIO max batch size (0 = auto handled by AIO backend, default: 0)",
         },
+        {
+            .name = "aio-iopoll",
+            .type = QEMU_OPT_BOOL,
+            .help = "poll for io_uring completions (default: off)",
+        },
+        {
+            .name = "aio-fixed-bufs",
+            .type = QEMU_OPT_BOOL,
+            .help = "register guest RAM with io_uring (default: off)",
+        },
         {
             .name = "locking",
             .type = QEMU_OPT_STRING,
@@ -583,12 +629,38 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_BOOL,
             .help = "check that page cache was dropped on live migration (default: off)"
         },
+        {
+            .name = "extent-cache",
+            .type = QEMU_OPT_BOOL,
+            .help = "cache data/hole extents for block-status queries (default: off)"
+        },
         { /* end of list */ }
     },
 };
 
 static const char *const mutable_opts[] = { "x-check-cache-dropped", NULL };
 
+/* Start using s->fd for I/O */
+static void raw_register_fd(BDRVRawState *s)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        s->luring_fixed_fd = luring_register_fd(s->fd);
+    }
+#endif
+}
+
+/* Close s->fd, which may have been used for I/O */
+static void raw_close_fd(BDRVRawState *s)
+{
+#ifdef CONFIG_LINUX_IO_URING
+    luring_unregister_fd(s->luring_fixed_fd);
+    s->luring_fixed_fd = -1;
+#endif
+    qemu_close(s->fd);
+    s->fd = -1;
+}
+
 static int raw_open_common(BlockDriverState *bs, QDict *options,
                            int bdrv_flags, int open_flags,
                            bool device, Error **errp)
@@ -642,6 +714,43 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 
     s->aio_max_batch = qemu_opt_get_number(opts, "aio-max-batch", 0);
 
+    if (qemu_opt_get_bool(opts, "aio-iopoll", false)) {
+#ifdef CONFIG_LINUX_IO_URING
+        if (!s->use_linux_io_uring) {
+            error_setg(errp, "aio-iopoll requires aio=io_uring");
+            ret = -EINVAL;
+            goto fail;
+        }
+        if (!(bdrv_flags & BDRV_O_NOCACHE)) {
+            error_setg(errp, "aio-iopoll requires cache.direct=on");
+            ret = -EINVAL;
+            goto fail;
+        }
+        s->use_linux_io_uring_iopoll = true;
+#else
+        error_setg(errp, "aio-iopoll was specified, but is not supported "
+                         "in this build.");
+        ret = -EINVAL;
+        goto fail;
+#endif
+    }
+
+    if (qemu_opt_get_bool(opts, "aio-fixed-bufs", false)) {
+#ifdef CONFIG_LINUX_IO_URING
+        if (!s->use_linux_io_uring) {
+            error_setg(errp, "aio-fixed-bufs requires aio=io_uring");
+            ret = -EINVAL;
+            goto fail;
+        }
+        s->use_linux_io_uring_fixed_bufs = true;
+#else
+        error_setg(errp, "aio-fixed-bufs was specified, but is not "
+                         "supported in this build.");
+        ret = -EINVAL;
+        goto fail;
+#endif
+    }
+
     locking = qapi_enum_parse(&OnOffAuto_lookup,
                               qemu_opt_get(opts, "locking"),
                               ON_OFF_AUTO_AUTO, &local_err);
@@ -688,6 +797,7 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     raw_parse_flags(bdrv_flags, &s->open_flags, false);
 
     s->fd = -1;
+    s->luring_fixed_fd = -1;
     fd = qemu_open(filename, s->open_flags, errp);
     ret = fd < 0 ? -errno : 0;
 
@@ -742,6 +852,7 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
 
     s->has_discard = true;
     s->has_write_zeroes = true;
+    s->has_clone_range = true;
 
     if (fstat(s->fd, &st) < 0) {
         ret = -errno;
@@ -805,10 +916,35 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     s->needs_alignment = raw_needs_alignment(bs);
 
     bs->supported_zero_flags = BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK;
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring_fixed_bufs) {
+        /*
+         * Registered buffers stay pinned, so discarded guest RAM would not
+         * be seen by requests.  Keep RAM discards (virtio-mem, balloon)
+         * away for as long as this node may register buffers.
+         */
+        ret = ram_block_discard_disable(true);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "ram_block_discard_disable() failed");
+            s->use_linux_io_uring_fixed_bufs = false;
+            goto fail;
+        }
+
+        /* Requests on guest RAM can use io_uring registered buffers */
+        bs->supported_write_flags |= BDRV_REQ_REGISTERED_BUF;
+    }
+#endif
     if (S_ISREG(st.st_mode)) {
         /* When extending regular files, we get zeros from the OS */
         bs->supported_truncate_flags = BDRV_REQ_ZERO_WRITE;
     }
+
+    s->extent_cache.enabled = qemu_opt_get_bool(opts, "extent-cache", false);
+    if (s->extent_cache.enabled) {
+        qemu_mutex_init(&s->extent_cache.lock);
+        s->extent_cache.extents = g_new(RawExtent, RAW_EXTENT_CACHE_SIZE);
+    }
+    raw_register_fd(s);
     ret = 0;
 fail:
     if (ret < 0 && s->fd != -1) {
@@ -1139,6 +1275,13 @@ static int raw_reopen_prepare(BDRVReopenState *state,
     rs->check_cache_dropped =
         qemu_opt_get_bool_del(opts, "x-check-cache-dropped", false);
 
+    /* Polled completions only work for O_DIRECT requests */
+    if (s->use_linux_io_uring_iopoll && !(state->flags & BDRV_O_NOCACHE)) {
+        error_setg(errp, "aio-iopoll requires cache.direct=on");
+        ret = -EINVAL;
+        goto out;
+    }
+
     /* This driver's reopen function doesn't currently allow changing
      * other options, so let's put them back in the original QDict and
      * bdrv_reopen_prepare() will detect changes and complain. */
@@ -2157,6 +2300,51 @@ static int handle_aiocb_zone_mgmt(void *opaque)
 }
 #endif
 
+/*
+ * Try to share the source extents with the destination instead of copying
+ * them.  This only works within one filesystem that supports reflinks, and
+ * only for ranges aligned to its block size; return -ENOTSUP if the range
+ * has to be copied.
+ */
+static int handle_aiocb_clone_range(RawPosixAIOData *aiocb)
+{
+#ifdef FICLONERANGE
+    BDRVRawState *s = aiocb->bs->opaque;
+    struct file_clone_range range = {
+        .src_fd         = aiocb->aio_fildes,
+        .src_offset     = aiocb->aio_offset,
+        .src_length     = aiocb->aio_nbytes,
+        .dest_offset    = aiocb->copy_range.aio_offset2,
+    };
+    int ret;
+
+    if (!s->has_clone_range) {
+        return -ENOTSUP;
+    }
+
+    do {
+        ret = ioctl(aiocb->copy_range.aio_fd2, FICLONERANGE, &range);
+    } while (ret < 0 && errno == EINTR);
+
+    trace_file_clone_range(aiocb->bs, range.src_fd, range.src_offset,
+                           aiocb->copy_range.aio_fd2, range.dest_offset,
+                           range.src_length, ret < 0 ? -errno : 0);
+    if (ret == 0) {
+        return 0;
+    }
+
+    switch (errno) {
+    case EOPNOTSUPP:
+    case ENOTTY:
+    case ENOSYS:
+        /* Not a reflink-capable filesystem, don't try again */
+        s->has_clone_range = false;
+        break;
+    }
+#endif
+    return -ENOTSUP;
+}
+
 static int handle_aiocb_copy_range(void *opaque)
 {
     RawPosixAIOData *aiocb = opaque;
@@ -2164,6 +2352,10 @@ static int handle_aiocb_copy_range(void *opaque)
     off_t in_off = aiocb->aio_offset;
     off_t out_off = aiocb->copy_range.aio_offset2;
 
+    if (handle_aiocb_clone_range(aiocb) == 0) {
+        return 0;
+    }
+
     while (bytes) {
         ssize_t ret = copy_file_range(aiocb->aio_fildes, &in_off,
                                       aiocb->copy_range.aio_fd2, &out_off,
@@ -2179,6 +2371,8 @@ static int handle_aiocb_copy_range(void *opaque)
         if (ret < 0) {
             switch (errno) {
             case ENOSYS:
+            case EXDEV:
+                /* Different filesystems, copying with buffers is as fast */
                 return -ENOTSUP;
             case EINTR:
                 continue;
@@ -2451,6 +2645,13 @@ static inline bool raw_check_linux_io_uring(BDRVRawState *s)
         s->use_linux_io_uring = false;
         return false;
     }
+    if (s->use_linux_io_uring_iopoll &&
+        unlikely(!aio_setup_linux_io_uring_iopoll(ctx, &local_err))) {
+        error_reportf_err(local_err, "Unable to poll for io_uring "
+                                     "completions, falling back to "
+                                     "interrupts: ");
+        s->use_linux_io_uring_iopoll = false;
+    }
     return true;
 }
 #endif
@@ -2477,7 +2678,8 @@ static inline bool raw_check_linux_aio(BDRVRawState *s)
 #endif
 
 static int coroutine_fn raw_co_prw(BlockDriverState *bs, int64_t *offset_ptr,
-                                   uint64_t bytes, QEMUIOVector *qiov, int type)
+                                   uint64_t bytes, QEMUIOVector *qiov, int type,
+                                   BdrvRequestFlags flags)
 {
     BDRVRawState *s = bs->opaque;
     RawPosixAIOData acb;
@@ -2508,7 +2710,20 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, int64_t *offset_ptr,
 #ifdef CONFIG_LINUX_IO_URING
     } else if (raw_check_linux_io_uring(s)) {
         assert(qiov->size == bytes);
-        ret = luring_co_submit(bs, s->fd, offset, qiov, type);
+        ret = luring_co_submit(bs, s->fd, s->luring_fixed_fd, offset, qiov,
+                               type, flags, s->use_linux_io_uring_iopoll);
+        if (ret == -EOPNOTSUPP && s->use_linux_io_uring_iopoll) {
+            /*
+             * Most filesystems and devices without poll queues can't do
+             * polled I/O.  Nothing was transferred, so retry on the
+             * regular ring and keep using it from now on.
+             */
+            warn_report_once("%s does not support polled I/O, "
+                             "disabling aio-iopoll", bs->filename);
+            s->use_linux_io_uring_iopoll = false;
+            ret = luring_co_submit(bs, s->fd, s->luring_fixed_fd, offset,
+                                   qiov, type, flags, false);
+        }
         goto out;
 #endif
 #ifdef CONFIG_LINUX_AIO
@@ -2564,6 +2779,9 @@ out:
         qemu_co_mutex_unlock(&wps->colock);
     }
 #endif
+    if (type & (QEMU_AIO_WRITE | QEMU_AIO_ZONE_APPEND)) {
+        raw_extent_cache_invalidate(s, offset, bytes);
+    }
     return ret;
 }
 
@@ -2571,14 +2789,14 @@ static int coroutine_fn raw_co_preadv(BlockDriverState *bs, int64_t offset,
                                       int64_t bytes, QEMUIOVector *qiov,
                                       BdrvRequestFlags flags)
 {
-    return raw_co_prw(bs, &offset, bytes, qiov, QEMU_AIO_READ);
+    return raw_co_prw(bs, &offset, bytes, qiov, QEMU_AIO_READ, flags);
 }
 
 static int coroutine_fn raw_co_pwritev(BlockDriverState *bs, int64_t offset,
                                        int64_t bytes, QEMUIOVector *qiov,
                                        BdrvRequestFlags flags)
 {
-    return raw_co_prw(bs, &offset, bytes, qiov, QEMU_AIO_WRITE);
+    return raw_co_prw(bs, &offset, bytes, qiov, QEMU_AIO_WRITE, flags);
 }
 
 static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
@@ -2600,7 +2818,8 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
 
 #ifdef CONFIG_LINUX_IO_URING
     if (raw_check_linux_io_uring(s)) {
-        return luring_co_submit(bs, s->fd, 0, NULL, QEMU_AIO_FLUSH);
+        return luring_co_submit(bs, s->fd, s->luring_fixed_fd, 0, NULL,
+                                QEMU_AIO_FLUSH, 0, false);
     }
 #endif
 #ifdef CONFIG_LINUX_AIO
@@ -2619,11 +2838,47 @@ static void raw_close(BlockDriverState *bs)
 #if defined(CONFIG_BLKZONED)
         g_free(bs->wps);
 #endif
-        qemu_close(s->fd);
-        s->fd = -1;
+        raw_close_fd(s);
     }
+    if (s->extent_cache.enabled) {
+        qemu_mutex_destroy(&s->extent_cache.lock);
+        g_free(s->extent_cache.extents);
+        s->extent_cache.enabled = false;
+    }
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring_fixed_bufs) {
+        ram_block_discard_disable(false);
+        s->use_linux_io_uring_fixed_bufs = false;
+    }
+#endif
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+static bool raw_register_buf(BlockDriverState *bs, void *host, size_t size,
+                             Error **errp)
+{
+    BDRVRawState *s = bs->opaque;
+
+    /*
+     * Registration is only an optimization, so it never fails.  RAM discards
+     * were disabled at open time (see raw_open_common()).
+     */
+    if (s->use_linux_io_uring_fixed_bufs) {
+        luring_register_buf(host, size);
+    }
+    return true;
+}
+
+static void raw_unregister_buf(BlockDriverState *bs, void *host, size_t size)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->use_linux_io_uring_fixed_bufs) {
+        luring_unregister_buf(host, size);
+    }
+}
+#endif
+
 /**
  * Truncates the given regular file @fd to @offset and, when growing, fills the
  * new space according to @prealloc.
@@ -2666,7 +2921,9 @@ static int coroutine_fn raw_co_truncate(BlockDriverState *bs, int64_t offset,
 
     if (S_ISREG(st.st_mode)) {
         /* Always resizes to the exact @offset */
-        return raw_regular_truncate(bs, s->fd, offset, prealloc, errp);
+        ret = raw_regular_truncate(bs, s->fd, offset, prealloc, errp);
+        raw_extent_cache_invalidate(s, 0, INT64_MAX);
+        return ret;
     }
 
     if (prealloc != PREALLOC_MODE_OFF) {
@@ -3175,6 +3432,164 @@ static int find_allocation(BlockDriverState *bs, off_t start,
 #endif
 }
 
+static void raw_extent_cache_invalidate(BDRVRawState *s, int64_t offset,
+                                        int64_t bytes)
+{
+    RawExtentCache *c = &s->extent_cache;
+
+    if (!c->enabled) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&c->lock);
+    c->gen++;
+    if (c->nb_extents &&
+        offset < c->extents[c->nb_extents - 1].end &&
+        c->extents[0].start < offset + MIN(bytes, INT64_MAX - offset))
+    {
+        c->nb_extents = 0;
+    }
+}
+
+/*
+ * Convert @ext, which must contain @start, to the return value of
+ * find_allocation().
+ */
+static int raw_extent_to_allocation(const RawExtent *ext, off_t start,
+                                    off_t *data, off_t *hole)
+{
+    assert(ext->start <= start && start < ext->end);
+
+    if (ext->data) {
+        *data = start;
+        *hole = ext->end;
+    } else if (ext->end == INT64_MAX) {
+        return -ENXIO;
+    } else {
+        *hole = start;
+        *data = ext->end;
+    }
+    return 0;
+}
+
+/*
+ * Add the @nb_extents extents in @extents to the cache.  If they continue
+ * the cached window, they are appended to it and the oldest extents make
+ * room if necessary; otherwise they replace it.  Caller must hold c->lock.
+ */
+static void raw_extent_cache_add(RawExtentCache *c, const RawExtent *extents,
+                                 int nb_extents)
+{
+    int drop;
+
+    if (!c->nb_extents ||
+        c->extents[c->nb_extents - 1].end != extents[0].start)
+    {
+        c->nb_extents = 0;
+    }
+
+    drop = c->nb_extents + nb_extents - RAW_EXTENT_CACHE_SIZE;
+    if (drop > 0) {
+        c->nb_extents -= drop;
+        memmove(c->extents, c->extents + drop,
+                c->nb_extents * sizeof(RawExtent));
+    }
+
+    memcpy(c->extents + c->nb_extents, extents,
+           nb_extents * sizeof(RawExtent));
+    c->nb_extents += nb_extents;
+}
+
+/*
+ * Like find_allocation(), but answer from the extent cache if possible.  On a
+ * miss, the next few extents starting at @start are read into the cache.
+ *
+ * Holes are only cached as long as nobody else may write to the file, because
+ * reporting a hole for data that was written behind our back would make
+ * callers skip that data.  Data extents are always cached: a hole punched
+ * behind our back being reported as data is harmless.
+ */
+static int raw_find_allocation(BlockDriverState *bs, off_t start,
+                               off_t *data, off_t *hole)
+{
+    BDRVRawState *s = bs->opaque;
+    RawExtentCache *c = &s->extent_cache;
+    RawExtent extents[RAW_EXTENT_CACHE_FILL];
+    bool cache_holes = !(s->shared_perm & BLK_PERM_WRITE);
+    int nb_extents = 0, nb_cached;
+    uint64_t gen;
+    off_t pos = start;
+    int ret = 0;
+
+    if (!c->enabled) {
+        return find_allocation(bs, start, data, hole);
+    }
+
+    WITH_QEMU_LOCK_GUARD(&c->lock) {
+        if (c->nb_extents && c->extents[0].start <= start &&
+            start < c->extents[c->nb_extents - 1].end)
+        {
+            int lo = 0, hi = c->nb_extents - 1;
+
+            while (lo < hi) {
+                int mid = (lo + hi) / 2;
+
+                if (c->extents[mid].end <= start) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            /* Holes cached before the permissions changed don't count */
+            if (c->extents[lo].data || cache_holes) {
+                return raw_extent_to_allocation(&c->extents[lo], start, data,
+                                                hole);
+            }
+        }
+        gen = c->gen;
+    }
+
+    while (nb_extents < RAW_EXTENT_CACHE_FILL) {
+        off_t next_data, next_hole;
+        RawExtent *ext = &extents[nb_extents];
+
+        ret = find_allocation(bs, pos, &next_data, &next_hole);
+        if (ret == -ENXIO) {
+            *ext = (RawExtent) { .start = pos, .end = INT64_MAX };
+        } else if (ret < 0) {
+            break;
+        } else if (next_data == pos) {
+            *ext = (RawExtent) { .start = pos, .end = next_hole, .data = true };
+        } else {
+            *ext = (RawExtent) { .start = pos, .end = next_data };
+        }
+        nb_extents++;
+        pos = ext->end;
+        if (ext->end == INT64_MAX || (!ext->data && !cache_holes)) {
+            break;
+        }
+    }
+
+    if (!nb_extents) {
+        /* Nothing learned, pass on the error of find_allocation() */
+        return ret;
+    }
+
+    /* Without cache_holes, only the last extent can be a hole */
+    nb_cached = nb_extents;
+    if (!cache_holes && !extents[nb_extents - 1].data) {
+        nb_cached--;
+    }
+
+    WITH_QEMU_LOCK_GUARD(&c->lock) {
+        if (c->gen == gen && nb_cached) {
+            raw_extent_cache_add(c, extents, nb_cached);
+        }
+    }
+
+    return raw_extent_to_allocation(&extents[0], start, data, hole);
+}
+
 /*
  * Returns the allocation status of the specified offset.
  *
@@ -3211,7 +3626,7 @@ static int coroutine_fn raw_co_block_status(BlockDriverState *bs,
         return BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID;
     }
 
-    ret = find_allocation(bs, offset, &data, &hole);
+    ret = raw_find_allocation(bs, offset, &data, &hole);
     if (ret == -ENXIO) {
         /* Trailing hole */
         *pnum = bytes;
@@ -3540,7 +3955,7 @@ static int coroutine_fn raw_co_zone_append(BlockDriverState *bs,
     }
 
     trace_zbd_zone_append(bs, *offset >> BDRV_SECTOR_BITS);
-    return raw_co_prw(bs, offset, len, qiov, QEMU_AIO_ZONE_APPEND);
+    return raw_co_prw(bs, offset, len, qiov, QEMU_AIO_ZONE_APPEND, 0);
 }
 #endif
 
@@ -3565,6 +3980,7 @@ raw_do_pdiscard(BlockDriverState *bs, int64_t offset, int64_t bytes,
     }
 
     ret = raw_thread_pool_submit(handle_aiocb_discard, &acb);
+    raw_extent_cache_invalidate(s, offset, bytes);
     raw_account_discard(s, bytes, ret);
     return ret;
 }
@@ -3582,6 +3998,7 @@ raw_do_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int64_t bytes,
     BDRVRawState *s = bs->opaque;
     RawPosixAIOData acb;
     ThreadPoolFunc *handler;
+    int ret;
 
 #ifdef CONFIG_FALLOCATE
     if (offset + bytes > bs->total_sectors * BDRV_SECTOR_SIZE) {
@@ -3639,7 +4056,9 @@ raw_do_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int64_t bytes,
         handler = handle_aiocb_write_zeroes;
     }
 
-    return raw_thread_pool_submit(handler, &acb);
+    ret = raw_thread_pool_submit(handler, &acb);
+    raw_extent_cache_invalidate(s, offset, bytes);
+    return ret;
 }
 
 static int coroutine_fn raw_co_pwrite_zeroes(
@@ -3809,15 +4228,19 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
-        qemu_close(s->fd);
+        raw_close_fd(s);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
+        raw_register_fd(s);
     }
     s->perm_change_fd = 0;
 
     raw_handle_perm_lock(bs, RAW_PL_COMMIT, perm, shared, NULL);
     s->perm = perm;
     s->shared_perm = shared;
+
+    /* Others may have been allowed to write to the file */
+    raw_extent_cache_invalidate(s, 0, INT64_MAX);
 }
 
 static void raw_abort_perm_update(BlockDriverState *bs)
@@ -3853,6 +4276,7 @@ raw_co_copy_range_to(BlockDriverState *bs,
     RawPosixAIOData acb;
     BDRVRawState *s = bs->opaque;
     BDRVRawState *src_s;
+    int ret;
 
     assert(dst->bs == bs);
     if (src->bs->drv->bdrv_co_copy_range_to != raw_co_copy_range_to) {
@@ -3876,7 +4300,9 @@ raw_co_copy_range_to(BlockDriverState *bs,
         },
     };
 
-    return raw_thread_pool_submit(handle_aiocb_copy_range, &acb);
+    ret = raw_thread_pool_submit(handle_aiocb_copy_range, &acb);
+    raw_extent_cache_invalidate(s, dst_offset, bytes);
+    return ret;
 }
 
 BlockDriver bdrv_file = {
@@ -3906,6 +4332,10 @@ BlockDriver bdrv_file = {
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
     .bdrv_refresh_limits = raw_refresh_limits,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
+#endif
 
     .bdrv_co_truncate                   = raw_co_truncate,
     .bdrv_co_getlength                  = raw_co_getlength,
@@ -4270,6 +4700,10 @@ static BlockDriver bdrv_host_device = {
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
     .bdrv_refresh_limits = raw_refresh_limits,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
+#endif
 
     .bdrv_co_truncate                   = raw_co_truncate,
     .bdrv_co_getlength                  = raw_co_getlength,
@@ -577,6 +577,39 @@ void bdrv_drain_all(void)
     bdrv_drain_all_end();
 }
 
+/* Shard index + 1 of the current thread, 0 if not assigned yet */
+QEMU_DEFINE_STATIC_CO_TLS(unsigned, tracked_shard)
+static unsigned tracked_shard_next;
+
+static BdrvTrackedRequestShard *tracked_request_shard(BlockDriverState *bs)
+{
+    unsigned idx = get_tracked_shard();
+
+    if (!idx) {
+        idx = qatomic_fetch_inc(&tracked_shard_next) % BDRV_TRACKED_SHARDS + 1;
+        set_tracked_shard(idx);
+    }
+    return &bs->tracked_shards[idx - 1];
+}
+
+static void tracked_requests_lock_all(BlockDriverState *bs)
+{
+    int i;
+
+    for (i = 0; i < BDRV_TRACKED_SHARDS; i++) {
+        qemu_mutex_lock(&bs->tracked_shards[i].lock);
+    }
+}
+
+static void tracked_requests_unlock_all(BlockDriverState *bs)
+{
+    int i;
+
+    for (i = BDRV_TRACKED_SHARDS - 1; i >= 0; i--) {
+        qemu_mutex_unlock(&bs->tracked_shards[i].lock);
+    }
+}
+
 /**
  * Remove an active request from the tracked requests list
  *
@@ -584,22 +617,37 @@ void bdrv_drain_all(void)
  */
 static void coroutine_fn tracked_request_end(BdrvTrackedRequest *req)
 {
+    BdrvTrackedRequestShard *shard = req->shard;
+
     if (req->serialising) {
         qatomic_dec(&req->bs->serialising_in_flight);
     }
 
-    qemu_mutex_lock(&req->bs->reqs_lock);
+    qemu_mutex_lock(&shard->lock);
     QLIST_REMOVE(req, list);
-    qemu_mutex_unlock(&req->bs->reqs_lock);
+    interval_tree_remove(&req->node, &shard->tree);
+    qemu_mutex_unlock(&shard->lock);
 
     /*
      * At this point qemu_co_queue_wait(&req->wait_queue, ...) won't be called
      * anymore because the request has been removed from the list, so it's safe
-     * to restart the queue outside reqs_lock to minimize the critical section.
+     * to restart the queue outside the shard lock to minimize the critical
+     * section.
      */
     qemu_co_queue_restart_all(&req->wait_queue);
 }
 
+/*
+ * Set the interval of @req->node from its overlap range.  Zero-length
+ * requests are indexed as one byte; tracked_request_overlaps() still decides
+ * about actual overlaps.
+ */
+static void tracked_request_set_node(BdrvTrackedRequest *req)
+{
+    req->node.start = req->overlap_offset;
+    req->node.last = req->overlap_offset + MAX(req->overlap_bytes, 1) - 1;
+}
+
 /**
  * Add an active request to the tracked requests list
  */
@@ -613,6 +661,7 @@ static void coroutine_fn tracked_request_begin(BdrvTrackedRequest *req,
 
     *req = (BdrvTrackedRequest){
         .bs = bs,
+        .shard          = tracked_request_shard(bs),
         .offset         = offset,
         .bytes          = bytes,
         .type           = type,
@@ -623,10 +672,12 @@ static void coroutine_fn tracked_request_begin(BdrvTrackedRequest *req,
     };
 
     qemu_co_queue_init(&req->wait_queue);
+    tracked_request_set_node(req);
 
-    qemu_mutex_lock(&bs->reqs_lock);
-    QLIST_INSERT_HEAD(&bs->tracked_requests, req, list);
-    qemu_mutex_unlock(&bs->reqs_lock);
+    qemu_mutex_lock(&req->shard->lock);
+    QLIST_INSERT_HEAD(&req->shard->requests, req, list);
+    interval_tree_insert(&req->node, &req->shard->tree);
+    qemu_mutex_unlock(&req->shard->lock);
 }
 
 static bool tracked_request_overlaps(BdrvTrackedRequest *req,
@@ -645,33 +696,46 @@ static bool tracked_request_overlaps(BdrvTrackedRequest *req,
     return true;
 }
 
-/* Called with self->bs->reqs_lock held */
+/* Called with the locks of all tracked request shards of self->bs held */
 static coroutine_fn BdrvTrackedRequest *
 bdrv_find_conflicting_request(BdrvTrackedRequest *self)
 {
-    BdrvTrackedRequest *req;
+    IntervalTreeNode *node;
+    int i;
 
-    QLIST_FOREACH(req, &self->bs->tracked_requests, list) {
-        if (req == self || (!req->serialising && !self->serialising)) {
-            continue;
-        }
-        if (tracked_request_overlaps(req, self->overlap_offset,
-                                     self->overlap_bytes))
+    for (i = 0; i < BDRV_TRACKED_SHARDS; i++) {
+        IntervalTreeRoot *root = &self->bs->tracked_shards[i].tree;
+
+        for (node = interval_tree_iter_first(root, self->node.start,
+                                             self->node.last);
+             node;
+             node = interval_tree_iter_next(node, self->node.start,
+                                            self->node.last))
         {
-            /*
-             * Hitting this means there was a reentrant request, for
-             * example, a block driver issuing nested requests.  This must
-             * never happen since it means deadlock.
-             */
-            assert(qemu_coroutine_self() != req->co);
+            BdrvTrackedRequest *req =
+                container_of(node, BdrvTrackedRequest, node);
 
-            /*
-             * If the request is already (indirectly) waiting for us, or
-             * will wait for us as soon as it wakes up, then just go on
-             * (instead of producing a deadlock in the former case).
-             */
-            if (!req->waiting_for) {
-                return req;
+            if (req == self || (!req->serialising && !self->serialising)) {
+                continue;
+            }
+            if (tracked_request_overlaps(req, self->overlap_offset,
+                                         self->overlap_bytes))
+            {
+                /*
+                 * Hitting this means there was a reentrant request, for
+                 * example, a block driver issuing nested requests.  This must
+                 * never happen since it means deadlock.
+                 */
+                assert(qemu_coroutine_self() != req->co);
+
+                /*
+                 * If the request is already (indirectly) waiting for us, or
+                 * will wait for us as soon as it wakes up, then just go on
+                 * (instead of producing a deadlock in the former case).
+                 */
+                if (!req->waiting_for) {
+                    return req;
+                }
             }
         }
     }
@@ -679,20 +743,38 @@ bdrv_find_conflicting_request(BdrvTrackedRequest *self)
     return NULL;
 }
 
-/* Called with self->bs->reqs_lock held */
+/* Called with the locks of all tracked request shards of self->bs held */
 static void coroutine_fn
 bdrv_wait_serialising_requests_locked(BdrvTrackedRequest *self)
 {
+    BlockDriverState *bs = self->bs;
     BdrvTrackedRequest *req;
+    BdrvTrackedRequestShard *shard;
+    int i;
 
     while ((req = bdrv_find_conflicting_request(self))) {
         self->waiting_for = req;
-        qemu_co_queue_wait(&req->wait_queue, &self->bs->reqs_lock);
+
+        /*
+         * Only keep the lock of @req's shard, which protects against @req
+         * completing before we are queued on it.  @req may be gone when we
+         * wake up, so don't look at it after waiting.
+         */
+        shard = req->shard;
+        for (i = BDRV_TRACKED_SHARDS - 1; i >= 0; i--) {
+            if (&bs->tracked_shards[i] != shard) {
+                qemu_mutex_unlock(&bs->tracked_shards[i].lock);
+            }
+        }
+        qemu_co_queue_wait(&req->wait_queue, &shard->lock);
+        qemu_mutex_unlock(&shard->lock);
+        tracked_requests_lock_all(bs);
+
         self->waiting_for = NULL;
     }
 }
 
-/* Called with req->bs->reqs_lock held */
+/* Called with the locks of all tracked request shards of req->bs held */
 static void tracked_request_set_serialising(BdrvTrackedRequest *req,
                                             uint64_t align)
 {
@@ -707,8 +789,15 @@ static void tracked_request_set_serialising(BdrvTrackedRequest *req,
         req->serialising = true;
     }
 
-    req->overlap_offset = MIN(req->overlap_offset, overlap_offset);
-    req->overlap_bytes = MAX(req->overlap_bytes, overlap_bytes);
+    if (overlap_offset < req->overlap_offset ||
+        overlap_bytes > req->overlap_bytes)
+    {
+        interval_tree_remove(&req->node, &req->shard->tree);
+        req->overlap_offset = MIN(req->overlap_offset, overlap_offset);
+        req->overlap_bytes = MAX(req->overlap_bytes, overlap_bytes);
+        tracked_request_set_node(req);
+        interval_tree_insert(&req->node, &req->shard->tree);
+    }
 }
 
 /**
@@ -719,17 +808,34 @@ BdrvTrackedRequest *coroutine_fn bdrv_co_get_self_request(BlockDriverState *bs)
 {
     BdrvTrackedRequest *req;
     Coroutine *self = qemu_coroutine_self();
+    int i;
     IO_CODE();
 
-    QLIST_FOREACH(req, &bs->tracked_requests, list) {
-        if (req->co == self) {
-            return req;
+    for (i = 0; i < BDRV_TRACKED_SHARDS; i++) {
+        QLIST_FOREACH(req, &bs->tracked_shards[i].requests, list) {
+            if (req->co == self) {
+                return req;
+            }
         }
     }
 
     return NULL;
 }
 
+bool bdrv_has_tracked_requests(BlockDriverState *bs)
+{
+    int i;
+    IO_CODE();
+
+    for (i = 0; i < BDRV_TRACKED_SHARDS; i++) {
+        if (!QLIST_EMPTY(&bs->tracked_shards[i].requests)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 /**
  * Round a region to subcluster (if supported) or cluster boundaries
  */
@@ -790,9 +896,9 @@ bdrv_wait_serialising_requests(BdrvTrackedRequest *self)
         return;
     }
 
-    qemu_mutex_lock(&bs->reqs_lock);
+    tracked_requests_lock_all(bs);
     bdrv_wait_serialising_requests_locked(self);
-    qemu_mutex_unlock(&bs->reqs_lock);
+    tracked_requests_unlock_all(bs);
 }
 
 void coroutine_fn bdrv_make_request_serialising(BdrvTrackedRequest *req,
@@ -800,12 +906,12 @@ void coroutine_fn bdrv_make_request_serialising(BdrvTrackedRequest *req,
 {
     IO_CODE();
 
-    qemu_mutex_lock(&req->bs->reqs_lock);
+    tracked_requests_lock_all(req->bs);
 
     tracked_request_set_serialising(req, align);
     bdrv_wait_serialising_requests_locked(req);
 
-    qemu_mutex_unlock(&req->bs->reqs_lock);
+    tracked_requests_unlock_all(req->bs);
 }
 
 int bdrv_check_qiov_request(int64_t offset, int64_t bytes,
@@ -1975,15 +2081,19 @@ bdrv_co_write_req_prepare(BdrvChild *child, int64_t offset, int64_t bytes,
     assert(!((flags & BDRV_REQ_NO_WAIT) && !(flags & BDRV_REQ_SERIALISING)));
 
     if (flags & BDRV_REQ_SERIALISING) {
-        QEMU_LOCK_GUARD(&bs->reqs_lock);
+        int64_t cluster_size = bdrv_get_cluster_size(bs);
+
+        tracked_requests_lock_all(bs);
 
-        tracked_request_set_serialising(req, bdrv_get_cluster_size(bs));
+        tracked_request_set_serialising(req, cluster_size);
 
         if ((flags & BDRV_REQ_NO_WAIT) && bdrv_find_conflicting_request(req)) {
+            tracked_requests_unlock_all(bs);
             return -EBUSY;
         }
 
         bdrv_wait_serialising_requests_locked(req);
+        tracked_requests_unlock_all(bs);
     } else {
         bdrv_wait_serialising_requests(req);
     }
@@ -16,6 +16,11 @@
 #include "block/raw-aio.h"
 #include "qemu/coroutine.h"
 #include "qemu/defer-call.h"
+#include "qemu/bitmap.h"
+#include "qemu/error-report.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
 #include "sysemu/block-backend.h"
 #include "trace.h"
@@ -23,8 +28,45 @@
 /* Only used for assertions.  */
 #include "qemu/coroutine_int.h"
 
-/* io_uring ring size */
-#define MAX_ENTRIES 128
+/* Default io_uring ring size */
+#define LURING_DEFAULT_ENTRIES 128
+
+/*
+ * Size of the sparse fixed file table of each ring.  Like buffer slots (see
+ * below), file slots are allocated globally so that the same slot refers to
+ * the same file in every ring, and users can remember the slot of their file.
+ */
+#define LURING_MAX_FIXED_FILES 64
+
+/*
+ * Registered buffers: RAM regions passed to luring_register_buf() are split
+ * into chunks of at most LURING_FIXED_BUF_SIZE (the kernel's limit for a
+ * single registered buffer), which occupy consecutive slots of the sparse
+ * buffer table.  The buffers are registered once with luring_buf_ring and
+ * cloned into the buffer table of every ring, so the same slot refers to the
+ * same memory in every ring.
+ */
+#define LURING_MAX_FIXED_BUFS 1024
+#define LURING_MAX_FIXED_REGIONS 64
+#define LURING_FIXED_BUF_SIZE (1 * GiB)
+
+typedef struct LuringFixedRegion {
+    void *host;             /* NULL if unused */
+    size_t size;
+    unsigned int first_slot;
+    unsigned int refcnt;    /* number of luring_register_buf() callers */
+} LuringFixedRegion;
+
+/*
+ * The regions registered with a ring, sorted by address.  Replaced as a
+ * whole when regions come and go, so that requests can look up their buffer
+ * under RCU.
+ */
+typedef struct LuringFixedBufs {
+    struct rcu_head rcu;
+    unsigned int nr;
+    LuringFixedRegion regions[];
+} LuringFixedBufs;
 
 typedef struct LuringAIOCB {
     Coroutine *co;
@@ -54,12 +96,462 @@ struct LuringState {
 
     struct io_uring ring;
 
+    /* Number of submission queue entries */
+    unsigned int entries;
+
+    /*
+     * IOPOLL rings never signal completions, they are reaped by busy polling
+     * the ring from the AioContext while requests are in flight.
+     */
+    bool iopoll;
+    bool busy_polling;
+
     /* No locking required, only accessed from AioContext home thread */
     LuringQueue io_q;
 
     QEMUBH *completion_bh;
+
+    /* Protected by luring_lock */
+    QLIST_ENTRY(LuringState) next;
+
+    /*
+     * Fixed files and buffers are looked up by the home thread without
+     * locks, but changed by the main loop with luring_lock held when files
+     * are opened and closed or guest RAM is (un)plugged.
+     */
+    bool has_fixed_files;
+    int fixed_fds[LURING_MAX_FIXED_FILES];  /* -1 if the slot is unused */
+    bool fixed_regions[LURING_MAX_FIXED_REGIONS]; /* registered here? */
+    LuringFixedBufs *fixed_bufs;                  /* RCU */
 };
 
+/*
+ * Protects luring_states, luring_files, luring_regions, luring_buf_slots and
+ * luring_buf_ring, and serializes updates to the fixed tables of the rings
+ */
+static QemuMutex luring_lock;
+static QLIST_HEAD(, LuringState) luring_states =
+    QLIST_HEAD_INITIALIZER(luring_states);
+static int luring_files[LURING_MAX_FIXED_FILES];  /* -1 if the slot is unused */
+static LuringFixedRegion luring_regions[LURING_MAX_FIXED_REGIONS];
+static DECLARE_BITMAP(luring_buf_slots, LURING_MAX_FIXED_BUFS);
+
+static void __attribute__((__constructor__)) luring_init_globals(void)
+{
+    int i;
+
+    qemu_mutex_init(&luring_lock);
+    for (i = 0; i < LURING_MAX_FIXED_FILES; i++) {
+        luring_files[i] = -1;
+    }
+}
+
+#ifdef CONFIG_LIBURING_CLONE_BUFFERS
+/*
+ * The ring that owns the registered buffers; it is never used for I/O.  The
+ * rings that do I/O clone its buffer table, which shares the pinned pages
+ * instead of pinning and accounting them once per ring.  Protected by
+ * luring_lock.
+ */
+static struct io_uring luring_buf_ring;
+static int luring_buf_ring_state; /* 0: not set up, 1: ready, -1: failed */
+
+static int luring_region_cmp(const void *a, const void *b)
+{
+    const LuringFixedRegion *ra = a, *rb = b;
+
+    return ra->host < rb->host ? -1 : ra->host > rb->host;
+}
+
+/*
+ * Publish the regions registered with @s for luring_fixed_buf().  Called
+ * with luring_lock held.
+ */
+static void luring_publish_fixed_bufs(LuringState *s)
+{
+    LuringFixedBufs *old = s->fixed_bufs;
+    LuringFixedBufs *bufs;
+    int i;
+
+    bufs = g_malloc(sizeof(*bufs) +
+                    LURING_MAX_FIXED_REGIONS * sizeof(bufs->regions[0]));
+    bufs->nr = 0;
+    for (i = 0; i < LURING_MAX_FIXED_REGIONS; i++) {
+        if (s->fixed_regions[i]) {
+            bufs->regions[bufs->nr++] = luring_regions[i];
+        }
+    }
+    qsort(bufs->regions, bufs->nr, sizeof(bufs->regions[0]),
+          luring_region_cmp);
+
+    qatomic_rcu_set(&s->fixed_bufs, bufs);
+    if (old) {
+        g_free_rcu(old, rcu);
+    }
+}
+
+/*
+ * Copy the slots of @r from luring_buf_ring to the buffer table of @s.  Empty
+ * slots are copied as well, which is how regions are removed from @s.  Called
+ * with luring_lock held.
+ */
+static int luring_clone_region(LuringState *s, LuringFixedRegion *r)
+{
+    unsigned int nr = DIV_ROUND_UP(r->size, LURING_FIXED_BUF_SIZE);
+    int ret;
+
+    ret = io_uring_clone_buffers_offset(&s->ring, &luring_buf_ring,
+                                        r->first_slot, r->first_slot, nr,
+                                        IORING_REGISTER_DST_REPLACE);
+    trace_luring_clone_buf(s, r->host, r->size, ret);
+    return ret;
+}
+
+/* Called with luring_lock held */
+static void luring_register_region(LuringState *s, LuringFixedRegion *r)
+{
+    if (luring_clone_region(s, r) < 0) {
+        return;
+    }
+
+    s->fixed_regions[r - luring_regions] = true;
+    luring_publish_fixed_bufs(s);
+}
+
+/*
+ * Called with luring_lock held, after the slots of @r have been cleared in
+ * luring_buf_ring
+ */
+static void luring_unregister_region(LuringState *s, LuringFixedRegion *r)
+{
+    if (!s->fixed_regions[r - luring_regions]) {
+        return;
+    }
+
+    s->fixed_regions[r - luring_regions] = false;
+    luring_publish_fixed_bufs(s);
+    luring_clone_region(s, r);
+}
+
+/* Called with luring_lock held */
+static bool luring_setup_buf_ring(void)
+{
+    if (luring_buf_ring_state == 0) {
+        luring_buf_ring_state = -1;
+        if (io_uring_queue_init(1, &luring_buf_ring, 0) < 0) {
+            return false;
+        }
+        if (io_uring_register_buffers_sparse(&luring_buf_ring,
+                                             LURING_MAX_FIXED_BUFS) < 0) {
+            io_uring_queue_exit(&luring_buf_ring);
+            return false;
+        }
+        luring_buf_ring_state = 1;
+    }
+    return luring_buf_ring_state > 0;
+}
+
+/*
+ * Register the existing regions with a new ring.  Called with luring_lock
+ * held.
+ */
+static void luring_init_fixed_bufs(LuringState *s)
+{
+    int i;
+
+    for (i = 0; i < LURING_MAX_FIXED_REGIONS; i++) {
+        if (luring_regions[i].host) {
+            luring_register_region(s, &luring_regions[i]);
+        }
+    }
+}
+
+/**
+ * luring_fixed_buf:
+ *
+ * Return the registered buffer slot that contains [@buf, @buf + @len), or -1
+ * if the request cannot use a registered buffer.
+ */
+static int luring_fixed_buf(LuringState *s, void *buf, size_t len)
+{
+    LuringFixedBufs *bufs;
+    LuringFixedRegion *r;
+    unsigned int lo, hi;
+    size_t offset;
+
+    RCU_READ_LOCK_GUARD();
+
+    bufs = qatomic_rcu_read(&s->fixed_bufs);
+    if (!bufs) {
+        return -1;
+    }
+
+    /* Find the last region that starts at or before @buf */
+    lo = 0;
+    hi = bufs->nr;
+    while (lo < hi) {
+        unsigned int mid = (lo + hi) / 2;
+
+        if (bufs->regions[mid].host <= buf) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return -1;
+    }
+    r = &bufs->regions[lo - 1];
+
+    /* The request must not cross into the next chunk */
+    offset = buf - r->host;
+    if (offset >= r->size || offset + len > r->size ||
+        offset / LURING_FIXED_BUF_SIZE !=
+        (offset + len - 1) / LURING_FIXED_BUF_SIZE) {
+        return -1;
+    }
+    return r->first_slot + offset / LURING_FIXED_BUF_SIZE;
+}
+
+void luring_register_buf(void *host, size_t size)
+{
+    unsigned int nr = DIV_ROUND_UP(size, LURING_FIXED_BUF_SIZE);
+    g_autofree struct iovec *iov = NULL;
+    LuringFixedRegion *r = NULL;
+    LuringState *s;
+    unsigned long slot;
+    int i, ret;
+
+    QEMU_LOCK_GUARD(&luring_lock);
+    for (i = 0; i < LURING_MAX_FIXED_REGIONS; i++) {
+        if (luring_regions[i].host == host &&
+            luring_regions[i].size == size) {
+            /* already registered by another BlockDriverState */
+            luring_regions[i].refcnt++;
+            return;
+        }
+        if (!luring_regions[i].host && !r) {
+            r = &luring_regions[i];
+        }
+    }
+
+    slot = bitmap_find_next_zero_area(luring_buf_slots, LURING_MAX_FIXED_BUFS,
+                                      0, nr, 0);
+    if (!r || slot >= LURING_MAX_FIXED_BUFS || !luring_setup_buf_ring()) {
+        return;
+    }
+
+    iov = g_new(struct iovec, nr);
+    for (i = 0; i < nr; i++) {
+        size_t offset = (size_t)i * LURING_FIXED_BUF_SIZE;
+
+        iov[i].iov_base = host + offset;
+        iov[i].iov_len = MIN(size - offset, LURING_FIXED_BUF_SIZE);
+    }
+
+    /* Pinning may fail, e.g. because of RLIMIT_MEMLOCK; it's only a hint */
+    ret = io_uring_register_buffers_update_tag(&luring_buf_ring, slot, iov,
+                                               NULL, nr);
+    trace_luring_register_buf(host, size, slot, nr, ret);
+    if (ret < 0) {
+        return;
+    }
+
+    bitmap_set(luring_buf_slots, slot, nr);
+    *r = (LuringFixedRegion) {
+        .host = host,
+        .size = size,
+        .first_slot = slot,
+        .refcnt = 1,
+    };
+
+    QLIST_FOREACH(s, &luring_states, next) {
+        luring_register_region(s, r);
+    }
+}
+
+void luring_unregister_buf(void *host, size_t size)
+{
+    LuringState *s;
+    int i;
+
+    QEMU_LOCK_GUARD(&luring_lock);
+    for (i = 0; i < LURING_MAX_FIXED_REGIONS; i++) {
+        LuringFixedRegion *r = &luring_regions[i];
+        unsigned int nr = DIV_ROUND_UP(size, LURING_FIXED_BUF_SIZE);
+        g_autofree struct iovec *iov = NULL;
+
+        if (r->host != host || r->size != size) {
+            continue;
+        }
+        if (--r->refcnt > 0) {
+            return;
+        }
+
+        /* An empty iovec clears the slot of a sparse table */
+        iov = g_new0(struct iovec, nr);
+        io_uring_register_buffers_update_tag(&luring_buf_ring, r->first_slot,
+                                             iov, NULL, nr);
+        trace_luring_unregister_buf(host, size);
+
+        QLIST_FOREACH(s, &luring_states, next) {
+            luring_unregister_region(s, r);
+        }
+        bitmap_clear(luring_buf_slots, r->first_slot, nr);
+        *r = (LuringFixedRegion) {};
+        return;
+    }
+}
+#else /* !CONFIG_LIBURING_CLONE_BUFFERS */
+static void luring_init_fixed_bufs(LuringState *s)
+{
+}
+
+static int luring_fixed_buf(LuringState *s, void *buf, size_t len)
+{
+    return -1;
+}
+
+void luring_register_buf(void *host, size_t size)
+{
+}
+
+void luring_unregister_buf(void *host, size_t size)
+{
+}
+#endif /* !CONFIG_LIBURING_CLONE_BUFFERS */
+
+#ifdef CONFIG_LIBURING_REGISTER_SPARSE
+/* Called with luring_lock held */
+static void luring_register_file(LuringState *s, int slot)
+{
+    if (!s->has_fixed_files ||
+        io_uring_register_files_update(&s->ring, slot, &luring_files[slot],
+                                       1) != 1) {
+        return;
+    }
+
+    trace_luring_fixed_file(s, luring_files[slot], slot);
+    qatomic_set(&s->fixed_fds[slot], luring_files[slot]);
+}
+
+/*
+ * Set up the sparse fixed file table and the registered buffers of a new
+ * ring.  Both are optional; if the kernel does not support them, requests
+ * simply use the plain file descriptor and iovecs.
+ */
+static void luring_init_fixed(LuringState *s)
+{
+    int i;
+
+    s->has_fixed_files =
+        io_uring_register_files_sparse(&s->ring, LURING_MAX_FIXED_FILES) == 0;
+
+    qemu_mutex_lock(&luring_lock);
+    QLIST_INSERT_HEAD(&luring_states, s, next);
+    for (i = 0; i < LURING_MAX_FIXED_FILES; i++) {
+        if (luring_files[i] != -1) {
+            luring_register_file(s, i);
+        }
+    }
+    luring_init_fixed_bufs(s);
+    qemu_mutex_unlock(&luring_lock);
+}
+
+/**
+ * luring_fixed_file:
+ *
+ * Return the fixed file table slot of @fd, which luring_register_fd()
+ * returned as @fixed_fd, or -1 if the plain file descriptor must be used.
+ */
+static int luring_fixed_file(LuringState *s, int fd, int fixed_fd)
+{
+    if (fixed_fd < 0 || qatomic_read(&s->fixed_fds[fixed_fd]) != fd) {
+        return -1;
+    }
+    return fixed_fd;
+}
+
+int luring_register_fd(int fd)
+{
+    LuringState *s;
+    int slot;
+
+    QEMU_LOCK_GUARD(&luring_lock);
+    for (slot = 0; slot < LURING_MAX_FIXED_FILES; slot++) {
+        if (luring_files[slot] == -1) {
+            break;
+        }
+    }
+    if (slot == LURING_MAX_FIXED_FILES) {
+        return -1;
+    }
+
+    luring_files[slot] = fd;
+    QLIST_FOREACH(s, &luring_states, next) {
+        luring_register_file(s, slot);
+    }
+    return slot;
+}
+
+void luring_unregister_fd(int fixed_fd)
+{
+    LuringState *s;
+    int unused = -1;
+
+    if (fixed_fd < 0) {
+        return;
+    }
+
+    QEMU_LOCK_GUARD(&luring_lock);
+    QLIST_FOREACH(s, &luring_states, next) {
+        if (s->fixed_fds[fixed_fd] != -1) {
+            qatomic_set(&s->fixed_fds[fixed_fd], -1);
+            io_uring_register_files_update(&s->ring, fixed_fd, &unused, 1);
+        }
+    }
+    luring_files[fixed_fd] = -1;
+}
+#else /* !CONFIG_LIBURING_REGISTER_SPARSE */
+static void luring_init_fixed(LuringState *s)
+{
+    qemu_mutex_lock(&luring_lock);
+    QLIST_INSERT_HEAD(&luring_states, s, next);
+    luring_init_fixed_bufs(s);
+    qemu_mutex_unlock(&luring_lock);
+}
+
+static int luring_fixed_file(LuringState *s, int fd, int fixed_fd)
+{
+    return -1;
+}
+
+int luring_register_fd(int fd)
+{
+    return -1;
+}
+
+void luring_unregister_fd(int fixed_fd)
+{
+}
+#endif /* !CONFIG_LIBURING_REGISTER_SPARSE */
+
+static void luring_update_busy_poll(LuringState *s)
+{
+    bool busy = s->iopoll && s->io_q.in_flight > 0;
+
+    if (busy == s->busy_polling) {
+        return;
+    }
+
+    s->busy_polling = busy;
+    if (busy) {
+        aio_busy_poll_inc(s->aio_context);
+    } else {
+        aio_busy_poll_dec(s->aio_context);
+    }
+}
+
 /**
  * luring_resubmit:
  *
@@ -102,8 +594,14 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
 
     /* Update sqe */
     luringcb->sqeq.off += nread;
-    luringcb->sqeq.addr = (uintptr_t)luringcb->resubmit_qiov.iov;
-    luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
+    if (luringcb->sqeq.opcode == IORING_OP_READ_FIXED) {
+        /* Registered buffers use a single buffer instead of an iovec */
+        luringcb->sqeq.addr += nread;
+        luringcb->sqeq.len -= nread;
+    } else {
+        luringcb->sqeq.addr = (uintptr_t)luringcb->resubmit_qiov.iov;
+        luringcb->sqeq.len = luringcb->resubmit_qiov.niov;
+    }
 
     luring_resubmit(s, luringcb);
 }
@@ -222,6 +720,7 @@ end:
     }
 
     qemu_bh_cancel(s->completion_bh);
+    luring_update_busy_poll(s);
 
     defer_call_end();
 }
@@ -259,6 +758,7 @@ static int ioq_submit(LuringState *s)
         s->io_q.in_queue  -= ret;
     }
     s->io_q.blocked = (s->io_q.in_queue > 0);
+    luring_update_busy_poll(s);
 
     if (s->io_q.in_flight) {
         /*
@@ -295,6 +795,13 @@ static bool qemu_luring_poll_cb(void *opaque)
 {
     LuringState *s = opaque;
 
+    if (s->busy_polling) {
+        struct io_uring_cqe *cqe;
+
+        /* For IOPOLL rings this enters the kernel to reap completions */
+        return io_uring_peek_cqe(&s->ring, &cqe) == 0;
+    }
+
     return io_uring_cq_ready(&s->ring);
 }
 
@@ -326,34 +833,61 @@ static void luring_deferred_fn(void *opaque)
 /**
  * luring_do_submit:
  * @fd: file descriptor for I/O
+ * @fixed_fd: registered file slot of @fd, or -1
  * @luringcb: AIO control block
  * @s: AIO state
  * @offset: offset for request
  * @type: type of request
+ * @flags: request flags
  *
  * Fetches sqes from ring, adds to pending queue and preps them
  *
  */
-static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
-                            uint64_t offset, int type)
+static int luring_do_submit(int fd, int fixed_fd, LuringAIOCB *luringcb,
+                            LuringState *s, uint64_t offset, int type,
+                            int flags)
 {
     int ret;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
+    QEMUIOVector *qiov = luringcb->qiov;
+    int buf_index = -1;
+
+    fixed_fd = luring_fixed_file(s, fd, fixed_fd);
+    if (fixed_fd >= 0) {
+        fd = fixed_fd;
+    }
+
+    /*
+     * Guest RAM is registered with the ring, so the kernel does not need to
+     * pin the pages of each request.  Only single-buffer requests can use
+     * that, the fixed opcodes take no iovec.
+     */
+    if ((flags & BDRV_REQ_REGISTERED_BUF) && qiov->niov == 1) {
+        buf_index = luring_fixed_buf(s, qiov->iov[0].iov_base,
+                                     qiov->iov[0].iov_len);
+    }
 
     switch (type) {
     case QEMU_AIO_WRITE:
-        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
-                             luringcb->qiov->niov, offset);
-        break;
     case QEMU_AIO_ZONE_APPEND:
-        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
-                             luringcb->qiov->niov, offset);
+        if (buf_index >= 0) {
+            io_uring_prep_write_fixed(sqes, fd, qiov->iov[0].iov_base,
+                                      qiov->iov[0].iov_len, offset, buf_index);
+        } else {
+            io_uring_prep_writev(sqes, fd, qiov->iov, qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_READ:
-        io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
-                            luringcb->qiov->niov, offset);
+        if (buf_index >= 0) {
+            io_uring_prep_read_fixed(sqes, fd, qiov->iov[0].iov_base,
+                                     qiov->iov[0].iov_len, offset, buf_index);
+        } else {
+            io_uring_prep_readv(sqes, fd, qiov->iov, qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_FLUSH:
+        /* IOPOLL rings only support reads and writes */
+        assert(!s->iopoll);
         io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
         break;
     default:
@@ -361,6 +895,9 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                         __func__, type);
         abort();
     }
+    if (fixed_fd >= 0) {
+        sqes->flags |= IOSQE_FIXED_FILE;
+    }
     io_uring_sqe_set_data(sqes, luringcb);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
@@ -368,7 +905,7 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
     trace_luring_do_submit(s, s->io_q.blocked, s->io_q.in_queue,
                            s->io_q.in_flight);
     if (!s->io_q.blocked) {
-        if (s->io_q.in_flight + s->io_q.in_queue >= MAX_ENTRIES) {
+        if (s->io_q.in_flight + s->io_q.in_queue >= s->entries) {
             ret = ioq_submit(s);
             trace_luring_do_submit_done(s, ret);
             return ret;
@@ -379,12 +916,14 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
     return 0;
 }
 
-int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
-                                  QEMUIOVector *qiov, int type)
+int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, int fixed_fd,
+                                  uint64_t offset, QEMUIOVector *qiov,
+                                  int type, int flags, bool iopoll)
 {
     int ret;
     AioContext *ctx = qemu_get_current_aio_context();
-    LuringState *s = aio_get_linux_io_uring(ctx);
+    LuringState *s = iopoll ? aio_get_linux_io_uring_iopoll(ctx) :
+                              aio_get_linux_io_uring(ctx);
     LuringAIOCB luringcb = {
         .co         = qemu_coroutine_self(),
         .ret        = -EINPROGRESS,
@@ -393,7 +932,7 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
     };
     trace_luring_co_submit(bs, s, &luringcb, fd, offset, qiov ? qiov->size : 0,
                            type);
-    ret = luring_do_submit(fd, &luringcb, s, offset, type);
+    ret = luring_do_submit(fd, fixed_fd, &luringcb, s, offset, type, flags);
 
     if (ret < 0) {
         return ret;
@@ -407,6 +946,10 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
 
 void luring_detach_aio_context(LuringState *s, AioContext *old_context)
 {
+    if (s->busy_polling) {
+        aio_busy_poll_dec(old_context);
+        s->busy_polling = false;
+    }
     aio_set_fd_handler(old_context, s->ring.ring_fd,
                        NULL, NULL, NULL, NULL, s);
     qemu_bh_delete(s->completion_bh);
@@ -422,21 +965,46 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
                        qemu_luring_poll_cb, qemu_luring_poll_ready, s);
 }
 
-LuringState *luring_init(Error **errp)
+LuringState *luring_init(unsigned int entries, unsigned int sqpoll_idle,
+                         bool iopoll, Error **errp)
 {
-    int rc;
+    int rc, i;
     LuringState *s = g_new0(LuringState, 1);
     struct io_uring *ring = &s->ring;
+    struct io_uring_params params = {};
 
     trace_luring_init_state(s, sizeof(*s));
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    s->entries = entries ?: LURING_DEFAULT_ENTRIES;
+    s->iopoll = iopoll;
+    if (sqpoll_idle) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = sqpoll_idle;
+    }
+    if (iopoll) {
+        params.flags |= IORING_SETUP_IOPOLL;
+    }
+
+    rc = io_uring_queue_init_params(s->entries, ring, &params);
+    if (rc == -EPERM && sqpoll_idle) {
+        /* Kernels before 5.11 only allow SQPOLL for privileged processes */
+        warn_report_once("io_uring submission queue polling is not permitted, "
+                         "continuing without it");
+        params.flags &= ~IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = 0;
+        rc = io_uring_queue_init_params(s->entries, ring, &params);
+    }
     if (rc < 0) {
         error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
         g_free(s);
         return NULL;
     }
 
+    for (i = 0; i < LURING_MAX_FIXED_FILES; i++) {
+        s->fixed_fds[i] = -1;
+    }
+    luring_init_fixed(s);
+
     ioq_init(&s->io_q);
     return s;
 
@@ -444,7 +1012,12 @@ LuringState *luring_init(Error **errp)
 
 void luring_cleanup(LuringState *s)
 {
+    qemu_mutex_lock(&luring_lock);
+    QLIST_REMOVE(s, next);
+    qemu_mutex_unlock(&luring_lock);
+
     io_uring_queue_exit(&s->ring);
+    g_free(s->fixed_bufs);
     trace_luring_cleanup_state(s);
     g_free(s);
 }
@@ -15,6 +15,7 @@
 #include "qemu/cutils.h"
 #include "qemu/coroutine.h"
 #include "qemu/range.h"
+#include "qemu/stats64.h"
 #include "trace.h"
 #include "block/blockjob_int.h"
 #include "block/block_int.h"
@@ -94,6 +95,26 @@ typedef struct MirrorBlockJob {
     bool prepared;
     bool in_drain;
     bool base_ro;
+
+    /*
+     * Look for allocated areas of the source while copying instead of
+     * before, and copy several dirty areas per iteration.
+     */
+    bool background_scan;
+    /* Everything below scan_offset has been looked at by mirror_scan() */
+    int64_t scan_offset;
+    /* Copy of scan_offset for mirror_query() */
+    Stat64 scanned;
+
+    /*
+     * Try copy offloading for data copies; cleared after the first copy
+     * that the source and target can't offload.
+     */
+    bool copy_offload;
+    bool copy_offload_requested;
+    /* Bytes copied with copy offloading, and with read/write */
+    Stat64 offloaded_bytes;
+    Stat64 copied_bytes;
 } MirrorBlockJob;
 
 typedef struct MirrorBDSOpaque {
@@ -266,6 +287,9 @@ static void coroutine_fn mirror_read_complete(MirrorOp *op, int ret)
     }
 
     ret = blk_co_pwritev(s->target, op->offset, op->qiov.size, &op->qiov, 0);
+    if (ret >= 0) {
+        stat64_add(&s->copied_bytes, op->bytes);
+    }
     mirror_write_complete(op, ret);
 }
 
@@ -398,6 +422,27 @@ static void coroutine_fn mirror_co_read(void *opaque)
     op->is_in_flight = true;
     trace_mirror_one_iteration(s, op->offset, op->bytes);
 
+    if (s->copy_offload) {
+        WITH_GRAPH_RDLOCK_GUARD() {
+            ret = blk_co_copy_range_from(s->mirror_top_bs->backing, op->offset,
+                                         s->target, op->offset, op->bytes,
+                                         0, 0);
+        }
+        if (ret >= 0) {
+            stat64_add(&s->offloaded_bytes, op->bytes);
+            mirror_iteration_done(op, ret);
+            return;
+        }
+
+        /*
+         * The failure may just mean that the source and target can't offload
+         * copies to each other; if it is a real I/O error, the buffered copy
+         * below will report it.
+         */
+        trace_mirror_copy_offload_fail(s, op->offset, ret);
+        s->copy_offload = false;
+    }
+
     WITH_GRAPH_RDLOCK_GUARD() {
         ret = bdrv_co_preadv(s->mirror_top_bs->backing, op->offset, op->bytes,
                              &op->qiov, 0);
@@ -629,6 +674,20 @@ fail:
     g_free(pseudo_op);
 }
 
+/*
+ * Start copying dirty areas until buf_size bytes are in flight, all
+ * in-flight slots are taken, or there is nothing left to copy.
+ */
+static void coroutine_fn GRAPH_UNLOCKED mirror_iteration_window(MirrorBlockJob *s)
+{
+    do {
+        mirror_iteration(s);
+    } while (s->ret >= 0 && !job_is_cancelled(&s->common.job) &&
+             s->bytes_in_flight < s->buf_size &&
+             s->in_flight < MAX_IN_FLIGHT && s->buf_free_count > 0 &&
+             bdrv_get_dirty_count(s->dirty_bitmap) > 0);
+}
+
 static void mirror_free_init(MirrorBlockJob *s)
 {
     int granularity = s->granularity;
@@ -836,20 +895,61 @@ static void coroutine_fn mirror_throttle(MirrorBlockJob *s)
     }
 }
 
-static int coroutine_fn GRAPH_UNLOCKED mirror_dirty_init(MirrorBlockJob *s)
+/*
+ * Mark the areas allocated in the source from s->scan_offset on as dirty,
+ * until the end of the source or until @dirty_limit bytes are dirty.
+ */
+static int coroutine_fn GRAPH_UNLOCKED
+mirror_scan(MirrorBlockJob *s, int64_t dirty_limit)
 {
-    int64_t offset;
     BlockDriverState *bs;
-    BlockDriverState *target_bs = blk_bs(s->target);
-    int ret = -1;
+    int ret = 0;
     int64_t count;
 
     bdrv_graph_co_rdlock();
     bs = s->mirror_top_bs->backing->bs;
     bdrv_graph_co_rdunlock();
 
+    while (s->scan_offset < s->bdev_length &&
+           bdrv_get_dirty_count(s->dirty_bitmap) < dirty_limit) {
+        /* Just to make sure we are not exceeding int limit. */
+        int bytes = MIN(s->bdev_length - s->scan_offset,
+                        QEMU_ALIGN_DOWN(INT_MAX, s->granularity));
+
+        mirror_throttle(s);
+
+        if (job_is_cancelled(&s->common.job)) {
+            break;
+        }
+
+        WITH_GRAPH_RDLOCK_GUARD() {
+            ret = bdrv_co_is_allocated_above(bs, s->base_overlay, true,
+                                             s->scan_offset, bytes, &count);
+        }
+        if (ret < 0) {
+            break;
+        }
+
+        assert(count);
+        if (ret > 0) {
+            bdrv_set_dirty_bitmap(s->dirty_bitmap, s->scan_offset, count);
+        }
+        s->scan_offset += count;
+    }
+
+    trace_mirror_scan(s, s->scan_offset, bdrv_get_dirty_count(s->dirty_bitmap));
+    stat64_set(&s->scanned, s->scan_offset);
+    return ret < 0 ? ret : 0;
+}
+
+static int coroutine_fn GRAPH_UNLOCKED mirror_dirty_init(MirrorBlockJob *s)
+{
+    int64_t offset;
+    BlockDriverState *target_bs = blk_bs(s->target);
+
     if (s->zero_target) {
         if (!bdrv_can_write_zeroes_with_unmap(target_bs)) {
+            /* Everything is copied, there is no need to scan */
             bdrv_set_dirty_bitmap(s->dirty_bitmap, 0, s->bdev_length);
             return 0;
         }
@@ -882,32 +982,12 @@ static int coroutine_fn GRAPH_UNLOCKED mirror_dirty_init(MirrorBlockJob *s)
     }
 
     /* First part, loop on the sectors and initialize the dirty bitmap.  */
-    for (offset = 0; offset < s->bdev_length; ) {
-        /* Just to make sure we are not exceeding int limit. */
-        int bytes = MIN(s->bdev_length - offset,
-                        QEMU_ALIGN_DOWN(INT_MAX, s->granularity));
-
-        mirror_throttle(s);
-
-        if (job_is_cancelled(&s->common.job)) {
-            return 0;
-        }
-
-        WITH_GRAPH_RDLOCK_GUARD() {
-            ret = bdrv_co_is_allocated_above(bs, s->base_overlay, true, offset,
-                                             bytes, &count);
-        }
-        if (ret < 0) {
-            return ret;
-        }
-
-        assert(count);
-        if (ret > 0) {
-            bdrv_set_dirty_bitmap(s->dirty_bitmap, offset, count);
-        }
-        offset += count;
+    s->scan_offset = 0;
+    if (s->background_scan) {
+        /* mirror_run() scans as it goes */
+        return 0;
     }
-    return 0;
+    return mirror_scan(s, INT64_MAX);
 }
 
 /* Called when going out of the streaming phase to flush the bulk of the
@@ -1020,6 +1100,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
     mirror_free_init(s);
 
     s->last_pause_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    s->scan_offset = s->bdev_length;
     if (!s->is_none_mode) {
         ret = mirror_dirty_init(s);
         if (ret < 0 || job_is_cancelled(&s->common.job)) {
@@ -1038,6 +1119,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
     for (;;) {
         int64_t cnt, delta;
         bool should_complete;
+        bool scanning;
 
         if (s->ret < 0) {
             ret = s->ret;
@@ -1051,6 +1133,16 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
             goto immediate_exit;
         }
 
+        /* Keep the scan at least one buffer ahead of the copy */
+        scanning = s->scan_offset < s->bdev_length;
+        if (scanning && bdrv_get_dirty_count(s->dirty_bitmap) < s->buf_size) {
+            ret = mirror_scan(s, s->buf_size);
+            if (ret < 0) {
+                goto immediate_exit;
+            }
+            scanning = s->scan_offset < s->bdev_length;
+        }
+
         cnt = bdrv_get_dirty_count(s->dirty_bitmap);
         /* cnt is the number of dirty bytes remaining and s->bytes_in_flight is
          * the number of bytes currently being processed; together those are
@@ -1074,13 +1166,15 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
                 trace_mirror_yield(s, cnt, s->buf_free_count, s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
                 continue;
+            } else if (cnt != 0 && s->background_scan) {
+                mirror_iteration_window(s);
             } else if (cnt != 0) {
                 mirror_iteration(s);
             }
         }
 
         should_complete = false;
-        if (s->in_flight == 0 && cnt == 0) {
+        if (s->in_flight == 0 && cnt == 0 && !scanning) {
             trace_mirror_before_flush(s);
             if (!job_is_ready(&s->common.job)) {
                 if (mirror_flush(s) < 0) {
@@ -1132,7 +1226,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
             /* The two disks are in sync.  Exit and report successful
              * completion.
              */
-            assert(QLIST_EMPTY(&bs->tracked_requests));
+            assert(!bdrv_has_tracked_requests(bs));
             need_drain = false;
             break;
         }
@@ -1297,6 +1391,12 @@ static void mirror_query(BlockJob *job, BlockJobInfo *info)
 
     info->u.mirror = (BlockJobInfoMirror) {
         .actively_synced = qatomic_read(&s->actively_synced),
+        .has_scanned = s->background_scan,
+        .scanned = stat64_get(&s->scanned),
+        .has_offloaded_bytes = s->copy_offload_requested,
+        .offloaded_bytes = stat64_get(&s->offloaded_bytes),
+        .has_copied_bytes = s->copy_offload_requested,
+        .copied_bytes = stat64_get(&s->copied_bytes),
     };
 }
 
@@ -1318,6 +1418,18 @@ static const BlockJobDriver mirror_job_driver = {
     .query                  = mirror_query,
 };
 
+static void commit_active_query(BlockJob *job, BlockJobInfo *info)
+{
+    MirrorBlockJob *s = container_of(job, MirrorBlockJob, common);
+
+    info->u.commit = (BlockJobInfoCommit) {
+        .has_offloaded_bytes = s->copy_offload_requested,
+        .offloaded_bytes = stat64_get(&s->offloaded_bytes),
+        .has_copied_bytes = s->copy_offload_requested,
+        .copied_bytes = stat64_get(&s->copied_bytes),
+    };
+}
+
 static const BlockJobDriver commit_active_job_driver = {
     .job_driver = {
         .instance_size          = sizeof(MirrorBlockJob),
@@ -1332,6 +1444,7 @@ static const BlockJobDriver commit_active_job_driver = {
         .cancel                 = commit_active_cancel,
     },
     .drained_poll           = mirror_drained_poll,
+    .query                  = commit_active_query,
 };
 
 static void coroutine_fn
@@ -1722,8 +1835,8 @@ static BlockJob *mirror_start_job(
                              bool is_none_mode, BlockDriverState *base,
                              bool auto_complete, const char *filter_node_name,
                              bool is_mirror, MirrorCopyMode copy_mode,
-                             bool base_ro,
-                             Error **errp)
+                             bool base_ro, bool background_scan,
+                             bool copy_offload, Error **errp)
 {
     MirrorBlockJob *s;
     MirrorBDSOpaque *bs_opaque;
@@ -1887,6 +2000,9 @@ static BlockJob *mirror_start_job(
     s->granularity = granularity;
     s->buf_size = ROUND_UP(buf_size, granularity);
     s->unmap = unmap;
+    s->background_scan = background_scan;
+    s->copy_offload = copy_offload;
+    s->copy_offload_requested = copy_offload;
     if (auto_complete) {
         s->should_complete = true;
     }
@@ -2013,7 +2129,8 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
                   bool unmap, const char *filter_node_name,
-                  MirrorCopyMode copy_mode, Error **errp)
+                  MirrorCopyMode copy_mode, bool background_scan,
+                  bool copy_offload, Error **errp)
 {
     bool is_none_mode;
     BlockDriverState *base;
@@ -2036,7 +2153,8 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                      speed, granularity, buf_size, backing_mode, zero_target,
                      on_source_error, on_target_error, unmap, NULL, NULL,
                      &mirror_job_driver, is_none_mode, base, false,
-                     filter_node_name, true, copy_mode, false, errp);
+                     filter_node_name, true, copy_mode, false,
+                     background_scan, copy_offload, errp);
 }
 
 BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
@@ -2044,7 +2162,8 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
                               int64_t speed, BlockdevOnError on_error,
                               const char *filter_node_name,
                               BlockCompletionFunc *cb, void *opaque,
-                              bool auto_complete, Error **errp)
+                              bool auto_complete, bool copy_offload,
+                              Error **errp)
 {
     bool base_read_only;
     BlockJob *job;
@@ -2065,7 +2184,7 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
                      on_error, on_error, true, cb, opaque,
                      &commit_active_job_driver, false, base, auto_complete,
                      filter_node_name, false, MIRROR_COPY_MODE_BACKGROUND,
-                     base_read_only, errp);
+                     base_read_only, false, copy_offload, errp);
     if (!job) {
         goto error_restore_flags;
     }
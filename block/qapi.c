@@ -586,6 +586,22 @@ static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
         = bdrv_latency_histogram_stats(&hgram[BLOCK_ACCT_ZONE_APPEND]);
     ds->flush_latency_histogram
         = bdrv_latency_histogram_stats(&hgram[BLOCK_ACCT_FLUSH]);
+
+    if (blk_get_public(blk)->throttle_group_member.throttle_state) {
+        ThrottleGroupMember *tgm = &blk_get_public(blk)->throttle_group_member;
+
+        ds->has_rd_throttled_operations = true;
+        ds->has_rd_throttled_time_ns = true;
+        throttle_group_get_stats(tgm, THROTTLE_READ,
+                                 &ds->rd_throttled_operations,
+                                 &ds->rd_throttled_time_ns);
+
+        ds->has_wr_throttled_operations = true;
+        ds->has_wr_throttled_time_ns = true;
+        throttle_group_get_stats(tgm, THROTTLE_WRITE,
+                                 &ds->wr_throttled_operations,
+                                 &ds->wr_throttled_time_ns);
+    }
 }
 
 static BlockStats * GRAPH_RDLOCK
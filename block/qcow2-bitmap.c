@@ -1471,7 +1471,7 @@ int coroutine_fn qcow2_co_remove_persistent_dirty_bitmap(BlockDriverState *bs,
         return 0;
     }
 
-    qemu_co_mutex_lock(&s->lock);
+    qcow2_co_lock(s);
 
     bm_list = bitmap_list_load(bs, s->bitmap_directory_offset,
                                s->bitmap_directory_size, errp);
@@ -1498,7 +1498,7 @@ int coroutine_fn qcow2_co_remove_persistent_dirty_bitmap(BlockDriverState *bs,
     free_bitmap_clusters(bs, &bm->table);
 
 out:
-    qemu_co_mutex_unlock(&s->lock);
+    qcow2_co_unlock(s);
 
     bitmap_free(bm);
     bitmap_list_free(bm_list);
@@ -31,8 +31,14 @@
 typedef struct Qcow2CachedTable {
     int64_t  offset;
     uint64_t lru_counter;
+    /* Number of lookups since the table was loaded */
+    uint64_t uses;
     int      ref;
     bool     dirty;
+    /* Set when the table is used, cleared when the clock hand passes by */
+    bool     referenced;
+    /* Next entry in the same hash bucket, or -1 */
+    int      hash_next;
 } Qcow2CachedTable;
 
 struct Qcow2Cache {
@@ -44,8 +50,26 @@ struct Qcow2Cache {
     void                   *table_array;
     uint64_t                lru_counter;
     uint64_t                cache_clean_lru_counter;
+
+    /* Hash index from table offset to entry, chained through hash_next */
+    int                    *buckets;
+    int                     hash_bits;
+    /* Next entry to consider for eviction */
+    int                     clock_hand;
+
+    uint64_t                hits;
+    uint64_t                misses;
+
+    /* Set while a table is being prefetched */
+    bool                    prefetching;
 };
 
+typedef struct Qcow2CachePrefetch {
+    BlockDriverState *bs;
+    Qcow2Cache *c;
+    uint64_t index;
+} Qcow2CachePrefetch;
+
 static inline void *qcow2_cache_get_table_addr(Qcow2Cache *c, int table)
 {
     return (uint8_t *) c->table_array + (size_t) table * c->table_size;
@@ -59,6 +83,81 @@ static inline int qcow2_cache_get_table_idx(Qcow2Cache *c, void *table)
     return idx;
 }
 
+static inline unsigned qcow2_cache_hash(Qcow2Cache *c, uint64_t offset)
+{
+    uint64_t table = offset / c->table_size;
+
+    return (table * 0x9e3779b97f4a7c15ULL) >> (64 - c->hash_bits);
+}
+
+static int qcow2_cache_lookup(Qcow2Cache *c, uint64_t offset)
+{
+    int i;
+
+    for (i = c->buckets[qcow2_cache_hash(c, offset)]; i != -1;
+         i = c->entries[i].hash_next) {
+        if (c->entries[i].offset == offset) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Change the offset of entry @i, keeping the hash index up to date */
+static void qcow2_cache_set_offset(Qcow2Cache *c, int i, int64_t offset)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+    int *p;
+
+    if (t->offset) {
+        for (p = &c->buckets[qcow2_cache_hash(c, t->offset)]; *p != i;
+             p = &c->entries[*p].hash_next) {
+            assert(*p != -1);
+        }
+        *p = t->hash_next;
+        t->hash_next = -1;
+    }
+
+    t->offset = offset;
+    t->uses = 0;
+
+    if (offset) {
+        p = &c->buckets[qcow2_cache_hash(c, offset)];
+        t->hash_next = *p;
+        *p = i;
+    }
+}
+
+/*
+ * Pick an unused entry to evict with the CLOCK algorithm: entries that
+ * have been used since the hand last passed get a second chance.
+ */
+static int qcow2_cache_find_victim(Qcow2Cache *c)
+{
+    int n;
+
+    /* After one full sweep all the reference bits are cleared */
+    for (n = 0; n < 2 * c->size; n++) {
+        int i = c->clock_hand;
+        Qcow2CachedTable *t = &c->entries[i];
+
+        if (++c->clock_hand == c->size) {
+            c->clock_hand = 0;
+        }
+
+        if (t->ref) {
+            continue;
+        }
+        if (t->referenced) {
+            t->referenced = false;
+            continue;
+        }
+        return i;
+    }
+
+    return -1;
+}
+
 static inline const char *qcow2_cache_get_name(BDRVQcow2State *s, Qcow2Cache *c)
 {
     if (c == s->refcount_block_cache) {
@@ -106,8 +205,9 @@ void qcow2_cache_clean_unused(Qcow2Cache *c)
 
         /* And count how many we can clean in a row */
         while (i < c->size && can_clean_entry(c, i)) {
-            c->entries[i].offset = 0;
+            qcow2_cache_set_offset(c, i, 0);
             c->entries[i].lru_counter = 0;
+            c->entries[i].referenced = false;
             i++;
             to_clean++;
         }
@@ -125,6 +225,7 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
 {
     BDRVQcow2State *s = bs->opaque;
     Qcow2Cache *c;
+    int i;
 
     assert(num_tables > 0);
     assert(is_power_of_2(table_size));
@@ -138,11 +239,23 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
     c->table_array = qemu_try_blockalign(bs->file->bs,
                                          (size_t) num_tables * c->table_size);
 
-    if (!c->entries || !c->table_array) {
+    /* Keep the load factor of the hash index at or below 1/2 */
+    c->hash_bits = ctz64(pow2ceil((uint64_t) num_tables * 2));
+    c->buckets = g_try_new(int, 1 << c->hash_bits);
+
+    if (!c->entries || !c->table_array || !c->buckets) {
         qemu_vfree(c->table_array);
         g_free(c->entries);
+        g_free(c->buckets);
         g_free(c);
-        c = NULL;
+        return NULL;
+    }
+
+    for (i = 0; i < (1 << c->hash_bits); i++) {
+        c->buckets[i] = -1;
+    }
+    for (i = 0; i < num_tables; i++) {
+        c->entries[i].hash_next = -1;
     }
 
     return c;
@@ -158,6 +271,7 @@ int qcow2_cache_destroy(Qcow2Cache *c)
 
     qemu_vfree(c->table_array);
     g_free(c->entries);
+    g_free(c->buckets);
     g_free(c);
 
     return 0;
@@ -309,8 +423,9 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
 
     for (i = 0; i < c->size; i++) {
         assert(c->entries[i].ref == 0);
-        c->entries[i].offset = 0;
+        qcow2_cache_set_offset(c, i, 0);
         c->entries[i].lru_counter = 0;
+        c->entries[i].referenced = false;
     }
 
     qcow2_cache_table_release(c, 0, c->size);
@@ -327,9 +442,6 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     BDRVQcow2State *s = bs->opaque;
     int i;
     int ret;
-    int lookup_index;
-    uint64_t min_lru_counter = UINT64_MAX;
-    int min_lru_index = -1;
 
     assert(offset != 0);
 
@@ -344,29 +456,21 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     }
 
     /* Check if the table is already cached */
-    i = lookup_index = (offset / c->table_size * 4) % c->size;
-    do {
-        const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
-        }
-        if (t->ref == 0 && t->lru_counter < min_lru_counter) {
-            min_lru_counter = t->lru_counter;
-            min_lru_index = i;
-        }
-        if (++i == c->size) {
-            i = 0;
-        }
-    } while (i != lookup_index);
+    i = qcow2_cache_lookup(c, offset);
+    if (i != -1) {
+        c->hits++;
+        goto found;
+    }
+    c->misses++;
 
-    if (min_lru_index == -1) {
+    i = qcow2_cache_find_victim(c);
+    if (i == -1) {
         /* This can't happen in current synchronous code, but leave the check
          * here as a reminder for whoever starts using AIO with the cache */
         abort();
     }
 
     /* Cache miss: write a table back and replace it */
-    i = min_lru_index;
     trace_qcow2_cache_get_replace_entry(qemu_coroutine_self(),
                                         c == s->l2_table_cache, i);
 
@@ -377,7 +481,7 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
+    qcow2_cache_set_offset(c, i, 0);
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
@@ -390,11 +494,12 @@ qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
         }
     }
 
-    c->entries[i].offset = offset;
+    qcow2_cache_set_offset(c, i, offset);
 
     /* And return the right table */
 found:
     c->entries[i].ref++;
+    c->entries[i].uses++;
     *table = qcow2_cache_get_table_addr(c, i);
 
     trace_qcow2_cache_get_done(qemu_coroutine_self(),
@@ -424,6 +529,7 @@ void qcow2_cache_put(Qcow2Cache *c, void **table)
 
     if (c->entries[i].ref == 0) {
         c->entries[i].lru_counter = ++c->lru_counter;
+        c->entries[i].referenced = true;
     }
 
     assert(c->entries[i].ref >= 0);
@@ -438,12 +544,41 @@ void qcow2_cache_entry_mark_dirty(Qcow2Cache *c, void *table)
 
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset)
 {
-    int i;
+    int i = qcow2_cache_lookup(c, offset);
 
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].offset == offset) {
+    return i == -1 ? NULL : qcow2_cache_get_table_addr(c, i);
+}
+
+/*
+ * Return the table at @offset if it is cached, without s->lock and without
+ * taking a reference.  The entries may change while this runs, so the caller
+ * must validate the result as described for BDRVQcow2State.meta_writers.
+ * Only the fields that decide about eviction and cleaning are updated, and
+ * only if needed, so that concurrent lookups don't write to shared cache
+ * lines all the time.
+ */
+void *qcow2_cache_peek(Qcow2Cache *c, uint64_t offset, bool count_use)
+{
+    int i, n;
+
+    /* Bound the walk in case a hash chain is being relinked */
+    i = qatomic_read(&c->buckets[qcow2_cache_hash(c, offset)]);
+    for (n = 0; i != -1 && n < c->size; n++) {
+        Qcow2CachedTable *t = &c->entries[i];
+
+        if (t->offset == offset) {
+            if (!qatomic_read(&t->referenced)) {
+                qatomic_set(&t->referenced, true);
+            }
+            if (t->lru_counter <= c->cache_clean_lru_counter) {
+                t->lru_counter = c->cache_clean_lru_counter + 1;
+            }
+            if (count_use) {
+                t->uses++;
+            }
             return qcow2_cache_get_table_addr(c, i);
         }
+        i = qatomic_read(&t->hash_next);
     }
     return NULL;
 }
@@ -454,9 +589,169 @@ void qcow2_cache_discard(Qcow2Cache *c, void *table)
 
     assert(c->entries[i].ref == 0);
 
-    c->entries[i].offset = 0;
+    qcow2_cache_set_offset(c, i, 0);
     c->entries[i].lru_counter = 0;
+    c->entries[i].referenced = false;
     c->entries[i].dirty = false;
 
     qcow2_cache_table_release(c, i, 1);
 }
+
+/*
+ * Returns the offset of the table that @index currently maps to, or 0 if
+ * there is none.  @index is a guest offset for the L2 table cache and a
+ * refcount table index for the refcount block cache.  Must be called with
+ * s->lock held.
+ */
+static uint64_t qcow2_cache_prefetch_offset(BlockDriverState *bs,
+                                            Qcow2Cache *c, uint64_t index)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t offset, l1_index;
+
+    if (c == s->l2_table_cache) {
+        l1_index = offset_to_l1_index(s, index);
+        if (l1_index >= s->l1_size) {
+            return 0;
+        }
+        offset = s->l1_table[l1_index] & L1E_OFFSET_MASK;
+    } else {
+        if (index >= s->refcount_table_size) {
+            return 0;
+        }
+        offset = s->refcount_table[index] & REFT_OFFSET_MASK;
+    }
+
+    if (!offset || offset_into_cluster(s, offset)) {
+        return 0;
+    }
+
+    if (c == s->l2_table_cache) {
+        offset += l2_entry_size(s) * (offset_to_l2_index(s, index) -
+                                      offset_to_l2_slice_index(s, index));
+    }
+    return offset;
+}
+
+static void coroutine_fn qcow2_cache_prefetch_entry(void *opaque)
+{
+    Qcow2CachePrefetch *p = opaque;
+    BlockDriverState *bs = p->bs;
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2Cache *c = p->c;
+    uint64_t offset;
+    void *table;
+
+    GRAPH_RDLOCK_GUARD();
+
+    qcow2_co_lock(s);
+    /*
+     * The metadata may have changed since the prefetch was scheduled, so
+     * look the table up again.  A request may also have loaded it already.
+     */
+    offset = qcow2_cache_prefetch_offset(bs, c, p->index);
+    if (offset && qcow2_cache_lookup(c, offset) == -1 &&
+        qcow2_cache_get(bs, c, offset, &table) == 0) {
+        qcow2_cache_put(c, &table);
+    }
+    c->prefetching = false;
+    qcow2_co_unlock(s);
+
+    bdrv_dec_in_flight(bs);
+    g_free(p);
+}
+
+/*
+ * Load the table that @index maps to into the cache in the background, so
+ * that the metadata read overlaps with the data I/O of the current request.
+ * @index is interpreted as in qcow2_cache_prefetch_offset().  Only one
+ * table per cache is prefetched at a time; the request is ignored if the
+ * table is already cached.
+ *
+ * Prefetching is only a hint, so callers that aren't in coroutine context
+ * with s->lock held (e.g. snapshot refcount updates) are ignored, too.
+ */
+void qcow2_cache_prefetch(BlockDriverState *bs, Qcow2Cache *c, uint64_t index)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2CachePrefetch *p;
+    uint64_t offset;
+
+    /* s->lock.holder can't be us unless we hold the lock */
+    if (!qemu_in_coroutine() ||
+        qatomic_read(&s->lock.holder) != qemu_coroutine_self() ||
+        c->prefetching) {
+        return;
+    }
+
+    offset = qcow2_cache_prefetch_offset(bs, c, index);
+    if (!offset || !QEMU_IS_ALIGNED(offset, c->table_size) ||
+        qcow2_cache_lookup(c, offset) != -1) {
+        return;
+    }
+
+    trace_qcow2_cache_prefetch(qemu_coroutine_self(),
+                               c == s->l2_table_cache, offset);
+
+    p = g_new(Qcow2CachePrefetch, 1);
+    *p = (Qcow2CachePrefetch) {
+        .bs = bs,
+        .c = c,
+        .index = index,
+    };
+    c->prefetching = true;
+
+    bdrv_inc_in_flight(bs);
+    aio_co_enter(bdrv_get_aio_context(bs),
+                 qemu_coroutine_create(qcow2_cache_prefetch_entry, p));
+}
+
+void qcow2_cache_get_stats(Qcow2Cache *c, uint64_t *hits, uint64_t *misses)
+{
+    *hits = c->hits;
+    *misses = c->misses;
+}
+
+int qcow2_cache_get_size(Qcow2Cache *c)
+{
+    return c->size;
+}
+
+static int qcow2_cache_compare_uses(const void *a, const void *b)
+{
+    const Qcow2CachedTable *ta = a, *tb = b;
+
+    if (ta->uses != tb->uses) {
+        return ta->uses > tb->uses ? -1 : 1;
+    }
+    if (ta->lru_counter != tb->lru_counter) {
+        return ta->lru_counter > tb->lru_counter ? -1 : 1;
+    }
+    return 0;
+}
+
+/*
+ * Return the offsets of all cached tables, most used first (and most
+ * recently used first among tables with the same number of uses).  The
+ * number of tables is stored in @nb_tables; the caller must free the array.
+ */
+uint64_t *qcow2_cache_get_hot_tables(Qcow2Cache *c, int *nb_tables)
+{
+    g_autofree Qcow2CachedTable *tables = g_new(Qcow2CachedTable, c->size);
+    uint64_t *offsets;
+    int i, n = 0;
+
+    for (i = 0; i < c->size; i++) {
+        if (c->entries[i].offset) {
+            tables[n++] = c->entries[i];
+        }
+    }
+    qsort(tables, n, sizeof(tables[0]), qcow2_cache_compare_uses);
+
+    offsets = g_new(uint64_t, n);
+    for (i = 0; i < n; i++) {
+        offsets[i] = tables[i].offset;
+    }
+    *nb_tables = n;
+    return offsets;
+}
@@ -29,6 +29,7 @@
 #include "qapi/error.h"
 #include "qcow2.h"
 #include "qemu/bswap.h"
+#include "qemu/cutils.h"
 #include "qemu/memalign.h"
 #include "trace.h"
 
@@ -83,12 +84,24 @@ fail:
     return ret;
 }
 
+typedef struct Qcow2OldL1Table {
+    struct rcu_head rcu;
+    uint64_t *l1_table;
+} Qcow2OldL1Table;
+
+static void qcow2_free_old_l1_table(Qcow2OldL1Table *old)
+{
+    qemu_vfree(old->l1_table);
+    g_free(old);
+}
+
 int qcow2_grow_l1_table(BlockDriverState *bs, uint64_t min_size,
                         bool exact_size)
 {
     BDRVQcow2State *s = bs->opaque;
     int new_l1_size2, ret, i;
     uint64_t *new_l1_table;
+    Qcow2OldL1Table *old_l1_table;
     int64_t old_l1_table_offset, old_l1_size;
     int64_t new_l1_table_offset, new_l1_size;
     uint8_t data[12];
@@ -177,12 +190,21 @@ int qcow2_grow_l1_table(BlockDriverState *bs, uint64_t min_size,
     if (ret < 0) {
         goto fail;
     }
-    qemu_vfree(s->l1_table);
+    /*
+     * qcow2_try_get_host_offset() may still be looking at the old table.
+     * It reads l1_size before l1_table, so publish the table first, and
+     * free the old one only after a grace period that starts once nobody
+     * can pick it up any more.
+     */
+    old_l1_table = g_new(Qcow2OldL1Table, 1);
+    old_l1_table->l1_table = s->l1_table;
     old_l1_table_offset = s->l1_table_offset;
     s->l1_table_offset = new_l1_table_offset;
-    s->l1_table = new_l1_table;
+    qatomic_rcu_set(&s->l1_table, new_l1_table);
+    smp_wmb();
     old_l1_size = s->l1_size;
-    s->l1_size = new_l1_size;
+    qatomic_set(&s->l1_size, new_l1_size);
+    call_rcu(old_l1_table, qcow2_free_old_l1_table, rcu);
     qcow2_free_clusters(bs, old_l1_table_offset, old_l1_size * L1E_SIZE,
                         QCOW2_DISCARD_OTHER);
     return 0;
@@ -219,6 +241,25 @@ l2_load(BlockDriverState *bs, uint64_t offset,
                            (void **)l2_slice);
 }
 
+/*
+ * Detect sequential access to the L2 slices and, when a lookup moves on
+ * to the slice following the previous one, prefetch the next slice into
+ * the cache so that its load overlaps with the data I/O of this request.
+ */
+static void l2_readahead(BlockDriverState *bs, uint64_t offset)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int slice_bits = s->cluster_bits + ctz32(s->l2_slice_size);
+    unsigned long slice = offset >> slice_bits;
+    bool sequential = slice == s->l2_readahead_slice + 1;
+
+    qatomic_set(&s->l2_readahead_slice, slice);
+    if (sequential) {
+        qcow2_cache_prefetch(bs, s->l2_table_cache,
+                             ((offset >> slice_bits) + 1) << slice_bits);
+    }
+}
+
 /*
  * Writes an L1 entry to disk (note that depending on the alignment
  * requirements this function may write more that just one entry in
@@ -428,6 +469,53 @@ qcow2_get_subcluster_range_type(BlockDriverState *bs, uint64_t l2_entry,
     }
 }
 
+/*
+ * Return how many of the @nb_clusters L2 entries starting at @l2_index
+ * continue the run of @type that starts with @l2_entry in the previous
+ * entry: their whole cluster has the same type and, for types with a host
+ * offset, they follow that entry in the image file.  Only entries that
+ * differ from @l2_entry in nothing but the offset are counted, which covers
+ * the common case with a vectorized scan; the caller must check the
+ * remaining entries one by one.
+ */
+static int count_continuing_l2_entries(BDRVQcow2State *s, uint64_t *l2_slice,
+                                       unsigned l2_index, int nb_clusters,
+                                       uint64_t l2_entry,
+                                       QCow2SubclusterType type)
+{
+    size_t stride = l2_entry_size(s) / sizeof(uint64_t);
+    uint64_t *entries = l2_slice + l2_index * stride;
+    uint64_t delta = 0, l2_bitmap;
+    size_t n;
+
+    switch (type) {
+    case QCOW2_SUBCLUSTER_NORMAL:
+        delta = s->cluster_size;
+        l2_bitmap = QCOW_L2_BITMAP_ALL_ALLOC;
+        break;
+    case QCOW2_SUBCLUSTER_ZERO_ALLOC:
+        delta = s->cluster_size;
+        /* fall through */
+    case QCOW2_SUBCLUSTER_ZERO_PLAIN:
+        l2_bitmap = QCOW_L2_BITMAP_ALL_ZEROES;
+        break;
+    case QCOW2_SUBCLUSTER_UNALLOCATED_ALLOC:
+        delta = s->cluster_size;
+        /* fall through */
+    case QCOW2_SUBCLUSTER_UNALLOCATED_PLAIN:
+        l2_bitmap = 0;
+        break;
+    default:
+        return 0;
+    }
+
+    n = be64_run_length(entries, nb_clusters, stride, l2_entry + delta, delta);
+    if (has_subclusters(s) && n > 0) {
+        n = be64_run_length(entries + 1, n, stride, l2_bitmap, 0);
+    }
+    return n;
+}
+
 /*
  * Return the number of contiguous subclusters of the exact same type
  * in a given L2 slice, starting from cluster @l2_index, subcluster
@@ -487,6 +575,14 @@ count_contiguous_subclusters(BlockDriverState *bs, int nb_clusters,
         if (first_sc + ret < s->subclusters_per_cluster) {
             break;
         }
+        if (i == 0 && nb_clusters > 1) {
+            int n = count_continuing_l2_entries(s, l2_slice, *l2_index + 1,
+                                                nb_clusters - 1, l2_entry,
+                                                type);
+            count += n * s->subclusters_per_cluster;
+            expected_offset += (uint64_t)n * s->cluster_size;
+            i += n;
+        }
     }
 
     return count;
@@ -633,6 +729,8 @@ int qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
         return -EIO;
     }
 
+    l2_readahead(bs, offset);
+
     /* load the l2 slice in memory */
 
     ret = l2_load(bs, offset, l2_offset, &l2_slice);
@@ -742,6 +840,140 @@ fail:
     return ret;
 }
 
+/*
+ * Like qcow2_get_host_offset(), but called without s->lock and only for
+ * lookups that can be answered from the L1 table and the L2 table cache as
+ * they are.  Nothing is modified, and the result is discarded if the
+ * metadata may have changed while it was looked up (see
+ * BDRVQcow2State.meta_writers).
+ *
+ * Returns -EAGAIN if the caller must take s->lock and use
+ * qcow2_get_host_offset() instead: if the L2 slice isn't cached, if the
+ * lookup raced with a change, on moving on to the slice after the last one
+ * looked up (for the readahead in qcow2_get_host_offset()), and for
+ * compressed clusters and anything that qcow2_get_host_offset() would
+ * report as corruption.
+ */
+int qcow2_try_get_host_offset(BlockDriverState *bs, uint64_t offset,
+                              unsigned int *bytes, uint64_t *host_offset,
+                              QCow2SubclusterType *subcluster_type)
+{
+    BDRVQcow2State *s = bs->opaque;
+    unsigned int l2_index, sc_index, offset_in_cluster;
+    uint64_t l1_index, l1_size, l2_offset, l2_entry, l2_bitmap;
+    uint64_t bytes_available, bytes_needed, nb_clusters, start_of_slice;
+    uint64_t cluster_offset, host = 0;
+    uint64_t *l1_table, *l2_slice;
+    unsigned long slice;
+    QCow2SubclusterType type;
+    unsigned gen;
+    int sc;
+
+    RCU_READ_LOCK_GUARD();
+
+    gen = qatomic_load_acquire(&s->meta_gen);
+    if (qatomic_load_acquire(&s->meta_writers)) {
+        return -EAGAIN;
+    }
+
+    offset_in_cluster = offset_into_cluster(s, offset);
+    bytes_needed = (uint64_t) *bytes + offset_in_cluster;
+    bytes_available =
+        ((uint64_t) (s->l2_slice_size - offset_to_l2_slice_index(s, offset)))
+        << s->cluster_bits;
+    if (bytes_needed > bytes_available) {
+        bytes_needed = bytes_available;
+    }
+
+    /* Pairs with smp_wmb() in qcow2_grow_l1_table() */
+    l1_index = offset_to_l1_index(s, offset);
+    l1_size = qatomic_read(&s->l1_size);
+    smp_rmb();
+    l1_table = qatomic_rcu_read(&s->l1_table);
+
+    if (l1_index >= l1_size) {
+        type = QCOW2_SUBCLUSTER_UNALLOCATED_PLAIN;
+        goto out;
+    }
+
+    l2_offset = l1_table[l1_index] & L1E_OFFSET_MASK;
+    if (!l2_offset) {
+        type = QCOW2_SUBCLUSTER_UNALLOCATED_PLAIN;
+        goto out;
+    }
+    /*
+     * Leave it to qcow2_get_host_offset() to trigger the L2 readahead.  A
+     * stale l2_readahead_slice only decides whether we fall back.
+     */
+    slice = offset >> (s->cluster_bits + ctz32(s->l2_slice_size));
+    if (offset_into_cluster(s, l2_offset) ||
+        slice == qatomic_read(&s->l2_readahead_slice) + 1) {
+        return -EAGAIN;
+    }
+
+    start_of_slice = l2_entry_size(s) *
+        (offset_to_l2_index(s, offset) - offset_to_l2_slice_index(s, offset));
+    l2_slice = qcow2_cache_peek(s->l2_table_cache, l2_offset + start_of_slice,
+                                s->hot_cache);
+    if (!l2_slice) {
+        return -EAGAIN;
+    }
+
+    l2_index = offset_to_l2_slice_index(s, offset);
+    sc_index = offset_to_sc_index(s, offset);
+    l2_entry = get_l2_entry(s, l2_slice, l2_index);
+    l2_bitmap = get_l2_bitmap(s, l2_slice, l2_index);
+    nb_clusters = size_to_clusters(s, bytes_needed);
+
+    type = qcow2_get_subcluster_type(bs, l2_entry, l2_bitmap, sc_index);
+    switch (type) {
+    case QCOW2_SUBCLUSTER_ZERO_PLAIN:
+    case QCOW2_SUBCLUSTER_UNALLOCATED_PLAIN:
+        if (s->qcow_version < 3 && type == QCOW2_SUBCLUSTER_ZERO_PLAIN) {
+            return -EAGAIN;
+        }
+        break;
+    case QCOW2_SUBCLUSTER_ZERO_ALLOC:
+    case QCOW2_SUBCLUSTER_NORMAL:
+    case QCOW2_SUBCLUSTER_UNALLOCATED_ALLOC:
+        if (s->qcow_version < 3 && type == QCOW2_SUBCLUSTER_ZERO_ALLOC) {
+            return -EAGAIN;
+        }
+        cluster_offset = l2_entry & L2E_OFFSET_MASK;
+        if (offset_into_cluster(s, cluster_offset) ||
+            (has_data_file(bs) &&
+             cluster_offset != offset - offset_in_cluster)) {
+            return -EAGAIN;
+        }
+        host = cluster_offset + offset_in_cluster;
+        break;
+    default:
+        return -EAGAIN;
+    }
+
+    sc = count_contiguous_subclusters(bs, nb_clusters, sc_index,
+                                      l2_slice, &l2_index);
+    if (sc < 0) {
+        return -EAGAIN;
+    }
+    bytes_available = ((int64_t)sc + sc_index) << s->subcluster_bits;
+
+out:
+    smp_rmb();
+    if (qatomic_read(&s->meta_writers) || qatomic_read(&s->meta_gen) != gen) {
+        return -EAGAIN;
+    }
+
+    if (bytes_available > bytes_needed) {
+        bytes_available = bytes_needed;
+    }
+    assert(bytes_available - offset_in_cluster <= UINT_MAX);
+    *bytes = bytes_available - offset_in_cluster;
+    *host_offset = host;
+    *subcluster_type = type;
+    return 0;
+}
+
 /*
  * get_cluster_table
  *
@@ -937,7 +1169,7 @@ perform_cow(BlockDriverState *bs, QCowL2Meta *m)
                                                        data_bytes)
                                 : 0));
 
-    qemu_co_mutex_unlock(&s->lock);
+    qcow2_co_unlock(s);
     /* First we read the existing data from both COW regions. We
      * either read the whole region in one go, or the start and end
      * regions separately. */
@@ -1009,7 +1241,7 @@ perform_cow(BlockDriverState *bs, QCowL2Meta *m)
     }
 
 fail:
-    qemu_co_mutex_lock(&s->lock);
+    qcow2_co_lock(s);
 
     /*
      * Before we update the L2 table to actually point to the new cluster, we
@@ -1457,7 +1689,9 @@ static int coroutine_fn handle_dependencies(BlockDriverState *bs,
              * Wait for the dependency to complete. We need to recheck
              * the free/allocated clusters when we continue.
              */
+            qcow2_meta_write_end(s);
             qemu_co_queue_wait(&old_alloc->dependent_requests, &s->lock);
+            qcow2_meta_write_begin(s);
             return -EAGAIN;
         }
     }
@@ -1606,6 +1840,7 @@ do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
                         uint64_t *host_offset, uint64_t *nb_clusters)
 {
     BDRVQcow2State *s = bs->opaque;
+    int64_t cluster_offset;
 
     trace_qcow2_do_alloc_clusters_offset(qemu_coroutine_self(), guest_offset,
                                          *host_offset, *nb_clusters);
@@ -1619,22 +1854,12 @@ do_alloc_cluster_offset(BlockDriverState *bs, uint64_t guest_offset,
 
     /* Allocate new clusters */
     trace_qcow2_cluster_alloc_phys(qemu_coroutine_self());
-    if (*host_offset == INV_OFFSET) {
-        int64_t cluster_offset =
-            qcow2_alloc_clusters(bs, *nb_clusters * s->cluster_size);
-        if (cluster_offset < 0) {
-            return cluster_offset;
-        }
-        *host_offset = cluster_offset;
-        return 0;
-    } else {
-        int64_t ret = qcow2_alloc_clusters_at(bs, *host_offset, *nb_clusters);
-        if (ret < 0) {
-            return ret;
-        }
-        *nb_clusters = ret;
-        return 0;
+    cluster_offset = qcow2_alloc_data_clusters(bs, *host_offset, nb_clusters);
+    if (cluster_offset < 0) {
+        return cluster_offset;
     }
+    *host_offset = cluster_offset;
+    return 0;
 }
 
 /*
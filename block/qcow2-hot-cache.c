@@ -0,0 +1,356 @@
+/*
+ * Persistent hot set of the qcow2 metadata caches
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+/*
+ * With the hot-cache option, qcow2 records which L2 slices and refcount
+ * blocks were used most when the image is closed, in the hot cache header
+ * extension, and loads them back into the caches in the background after
+ * the image is opened again.  This saves the guest from missing the caches
+ * on its first accesses.
+ *
+ * The tables are recorded by what they describe rather than by where they
+ * are stored: L2 slices by the first guest offset they map, refcount blocks
+ * by the first host offset they count.  When the image is opened, the
+ * current L1 and refcount tables are used to find the tables again.  So
+ * the extension never points at anything but active metadata, even when
+ * the image was changed by a program that doesn't know about it.
+ */
+
+#include "qemu/osdep.h"
+#include "block/block-io.h"
+#include "block/block_int.h"
+#include "qcow2.h"
+#include "trace.h"
+
+typedef struct HotCacheRef {
+    uint64_t offset;    /* Host offset of a metadata table */
+    uint64_t index;     /* Its index in the L1 or refcount table */
+} HotCacheRef;
+
+static int hot_cache_ref_compare(const void *a, const void *b)
+{
+    const HotCacheRef *ra = a, *rb = b;
+
+    if (ra->offset != rb->offset) {
+        return ra->offset < rb->offset ? -1 : 1;
+    }
+    return 0;
+}
+
+/*
+ * Return the tables referenced by @table (with @size entries, containing
+ * table offsets in the bits of @mask) sorted by offset, for lookups with
+ * hot_cache_ref_find().
+ */
+static HotCacheRef *hot_cache_refs(const uint64_t *table, uint64_t size,
+                                   uint64_t mask, uint64_t *nb_refs)
+{
+    HotCacheRef *refs = g_new(HotCacheRef, size);
+    uint64_t i, n = 0;
+
+    for (i = 0; i < size; i++) {
+        if (table[i] & mask) {
+            refs[n++] = (HotCacheRef) {
+                .offset = table[i] & mask,
+                .index = i,
+            };
+        }
+    }
+    qsort(refs, n, sizeof(refs[0]), hot_cache_ref_compare);
+
+    *nb_refs = n;
+    return refs;
+}
+
+static HotCacheRef *hot_cache_ref_find(HotCacheRef *refs, uint64_t nb_refs,
+                                       uint64_t offset)
+{
+    HotCacheRef key = { .offset = offset };
+
+    if (!nb_refs) {
+        return NULL;
+    }
+    return bsearch(&key, refs, nb_refs, sizeof(refs[0]),
+                   hot_cache_ref_compare);
+}
+
+void qcow2_hot_cache_free(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    g_free(s->hot_tables);
+    s->hot_tables = NULL;
+    s->nb_hot_l2_slices = 0;
+    s->nb_hot_refcount_blocks = 0;
+}
+
+/*
+ * Replace the recorded hot tables with the tables in the caches, most used
+ * first.  Tables that are not part of the active metadata (e.g. L2 tables
+ * of internal snapshots) are skipped.
+ */
+void qcow2_hot_cache_record(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    g_autofree uint64_t *l2_slices = NULL;
+    g_autofree uint64_t *refcount_blocks = NULL;
+    g_autofree HotCacheRef *refs = NULL;
+    uint64_t nb_refs;
+    uint64_t *hot;
+    int nb_l2_slices, nb_refcount_blocks, i;
+    uint32_t n = 0;
+
+    qcow2_hot_cache_free(bs);
+
+    l2_slices = qcow2_cache_get_hot_tables(s->l2_table_cache, &nb_l2_slices);
+    refcount_blocks = qcow2_cache_get_hot_tables(s->refcount_block_cache,
+                                                 &nb_refcount_blocks);
+    hot = g_new(uint64_t, nb_l2_slices + nb_refcount_blocks);
+
+    refs = hot_cache_refs(s->l1_table, s->l1_size, L1E_OFFSET_MASK, &nb_refs);
+    for (i = 0; i < nb_l2_slices; i++) {
+        HotCacheRef *ref;
+        uint64_t slice;
+
+        ref = hot_cache_ref_find(refs, nb_refs,
+                                 start_of_cluster(s, l2_slices[i]));
+        if (!ref) {
+            continue;
+        }
+
+        slice = offset_into_cluster(s, l2_slices[i]) /
+                (s->l2_slice_size * l2_entry_size(s));
+        hot[n++] = (ref->index << (s->l2_bits + s->cluster_bits)) +
+                   (slice * s->l2_slice_size << s->cluster_bits);
+    }
+    s->nb_hot_l2_slices = n;
+    g_free(refs);
+
+    refs = hot_cache_refs(s->refcount_table, s->refcount_table_size,
+                          REFT_OFFSET_MASK, &nb_refs);
+    for (i = 0; i < nb_refcount_blocks; i++) {
+        HotCacheRef *ref;
+
+        ref = hot_cache_ref_find(refs, nb_refs, refcount_blocks[i]);
+        if (ref) {
+            hot[n++] = ref->index << (s->refcount_block_bits + s->cluster_bits);
+        }
+    }
+    s->nb_hot_refcount_blocks = n - s->nb_hot_l2_slices;
+
+    s->hot_tables = hot;
+    trace_qcow2_hot_cache_record(bs, s->nb_hot_l2_slices,
+                                 s->nb_hot_refcount_blocks);
+}
+
+int coroutine_fn GRAPH_RDLOCK
+qcow2_hot_cache_read_ext(BlockDriverState *bs, uint64_t offset, uint32_t len)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2HotCacheHeaderExt ext;
+    uint64_t nb_tables, i;
+    int ret;
+
+    qcow2_hot_cache_free(bs);
+
+    /* The extension is only a hint, so just ignore it if it is malformed */
+    if (len < sizeof(ext)) {
+        return 0;
+    }
+
+    ret = bdrv_co_pread(bs->file, offset, sizeof(ext), &ext, 0);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ext.nb_l2_slices = be32_to_cpu(ext.nb_l2_slices);
+    ext.nb_refcount_blocks = be32_to_cpu(ext.nb_refcount_blocks);
+    nb_tables = (uint64_t)ext.nb_l2_slices + ext.nb_refcount_blocks;
+    if (len != sizeof(ext) + nb_tables * sizeof(uint64_t) || !nb_tables) {
+        return 0;
+    }
+
+    s->hot_tables = g_new(uint64_t, nb_tables);
+    ret = bdrv_co_pread(bs->file, offset + sizeof(ext),
+                        nb_tables * sizeof(uint64_t), s->hot_tables, 0);
+    if (ret < 0) {
+        qcow2_hot_cache_free(bs);
+        return ret;
+    }
+
+    for (i = 0; i < nb_tables; i++) {
+        be64_to_cpus(&s->hot_tables[i]);
+    }
+    s->nb_hot_l2_slices = ext.nb_l2_slices;
+    s->nb_hot_refcount_blocks = ext.nb_refcount_blocks;
+
+    return 0;
+}
+
+/*
+ * Return the data of the hot cache header extension, at most @max_len bytes
+ * of it, in a newly allocated buffer and store its length in @len.  Returns
+ * NULL if no table is recorded or none fits.
+ *
+ * If not all of the tables fit, the least used ones are left out, refcount
+ * blocks before L2 slices.
+ */
+void *qcow2_hot_cache_build_ext(BlockDriverState *bs, size_t max_len,
+                                size_t *len)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2HotCacheHeaderExt *ext;
+    uint64_t *tables;
+    size_t max_tables;
+    uint32_t nb_l2_slices, nb_refcount_blocks, i;
+
+    if (max_len < sizeof(*ext) + sizeof(uint64_t)) {
+        return NULL;
+    }
+    max_tables = (max_len - sizeof(*ext)) / sizeof(uint64_t);
+
+    nb_l2_slices = MIN(s->nb_hot_l2_slices, max_tables);
+    nb_refcount_blocks = MIN(s->nb_hot_refcount_blocks,
+                             max_tables - nb_l2_slices);
+    if (!nb_l2_slices && !nb_refcount_blocks) {
+        return NULL;
+    }
+
+    *len = sizeof(*ext) +
+           (nb_l2_slices + nb_refcount_blocks) * sizeof(uint64_t);
+    ext = g_malloc(*len);
+    *ext = (Qcow2HotCacheHeaderExt) {
+        .nb_l2_slices = cpu_to_be32(nb_l2_slices),
+        .nb_refcount_blocks = cpu_to_be32(nb_refcount_blocks),
+    };
+
+    tables = (uint64_t *)(ext + 1);
+    for (i = 0; i < nb_l2_slices; i++) {
+        tables[i] = cpu_to_be64(s->hot_tables[i]);
+    }
+    for (i = 0; i < nb_refcount_blocks; i++) {
+        tables[nb_l2_slices + i] =
+            cpu_to_be64(s->hot_tables[s->nb_hot_l2_slices + i]);
+    }
+
+    return ext;
+}
+
+/* Return the host offset of the L2 slice mapping @guest_offset, or 0 */
+static uint64_t hot_cache_l2_slice(BDRVQcow2State *s, uint64_t guest_offset)
+{
+    uint64_t l1_index = guest_offset >> (s->l2_bits + s->cluster_bits);
+    uint64_t l2_offset;
+
+    if (l1_index >= s->l1_size) {
+        return 0;
+    }
+
+    l2_offset = s->l1_table[l1_index] & L1E_OFFSET_MASK;
+    if (!l2_offset || offset_into_cluster(s, l2_offset)) {
+        return 0;
+    }
+
+    return l2_offset + l2_entry_size(s) *
+        (offset_to_l2_index(s, guest_offset) -
+         offset_to_l2_slice_index(s, guest_offset));
+}
+
+/* Return the host offset of the refcount block counting @offset, or 0 */
+static uint64_t hot_cache_refcount_block(BDRVQcow2State *s, uint64_t offset)
+{
+    uint64_t index = offset >> (s->refcount_block_bits + s->cluster_bits);
+    uint64_t refblock_offset;
+
+    if (index >= s->refcount_table_size) {
+        return 0;
+    }
+
+    refblock_offset = s->refcount_table[index] & REFT_OFFSET_MASK;
+    if (offset_into_cluster(s, refblock_offset)) {
+        return 0;
+    }
+
+    return refblock_offset;
+}
+
+static void coroutine_fn qcow2_hot_cache_prefetch_entry(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVQcow2State *s = bs->opaque;
+    g_autofree uint64_t *tables = NULL;
+    uint32_t nb_l2_slices, nb_refcount_blocks, i;
+
+    GRAPH_RDLOCK_GUARD();
+
+    /*
+     * Loading more tables than fit into the cache would only evict the ones
+     * loaded first, which are the more important ones.
+     */
+    qcow2_co_lock(s);
+    nb_l2_slices = MIN(s->nb_hot_l2_slices,
+                       qcow2_cache_get_size(s->l2_table_cache));
+    nb_refcount_blocks = MIN(s->nb_hot_refcount_blocks,
+                             qcow2_cache_get_size(s->refcount_block_cache));
+    tables = g_new(uint64_t, nb_l2_slices + nb_refcount_blocks);
+    memcpy(tables, s->hot_tables, nb_l2_slices * sizeof(uint64_t));
+    memcpy(tables + nb_l2_slices, s->hot_tables + s->nb_hot_l2_slices,
+           nb_refcount_blocks * sizeof(uint64_t));
+    qcow2_co_unlock(s);
+
+    for (i = 0; i < nb_l2_slices + nb_refcount_blocks; i++) {
+        bool is_l2 = i < nb_l2_slices;
+        Qcow2Cache *c;
+        uint64_t offset;
+        void *table;
+
+        /* Don't hold up drained sections, the rest is just not prefetched */
+        if (qatomic_read(&bs->quiesce_counter)) {
+            break;
+        }
+
+        qcow2_co_lock(s);
+        if (is_l2) {
+            c = s->l2_table_cache;
+            offset = hot_cache_l2_slice(s, tables[i]);
+        } else {
+            c = s->refcount_block_cache;
+            offset = hot_cache_refcount_block(s, tables[i]);
+        }
+        if (offset && !qcow2_cache_is_table_offset(c, offset) &&
+            qcow2_cache_get(bs, c, offset, &table) == 0) {
+            qcow2_cache_put(c, &table);
+        }
+        qcow2_co_unlock(s);
+    }
+
+    trace_qcow2_hot_cache_prefetch_done(bs, i,
+                                        nb_l2_slices + nb_refcount_blocks);
+    bdrv_dec_in_flight(bs);
+}
+
+/*
+ * Start loading the recorded hot tables into the caches in the background.
+ * The image must be fully opened when the coroutine gets to run; call this
+ * with s->lock held at the end of opening the image.
+ */
+void qcow2_hot_cache_prefetch(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (!s->nb_hot_l2_slices && !s->nb_hot_refcount_blocks) {
+        return;
+    }
+
+    trace_qcow2_hot_cache_prefetch(bs, s->nb_hot_l2_slices,
+                                   s->nb_hot_refcount_blocks);
+
+    bdrv_inc_in_flight(bs);
+    aio_co_enter(bdrv_get_aio_context(bs),
+                 qemu_coroutine_create(qcow2_hot_cache_prefetch_entry, bs));
+}
@@ -867,6 +867,15 @@ update_refcount(BlockDriverState *bs, int64_t offset, int64_t length,
         /* we can update the count and save it */
         block_index = cluster_index & (s->refcount_block_size - 1);
 
+        /*
+         * Allocations mostly move forward through the image, so prefetch
+         * the next refcount block once we get close to the end of this one.
+         */
+        if (!decrease && block_index == s->refcount_block_size * 3 / 4) {
+            qcow2_cache_prefetch(bs, s->refcount_block_cache,
+                                 table_index + 1);
+        }
+
         refcount = s->get_refcount(refcount_block, block_index);
         if (decrease ? (refcount - addend > refcount)
                      : (refcount + addend < refcount ||
@@ -1065,6 +1074,144 @@ int64_t coroutine_fn qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offs
     return i;
 }
 
+/*
+ * Batched allocation of data clusters
+ *
+ * With the alloc-batch option, allocating writes don't increase the refcounts
+ * of their clusters one write at a time.  Instead, the refcounts of a range of
+ * up to QCOW2_ALLOC_BATCH_SIZE of free clusters are increased at once, and the
+ * clusters of that range are handed out to the following allocating writes
+ * without touching the refcount blocks again.  Sequential and concurrent
+ * allocating writes then only dirty a refcount block once per batch instead
+ * of once per write, which saves a refcount block write for most allocating
+ * writes when the guest flushes after each of them.
+ *
+ * The refcounts of the batch are increased before any L2 entry points to its
+ * clusters, and link_l2() makes the L2 table cache depend on the refcount
+ * block cache as usual, so the image stays consistent.  If QEMU exits without
+ * closing the image, the clusters of the batch that haven't been handed out
+ * yet are leaked, which is harmless.  qcow2_release_alloc_batch() frees them
+ * before the image is closed or its refcounts are checked.
+ */
+
+static int coroutine_fn GRAPH_RDLOCK
+alloc_batch_refill(BlockDriverState *bs, uint64_t nb_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t batch_clusters = MAX(nb_clusters,
+                                  QCOW2_ALLOC_BATCH_SIZE >> s->cluster_bits);
+    uint64_t max_index = QCOW_MAX_CLUSTER_OFFSET >> s->cluster_bits;
+    uint64_t i, refcount;
+    int64_t offset;
+    int ret;
+
+    BLKDBG_CO_EVENT(bs->file, BLKDBG_CLUSTER_ALLOC);
+    do {
+        offset = alloc_clusters_noref(bs, nb_clusters << s->cluster_bits,
+                                      QCOW_MAX_CLUSTER_OFFSET);
+        if (offset < 0) {
+            return offset;
+        }
+
+        /* Take as many of the following clusters as are free, too */
+        for (i = nb_clusters; i < batch_clusters; i++) {
+            uint64_t cluster_index = (offset >> s->cluster_bits) + i;
+
+            if (cluster_index > max_index) {
+                break;
+            }
+            ret = qcow2_get_refcount(bs, cluster_index, &refcount);
+            if (ret < 0) {
+                return ret;
+            } else if (refcount != 0) {
+                break;
+            }
+        }
+        s->free_cluster_index = (offset >> s->cluster_bits) + i;
+
+        ret = update_refcount(bs, offset, i << s->cluster_bits, 1, false,
+                              QCOW2_DISCARD_NEVER);
+    } while (ret == -EAGAIN);
+
+    if (ret < 0) {
+        return ret;
+    }
+
+    trace_qcow2_alloc_batch_refill(bs, offset, i);
+    s->alloc_batch_offset = offset;
+    s->alloc_batch_clusters = i;
+    return 0;
+}
+
+/*
+ * Allocates data clusters for an allocating write, from the current batch if
+ * possible.  If @offset is INV_OFFSET, the clusters can be anywhere in the
+ * image file, otherwise they must start at @offset.
+ *
+ * Returns the offset of the first allocated cluster and sets *nb_clusters to
+ * the number of clusters allocated, which can be less than requested (and 0
+ * if the cluster at @offset is already in use), or -errno on error.
+ */
+int64_t coroutine_fn qcow2_alloc_data_clusters(BlockDriverState *bs,
+                                               uint64_t offset,
+                                               uint64_t *nb_clusters)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t n;
+    int64_t ret;
+
+    if (offset == INV_OFFSET && !s->alloc_batch_clusters && s->alloc_batch) {
+        ret = alloc_batch_refill(bs, *nb_clusters);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    if (s->alloc_batch_clusters &&
+        (offset == INV_OFFSET || offset == s->alloc_batch_offset))
+    {
+        n = MIN(*nb_clusters, s->alloc_batch_clusters);
+        offset = s->alloc_batch_offset;
+        s->alloc_batch_offset += n << s->cluster_bits;
+        s->alloc_batch_clusters -= n;
+        *nb_clusters = n;
+        return offset;
+    }
+
+    if (offset == INV_OFFSET) {
+        return qcow2_alloc_clusters(bs, *nb_clusters << s->cluster_bits);
+    }
+
+    ret = qcow2_alloc_clusters_at(bs, offset, *nb_clusters);
+    if (ret < 0) {
+        return ret;
+    }
+    *nb_clusters = ret;
+    return offset;
+}
+
+/*
+ * Frees the clusters of the current allocation batch that haven't been
+ * handed out yet.
+ */
+int qcow2_release_alloc_batch(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+
+    if (!s->alloc_batch_clusters) {
+        return 0;
+    }
+
+    ret = update_refcount(bs, s->alloc_batch_offset,
+                          s->alloc_batch_clusters << s->cluster_bits, 1, true,
+                          QCOW2_DISCARD_NEVER);
+
+    /* If this failed, the clusters are leaked at worst */
+    s->alloc_batch_clusters = 0;
+    return ret;
+}
+
 /* only used to allocate compressed sectors. We try to allocate
    contiguous sectors. size must be <= cluster_size */
 int64_t coroutine_fn GRAPH_RDLOCK qcow2_alloc_bytes(BlockDriverState *bs, int size)
@@ -484,11 +484,11 @@ int coroutine_fn qcow2_check_read_snapshot_table(BlockDriverState *bs,
         return ret;
     }
 
-    qemu_co_mutex_unlock(&s->lock);
+    qcow2_co_unlock(s);
     ret = qcow2_do_read_snapshots(bs, fix & BDRV_FIX_ERRORS,
                                   &nb_clusters_reduced, &extra_data_dropped,
                                   &local_err);
-    qemu_co_mutex_lock(&s->lock);
+    qcow2_co_lock(s);
     if (ret < 0) {
         result->check_errors++;
         error_reportf_err(local_err,
@@ -556,9 +556,9 @@ int coroutine_fn qcow2_check_fix_snapshot_table(BlockDriverState *bs,
     int ret;
 
     if (result->corruptions && (fix & BDRV_FIX_ERRORS)) {
-        qemu_co_mutex_unlock(&s->lock);
+        qcow2_co_unlock(s);
         ret = qcow2_write_snapshots(bs);
-        qemu_co_mutex_lock(&s->lock);
+        qcow2_co_lock(s);
         if (ret < 0) {
             result->check_errors++;
             fprintf(stderr, "ERROR failed to update snapshot table: %s\n",
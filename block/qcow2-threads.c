@@ -43,20 +43,28 @@ qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
 {
     int ret;
     BDRVQcow2State *s = bs->opaque;
+    int64_t queued = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t started;
 
-    qemu_co_mutex_lock(&s->lock);
-    while (s->nb_threads >= QCOW2_MAX_THREADS) {
-        qemu_co_queue_wait(&s->thread_task_queue, &s->lock);
+    qemu_co_mutex_lock(&s->threads_lock);
+    s->nb_threads_queued++;
+    while (s->nb_threads >= s->max_threads) {
+        qemu_co_queue_wait(&s->thread_task_queue, &s->threads_lock);
     }
+    s->nb_threads_queued--;
     s->nb_threads++;
-    qemu_co_mutex_unlock(&s->lock);
+    qemu_co_mutex_unlock(&s->threads_lock);
 
+    started = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     ret = thread_pool_submit_co(func, arg);
 
-    qemu_co_mutex_lock(&s->lock);
+    qemu_co_mutex_lock(&s->threads_lock);
     s->nb_threads--;
+    s->thread_jobs++;
+    s->thread_wait_ns += started - queued;
+    s->thread_busy_ns += qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - started;
     qemu_co_queue_next(&s->thread_task_queue);
-    qemu_co_mutex_unlock(&s->lock);
+    qemu_co_mutex_unlock(&s->threads_lock);
 
     return ret;
 }
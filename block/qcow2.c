@@ -73,6 +73,7 @@ typedef struct {
 #define  QCOW2_EXT_MAGIC_CRYPTO_HEADER 0x0537be77
 #define  QCOW2_EXT_MAGIC_BITMAPS 0x23852875
 #define  QCOW2_EXT_MAGIC_DATA_FILE 0x44415441
+#define  QCOW2_EXT_MAGIC_HOT_CACHE 0x484f5443
 
 static int coroutine_fn
 qcow2_co_preadv_compressed(BlockDriverState *bs,
@@ -432,6 +433,15 @@ qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
             break;
         }
 
+        case QCOW2_EXT_MAGIC_HOT_CACHE:
+            ret = qcow2_hot_cache_read_ext(bs, offset, ext.len);
+            if (ret < 0) {
+                error_setg_errno(errp, -ret,
+                                 "ERROR: Could not read hot cache extension");
+                return ret;
+            }
+            break;
+
         default:
             /* unknown magic - save it in case we need to rewrite the header */
             /* If you add a new feature, make sure to also update the fast
@@ -614,6 +624,12 @@ qcow2_co_check_locked(BlockDriverState *bs, BdrvCheckResult *result,
 
     memset(result, 0, sizeof(*result));
 
+    /* Unused clusters of the allocation batch would look like leaks */
+    ret = qcow2_release_alloc_batch(bs);
+    if (ret < 0) {
+        return ret;
+    }
+
     ret = qcow2_check_read_snapshot_table(bs, &snapshot_res, fix);
     if (ret < 0) {
         qcow2_add_check_result(result, &snapshot_res, false);
@@ -650,9 +666,9 @@ qcow2_co_check(BlockDriverState *bs, BdrvCheckResult *result,
     BDRVQcow2State *s = bs->opaque;
     int ret;
 
-    qemu_co_mutex_lock(&s->lock);
+    qcow2_co_lock(s);
     ret = qcow2_co_check_locked(bs, result, fix);
-    qemu_co_mutex_unlock(&s->lock);
+    qcow2_co_unlock(s);
     return ret;
 }
 
@@ -701,6 +717,9 @@ static const char *const mutable_opts[] = {
     QCOW2_OPT_L2_CACHE_ENTRY_SIZE,
     QCOW2_OPT_REFCOUNT_CACHE_SIZE,
     QCOW2_OPT_CACHE_CLEAN_INTERVAL,
+    QCOW2_OPT_MAX_THREADS,
+    QCOW2_OPT_HOT_CACHE,
+    QCOW2_OPT_ALLOC_BATCH,
     NULL
 };
 
@@ -817,6 +836,24 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_MAX_THREADS,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Maximum number of compression and encryption jobs "
+                    "running in parallel",
+        },
+        {
+            .name = QCOW2_OPT_HOT_CACHE,
+            .type = QEMU_OPT_BOOL,
+            .help = "Save the most used metadata tables on close and load "
+                    "them on open",
+        },
+        {
+            .name = QCOW2_OPT_ALLOC_BATCH,
+            .type = QEMU_OPT_BOOL,
+            .help = "Update the refcounts of newly allocated data clusters "
+                    "in batches",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -839,8 +876,10 @@ static void cache_clean_timer_cb(void *opaque)
 {
     BlockDriverState *bs = opaque;
     BDRVQcow2State *s = bs->opaque;
+    qcow2_meta_write_begin(s);
     qcow2_cache_clean_unused(s->l2_table_cache);
     qcow2_cache_clean_unused(s->refcount_block_cache);
+    qcow2_meta_write_end(s);
     timer_mod(s->cache_clean_timer, qemu_clock_get_ms(QEMU_CLOCK_VIRTUAL) +
               (int64_t) s->cache_clean_interval * 1000);
 }
@@ -979,6 +1018,9 @@ typedef struct Qcow2ReopenState {
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     bool discard_no_unref;
     uint64_t cache_clean_interval;
+    uint64_t max_threads;
+    bool hot_cache;
+    bool alloc_batch;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -1079,6 +1121,18 @@ qcow2_update_options_prepare(BlockDriverState *bs, Qcow2ReopenState *r,
         goto fail;
     }
 
+    r->max_threads = qemu_opt_get_number(opts, QCOW2_OPT_MAX_THREADS,
+                                         QCOW2_DEFAULT_THREADS);
+    if (r->max_threads == 0 || r->max_threads > INT_MAX) {
+        error_setg(errp, QCOW2_OPT_MAX_THREADS " must be between 1 and %d",
+                   INT_MAX);
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    r->hot_cache = qemu_opt_get_bool(opts, QCOW2_OPT_HOT_CACHE, false);
+    r->alloc_batch = qemu_opt_get_bool(opts, QCOW2_OPT_ALLOC_BATCH, false);
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1245,6 +1299,14 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
         cache_clean_timer_init(bs, bdrv_get_aio_context(bs));
     }
 
+    /* The node is drained, so no jobs are waiting for a thread */
+    s->max_threads = r->max_threads;
+
+    s->hot_cache = r->hot_cache;
+
+    /* A batch that is still reserved is used up even if this disables it */
+    s->alloc_batch = r->alloc_batch;
+
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     s->crypto_opts = r->crypto_opts;
 }
@@ -1880,6 +1942,10 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
         }
     }
 
+    if (s->hot_cache && !(flags & (BDRV_O_INACTIVE | BDRV_O_NO_IO))) {
+        qcow2_hot_cache_prefetch(bs);
+    }
+
 #ifdef DEBUG_ALLOC
     {
         BdrvCheckResult result = {0};
@@ -1887,12 +1953,14 @@ qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
     }
 #endif
 
+    qemu_co_mutex_init(&s->threads_lock);
     qemu_co_queue_init(&s->thread_task_queue);
 
     return ret;
 
  fail:
     g_free(s->image_data_file);
+    qcow2_hot_cache_free(bs);
     if (open_data_file && has_data_file(bs)) {
         bdrv_graph_co_rdunlock();
         bdrv_co_unref_child(bs, s->data_file);
@@ -1933,10 +2001,10 @@ static void coroutine_fn qcow2_open_entry(void *opaque)
 
     GRAPH_RDLOCK_GUARD();
 
-    qemu_co_mutex_lock(&s->lock);
+    qcow2_co_lock(s);
     qoc->ret = qcow2_do_open(qoc->bs, qoc->options, qoc->flags, true,
                              qoc->errp);
-    qemu_co_mutex_unlock(&s->lock);
+    qcow2_co_unlock(s);
 
     aio_wait_kick();
 }
@@ -2011,6 +2079,12 @@ qcow2_reopen_prepare(BDRVReopenState *state,BlockReopenQueue *queue,
             goto fail;
         }
 
+        ret = qcow2_release_alloc_batch(state->bs);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Failed to free the allocation batch");
+            goto fail;
+        }
+
         ret = bdrv_flush(state->bs);
         if (ret < 0) {
             goto fail;
@@ -2151,7 +2225,7 @@ qcow2_co_block_status(BlockDriverState *bs, bool want_zero, int64_t offset,
     QCow2SubclusterType type;
     int ret, status = 0;
 
-    qemu_co_mutex_lock(&s->lock);
+    qcow2_co_lock(s);
 
     if (!s->metadata_preallocation_checked) {
         ret = qcow2_detect_metadata_preallocation(bs);
@@ -2161,7 +2235,7 @@ qcow2_co_block_status(BlockDriverState *bs, bool want_zero, int64_t offset,
 
     bytes = MIN(INT_MAX, count);
     ret = qcow2_get_host_offset(bs, offset, &bytes, &host_offset, &type);
-    qemu_co_mutex_unlock(&s->lock);
+    qcow2_co_unlock(s);
     if (ret < 0) {
         return ret;
     }
@@ -2403,10 +2477,14 @@ qcow2_co_preadv_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
                             QCOW_MAX_CRYPT_CLUSTERS * s->cluster_size);
         }
 
-        qemu_co_mutex_lock(&s->lock);
-        ret = qcow2_get_host_offset(bs, offset, &cur_bytes,
-                                    &host_offset, &type);
-        qemu_co_mutex_unlock(&s->lock);
+        ret = qcow2_try_get_host_offset(bs, offset, &cur_bytes,
+                                        &host_offset, &type);
+        if (ret == -EAGAIN) {
+            qcow2_co_lock(s);
+            ret = qcow2_get_host_offset(bs, offset, &cur_bytes,
+                                        &host_offset, &type);
+            qcow2_co_unlock(s);
+        }
         if (ret < 0) {
             goto out;
         }
@@ -2641,17 +2719,17 @@ int qcow2_co_pwritev_task(BlockDriverState *bs, uint64_t host_offset,
         }
     }
 
-    qemu_co_mutex_lock(&s->lock);
+    qcow2_co_lock(s);
 
     ret = qcow2_handle_l2meta(bs, &l2meta, true);
     goto out_locked;
 
 out_unlocked:
-    qemu_co_mutex_lock(&s->lock);
+    qcow2_co_lock(s);
 
 out_locked:
     qcow2_handle_l2meta(bs, &l2meta, false);
-    qemu_co_mutex_unlock(&s->lock);
+    qcow2_co_unlock(s);
 
     qemu_vfree(crypt_buf);
 
@@ -2701,7 +2779,7 @@ qcow2_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
                             - offset_in_cluster);
         }
 
-        qemu_co_mutex_lock(&s->lock);
+        qcow2_co_lock(s);
 
         ret = qcow2_alloc_host_offset(bs, offset, &cur_bytes,
                                       &host_offset, &l2meta);
@@ -2715,7 +2793,7 @@ qcow2_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
             goto out_locked;
         }
 
-        qemu_co_mutex_unlock(&s->lock);
+        qcow2_co_unlock(s);
 
         if (!aio && cur_bytes != bytes) {
             aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
@@ -2735,12 +2813,12 @@ qcow2_co_pwritev_part(BlockDriverState *bs, int64_t offset, int64_t bytes,
     }
     ret = 0;
 
-    qemu_co_mutex_lock(&s->lock);
+    qcow2_co_lock(s);
 
 out_locked:
     qcow2_handle_l2meta(bs, &l2meta, false);
 
-    qemu_co_mutex_unlock(&s->lock);
+    qcow2_co_unlock(s);
 
 fail_nometa:
     if (aio) {
@@ -2770,6 +2848,13 @@ static int GRAPH_RDLOCK qcow2_inactivate(BlockDriverState *bs)
                           bdrv_get_device_or_node_name(bs));
     }
 
+    ret = qcow2_release_alloc_batch(bs);
+    if (ret) {
+        result = ret;
+        error_report("Failed to free the allocation batch: %s",
+                     strerror(-ret));
+    }
+
     ret = qcow2_cache_flush(bs, s->l2_table_cache);
     if (ret) {
         result = ret;
@@ -2784,6 +2869,15 @@ static int GRAPH_RDLOCK qcow2_inactivate(BlockDriverState *bs)
                      strerror(-ret));
     }
 
+    if (s->hot_cache && bdrv_is_writable(bs)) {
+        qcow2_hot_cache_record(bs);
+        ret = qcow2_update_header(bs);
+        if (ret < 0) {
+            warn_report("Failed to store the hot cache of node '%s': %s",
+                        bdrv_get_device_or_node_name(bs), strerror(-ret));
+        }
+    }
+
     if (result == 0) {
         qcow2_mark_clean(bs);
     }
@@ -2795,14 +2889,16 @@ static void coroutine_mixed_fn GRAPH_RDLOCK
 qcow2_do_close(BlockDriverState *bs, bool close_data_file)
 {
     BDRVQcow2State *s = bs->opaque;
-    qemu_vfree(s->l1_table);
-    /* else pre-write overlap checks in cache_destroy may crash */
-    s->l1_table = NULL;
 
+    /* qcow2_inactivate() needs the L1 table to record the hot cache */
     if (!(s->flags & BDRV_O_INACTIVE)) {
         qcow2_inactivate(bs);
     }
 
+    qemu_vfree(s->l1_table);
+    /* else pre-write overlap checks in cache_destroy may crash */
+    s->l1_table = NULL;
+
     cache_clean_timer_del(bs);
     qcow2_cache_destroy(s->l2_table_cache);
     qcow2_cache_destroy(s->refcount_block_cache);
@@ -2813,6 +2909,7 @@ qcow2_do_close(BlockDriverState *bs, bool close_data_file)
 
     g_free(s->unknown_header_fields);
     cleanup_unknown_header_ext(bs);
+    qcow2_hot_cache_free(bs);
 
     g_free(s->image_data_file);
     g_free(s->image_backing_file);
@@ -2875,9 +2972,9 @@ qcow2_co_invalidate_cache(BlockDriverState *bs, Error **errp)
     options = qdict_clone_shallow(bs->options);
 
     flags &= ~BDRV_O_INACTIVE;
-    qemu_co_mutex_lock(&s->lock);
+    qcow2_co_lock(s);
     ret = qcow2_do_open(bs, options, flags, false, errp);
-    qemu_co_mutex_unlock(&s->lock);
+    qcow2_co_unlock(s);
     qobject_unref(options);
     if (ret < 0) {
         error_prepend(errp, "Could not reopen qcow2 layer: ");
@@ -3137,6 +3234,34 @@ int qcow2_update_header(BlockDriverState *bs)
         buflen -= ret;
     }
 
+    /*
+     * Hot cache extension.  It takes at most QCOW2_HOT_CACHE_EXT_MAX_SIZE
+     * bytes of the space left after the end marker and the backing file
+     * name, and is cut short if necessary.
+     */
+    if (s->nb_hot_l2_slices || s->nb_hot_refcount_blocks) {
+        size_t reserved = 2 * sizeof(QCowExtension) +
+            (s->image_backing_file ? strlen(s->image_backing_file) : 0);
+        g_autofree void *hot_cache = NULL;
+        size_t hot_cache_len;
+
+        if (buflen > reserved) {
+            hot_cache = qcow2_hot_cache_build_ext(
+                bs, MIN(buflen - reserved, QCOW2_HOT_CACHE_EXT_MAX_SIZE),
+                &hot_cache_len);
+        }
+        if (hot_cache) {
+            ret = header_ext_add(buf, QCOW2_EXT_MAGIC_HOT_CACHE, hot_cache,
+                                 hot_cache_len, buflen);
+            if (ret < 0) {
+                goto fail;
+            }
+
+            buf += ret;
+            buflen -= ret;
+        }
+    }
+
     /* End of header extensions */
     ret = header_ext_add(buf, QCOW2_EXT_MAGIC_END, NULL, 0, buflen);
     if (ret < 0) {
@@ -4087,7 +4212,7 @@ qcow2_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int64_t bytes,
             return -ENOTSUP;
         }
 
-        qemu_co_mutex_lock(&s->lock);
+        qcow2_co_lock(s);
         /* We can have new write after previous check */
         offset -= head;
         bytes = s->subcluster_size;
@@ -4098,18 +4223,18 @@ qcow2_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset, int64_t bytes,
              type != QCOW2_SUBCLUSTER_UNALLOCATED_ALLOC &&
              type != QCOW2_SUBCLUSTER_ZERO_PLAIN &&
              type != QCOW2_SUBCLUSTER_ZERO_ALLOC)) {
-            qemu_co_mutex_unlock(&s->lock);
+            qcow2_co_unlock(s);
             return ret < 0 ? ret : -ENOTSUP;
         }
     } else {
-        qemu_co_mutex_lock(&s->lock);
+        qcow2_co_lock(s);
     }
 
     trace_qcow2_pwrite_zeroes(qemu_coroutine_self(), offset, bytes);
 
     /* Whatever is left can use real zero subclusters */
     ret = qcow2_subcluster_zeroize(bs, offset, bytes, flags);
-    qemu_co_mutex_unlock(&s->lock);
+    qcow2_co_unlock(s);
 
     return ret;
 }
@@ -4136,10 +4261,10 @@ qcow2_co_pdiscard(BlockDriverState *bs, int64_t offset, int64_t bytes)
         }
     }
 
-    qemu_co_mutex_lock(&s->lock);
+    qcow2_co_lock(s);
     ret = qcow2_cluster_discard(bs, offset, bytes, QCOW2_DISCARD_REQUEST,
                                 false);
-    qemu_co_mutex_unlock(&s->lock);
+    qcow2_co_unlock(s);
     return ret;
 }
 
@@ -4157,7 +4282,7 @@ qcow2_co_copy_range_from(BlockDriverState *bs,
     BdrvRequestFlags cur_write_flags;
 
     assert(!bs->encrypted);
-    qemu_co_mutex_lock(&s->lock);
+    qcow2_co_lock(s);
 
     while (bytes != 0) {
         uint64_t copy_offset = 0;
@@ -4205,12 +4330,12 @@ qcow2_co_copy_range_from(BlockDriverState *bs,
         default:
             abort();
         }
-        qemu_co_mutex_unlock(&s->lock);
+        qcow2_co_unlock(s);
         ret = bdrv_co_copy_range_from(child,
                                       copy_offset,
                                       dst, dst_offset,
                                       cur_bytes, read_flags, cur_write_flags);
-        qemu_co_mutex_lock(&s->lock);
+        qcow2_co_lock(s);
         if (ret < 0) {
             goto out;
         }
@@ -4222,7 +4347,7 @@ qcow2_co_copy_range_from(BlockDriverState *bs,
     ret = 0;
 
 out:
-    qemu_co_mutex_unlock(&s->lock);
+    qcow2_co_unlock(s);
     return ret;
 }
 
@@ -4241,7 +4366,7 @@ qcow2_co_copy_range_to(BlockDriverState *bs,
 
     assert(!bs->encrypted);
 
-    qemu_co_mutex_lock(&s->lock);
+    qcow2_co_lock(s);
 
     while (bytes != 0) {
 
@@ -4265,10 +4390,10 @@ qcow2_co_copy_range_to(BlockDriverState *bs,
             goto fail;
         }
 
-        qemu_co_mutex_unlock(&s->lock);
+        qcow2_co_unlock(s);
         ret = bdrv_co_copy_range_to(src, src_offset, s->data_file, host_offset,
                                     cur_bytes, read_flags, write_flags);
-        qemu_co_mutex_lock(&s->lock);
+        qcow2_co_lock(s);
         if (ret < 0) {
             goto fail;
         }
@@ -4287,7 +4412,7 @@ qcow2_co_copy_range_to(BlockDriverState *bs,
 fail:
     qcow2_handle_l2meta(bs, &l2meta, false);
 
-    qemu_co_mutex_unlock(&s->lock);
+    qcow2_co_unlock(s);
 
     trace_qcow2_writev_done_req(qemu_coroutine_self(), ret);
 
@@ -4319,7 +4444,7 @@ qcow2_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
         return -EINVAL;
     }
 
-    qemu_co_mutex_lock(&s->lock);
+    qcow2_co_lock(s);
 
     /*
      * Even though we store snapshot size for all images, it was not
@@ -4349,6 +4474,12 @@ qcow2_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
             goto fail;
         }
 
+        ret = qcow2_release_alloc_batch(bs);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Failed to free the allocation batch");
+            goto fail;
+        }
+
         ret = qcow2_cluster_discard(bs, ROUND_UP(offset, s->cluster_size),
                                     old_length - ROUND_UP(offset,
                                                           s->cluster_size),
@@ -4623,9 +4754,9 @@ qcow2_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
             QEMUIOVector qiov;
             qemu_iovec_init_buf(&qiov, buf, len);
 
-            qemu_co_mutex_unlock(&s->lock);
+            qcow2_co_unlock(s);
             ret = qcow2_co_pwritev_part(bs, old_length, len, &qiov, 0, 0);
-            qemu_co_mutex_lock(&s->lock);
+            qcow2_co_lock(s);
 
             qemu_vfree(buf);
             if (ret < 0) {
@@ -4667,72 +4798,180 @@ qcow2_co_truncate(BlockDriverState *bs, int64_t offset, bool exact,
     }
     ret = 0;
 fail:
-    qemu_co_mutex_unlock(&s->lock);
+    qcow2_co_unlock(s);
     return ret;
 }
 
+typedef struct Qcow2CompressedCluster {
+    uint64_t offset;
+    uint64_t bytes;
+    size_t qiov_offset;
+    uint8_t *out_buf;
+    ssize_t out_len;
+    uint64_t host_offset;
+} Qcow2CompressedCluster;
+
+typedef struct Qcow2CompressTask {
+    AioTask task;
+    BlockDriverState *bs;
+    QEMUIOVector *qiov;
+    Qcow2CompressedCluster *cluster;
+} Qcow2CompressTask;
+
+static int coroutine_fn qcow2_co_compress_task_entry(AioTask *task)
+{
+    Qcow2CompressTask *t = container_of(task, Qcow2CompressTask, task);
+    Qcow2CompressedCluster *c = t->cluster;
+    BDRVQcow2State *s = t->bs->opaque;
+    uint8_t *buf;
+
+    buf = qemu_blockalign(t->bs, s->cluster_size);
+    if (c->bytes < s->cluster_size) {
+        /* Zero-pad last write if image size is not cluster aligned */
+        memset(buf + c->bytes, 0, s->cluster_size - c->bytes);
+    }
+    qemu_iovec_to_buf(t->qiov, c->qiov_offset, buf, c->bytes);
+
+    c->out_buf = g_malloc(s->cluster_size);
+    c->out_len = qcow2_co_compress(t->bs, c->out_buf, s->cluster_size - 1,
+                                   buf, s->cluster_size);
+    qemu_vfree(buf);
+
+    /* -ENOMEM means "does not compress", the caller writes it uncompressed */
+    return c->out_len < 0 && c->out_len != -ENOMEM ? -EINVAL : 0;
+}
+
+/*
+ * Write a run of up to QCOW2_COMPRESS_BATCH clusters.
+ *
+ * All clusters of the run are compressed in parallel first. Host space for
+ * them is then allocated in a single s->lock section; since
+ * qcow2_alloc_bytes() packs compressed clusters back to back, the
+ * allocations are usually adjacent and can be written with one vectored
+ * request instead of one small write per cluster.
+ *
+ * Allocating a cluster already points its L2 entry to the new host offset,
+ * so once allocated, a cluster's data must be written even if something
+ * else failed.  Otherwise the guest would read whatever happens to be at
+ * the host offset instead of either its old or its new data.
+ */
 static int coroutine_fn GRAPH_RDLOCK
 qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
                                  uint64_t offset, uint64_t bytes,
                                  QEMUIOVector *qiov, size_t qiov_offset)
 {
     BDRVQcow2State *s = bs->opaque;
-    int ret;
-    ssize_t out_len;
-    uint8_t *buf, *out_buf;
-    uint64_t cluster_offset;
+    Qcow2CompressedCluster clusters[QCOW2_COMPRESS_BATCH] = {};
+    AioTaskPool *aio;
+    QEMUIOVector hd_qiov;
+    int nb_clusters = DIV_ROUND_UP(bytes, s->cluster_size);
+    int nb_alloc;
+    int ret = 0;
+    int i, j;
+
+    assert(nb_clusters > 0 && nb_clusters <= QCOW2_COMPRESS_BATCH);
+    assert(bytes == (uint64_t)nb_clusters * s->cluster_size ||
+           (offset + bytes == bs->total_sectors << BDRV_SECTOR_BITS));
+
+    aio = aio_task_pool_new(nb_clusters);
+    for (i = 0; i < nb_clusters; i++) {
+        Qcow2CompressTask *t = g_new(Qcow2CompressTask, 1);
+
+        clusters[i].offset = offset + (uint64_t)i * s->cluster_size;
+        clusters[i].bytes = MIN(bytes - (uint64_t)i * s->cluster_size,
+                                s->cluster_size);
+        clusters[i].qiov_offset = qiov_offset + (uint64_t)i * s->cluster_size;
+
+        *t = (Qcow2CompressTask) {
+            .task.func = qcow2_co_compress_task_entry,
+            .bs = bs,
+            .qiov = qiov,
+            .cluster = &clusters[i],
+        };
+        aio_task_pool_start_task(aio, &t->task);
+    }
+    aio_task_pool_wait_all(aio);
+    ret = aio_task_pool_status(aio);
+    g_free(aio);
+    if (ret < 0) {
+        goto out;
+    }
 
-    assert(bytes == s->cluster_size || (bytes < s->cluster_size &&
-           (offset + bytes == bs->total_sectors << BDRV_SECTOR_BITS)));
+    qcow2_co_lock(s);
+    for (i = 0; i < nb_clusters; i++) {
+        Qcow2CompressedCluster *c = &clusters[i];
 
-    buf = qemu_blockalign(bs, s->cluster_size);
-    if (bytes < s->cluster_size) {
-        /* Zero-pad last write if image size is not cluster aligned */
-        memset(buf + bytes, 0, s->cluster_size - bytes);
-    }
-    qemu_iovec_to_buf(qiov, qiov_offset, buf, bytes);
+        if (c->out_len < 0) {
+            continue;
+        }
 
-    out_buf = g_malloc(s->cluster_size);
+        ret = qcow2_alloc_compressed_cluster_offset(bs, c->offset, c->out_len,
+                                                    &c->host_offset);
+        if (ret < 0) {
+            break;
+        }
 
-    out_len = qcow2_co_compress(bs, out_buf, s->cluster_size - 1,
-                                buf, s->cluster_size);
-    if (out_len == -ENOMEM) {
-        /* could not compress: write normal cluster */
-        ret = qcow2_co_pwritev_part(bs, offset, bytes, qiov, qiov_offset, 0);
+        ret = qcow2_pre_write_overlap_check(bs, 0, c->host_offset, c->out_len,
+                                            true);
         if (ret < 0) {
-            goto fail;
+            break;
         }
-        goto success;
-    } else if (out_len < 0) {
-        ret = -EINVAL;
-        goto fail;
     }
+    qcow2_co_unlock(s);
 
-    qemu_co_mutex_lock(&s->lock);
-    ret = qcow2_alloc_compressed_cluster_offset(bs, offset, out_len,
-                                                &cluster_offset);
-    if (ret < 0) {
-        qemu_co_mutex_unlock(&s->lock);
-        goto fail;
-    }
+    /*
+     * On failure, the clusters before the failing one are allocated and
+     * still need their data.  The failing one is left alone, like it would
+     * be when writing a single cluster.
+     */
+    nb_alloc = i;
+
+    qemu_iovec_init(&hd_qiov, nb_alloc);
+    for (i = 0; i < nb_alloc; i = j) {
+        Qcow2CompressedCluster *c = &clusters[i];
+        uint64_t run_bytes;
+        int write_ret;
+
+        if (c->out_len < 0) {
+            /* could not compress: write normal cluster */
+            write_ret = qcow2_co_pwritev_part(bs, c->offset, c->bytes, qiov,
+                                              c->qiov_offset, 0);
+            if (write_ret < 0 && ret == 0) {
+                ret = write_ret;
+            }
+            j = i + 1;
+            continue;
+        }
 
-    ret = qcow2_pre_write_overlap_check(bs, 0, cluster_offset, out_len, true);
-    qemu_co_mutex_unlock(&s->lock);
-    if (ret < 0) {
-        goto fail;
+        /* Merge clusters whose compressed data ended up contiguous */
+        qemu_iovec_reset(&hd_qiov);
+        qemu_iovec_add(&hd_qiov, c->out_buf, c->out_len);
+        run_bytes = c->out_len;
+        for (j = i + 1; j < nb_alloc; j++) {
+            if (clusters[j].out_len < 0 ||
+                clusters[j].host_offset != c->host_offset + run_bytes) {
+                break;
+            }
+            qemu_iovec_add(&hd_qiov, clusters[j].out_buf, clusters[j].out_len);
+            run_bytes += clusters[j].out_len;
+        }
+
+        trace_qcow2_writev_compressed_run(qemu_coroutine_self(), c->offset,
+                                          c->host_offset, j - i, run_bytes);
+        BLKDBG_CO_EVENT(s->data_file, BLKDBG_WRITE_COMPRESSED);
+        write_ret = bdrv_co_pwritev(s->data_file, c->host_offset, run_bytes,
+                                    &hd_qiov, 0);
+        if (write_ret < 0 && ret == 0) {
+            ret = write_ret;
+        }
     }
+    qemu_iovec_destroy(&hd_qiov);
 
-    BLKDBG_CO_EVENT(s->data_file, BLKDBG_WRITE_COMPRESSED);
-    ret = bdrv_co_pwrite(s->data_file, cluster_offset, out_len, out_buf, 0);
-    if (ret < 0) {
-        goto fail;
+out:
+    for (i = 0; i < nb_clusters; i++) {
+        g_free(clusters[i].out_buf);
     }
-success:
-    ret = 0;
-fail:
-    qemu_vfree(buf);
-    g_free(out_buf);
-    return ret;
+    return ret < 0 ? ret : 0;
 }
 
 /*
@@ -4791,7 +5030,9 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
     }
 
     while (bytes && aio_task_pool_status(aio) == 0) {
-        uint64_t chunk_size = MIN(bytes, s->cluster_size);
+        uint64_t chunk_size = MIN(bytes,
+                                  (uint64_t)QCOW2_COMPRESS_BATCH *
+                                  s->cluster_size);
 
         if (!aio && chunk_size != bytes) {
             aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
@@ -5019,6 +5260,11 @@ static int GRAPH_RDLOCK qcow2_make_empty(BlockDriverState *bs)
     int step = QEMU_ALIGN_DOWN(INT_MAX, s->cluster_size);
     int l1_clusters, ret = 0;
 
+    ret = qcow2_release_alloc_batch(bs);
+    if (ret < 0) {
+        return ret;
+    }
+
     l1_clusters = DIV_ROUND_UP(s->l1_size, s->cluster_size / L1E_SIZE);
 
     if (s->qcow_version >= 3 && !s->snapshots && !s->nb_bitmaps &&
@@ -5061,9 +5307,9 @@ static coroutine_fn GRAPH_RDLOCK int qcow2_co_flush_to_os(BlockDriverState *bs)
     BDRVQcow2State *s = bs->opaque;
     int ret;
 
-    qemu_co_mutex_lock(&s->lock);
+    qcow2_co_lock(s);
     ret = qcow2_write_caches(bs);
-    qemu_co_mutex_unlock(&s->lock);
+    qcow2_co_unlock(s);
 
     return ret;
 }
@@ -5327,6 +5573,26 @@ qcow2_get_specific_info(BlockDriverState *bs, Error **errp)
     return spec_info;
 }
 
+static BlockStatsSpecific *qcow2_get_specific_stats(BlockDriverState *bs)
+{
+    BlockStatsSpecific *stats = g_new(BlockStatsSpecific, 1);
+    BDRVQcow2State *s = bs->opaque;
+    BlockStatsSpecificQcow2 *q = &stats->u.qcow2;
+
+    stats->driver = BLOCKDEV_DRIVER_QCOW2;
+    qcow2_cache_get_stats(s->l2_table_cache, &q->l2_cache_hits,
+                          &q->l2_cache_misses);
+    qcow2_cache_get_stats(s->refcount_block_cache, &q->refcount_cache_hits,
+                          &q->refcount_cache_misses);
+    q->thread_jobs = s->thread_jobs;
+    q->thread_jobs_active = s->nb_threads;
+    q->thread_jobs_queued = s->nb_threads_queued;
+    q->thread_busy_ns = s->thread_busy_ns;
+    q->thread_wait_ns = s->thread_wait_ns;
+
+    return stats;
+}
+
 static int coroutine_mixed_fn GRAPH_RDLOCK
 qcow2_has_zero_init(BlockDriverState *bs)
 {
@@ -5334,7 +5600,7 @@ qcow2_has_zero_init(BlockDriverState *bs)
     bool preallocated;
 
     if (qemu_in_coroutine()) {
-        qemu_co_mutex_lock(&s->lock);
+        qcow2_co_lock(s);
     }
     /*
      * Check preallocation status: Preallocated images have all L2
@@ -5343,7 +5609,7 @@ qcow2_has_zero_init(BlockDriverState *bs)
      */
     preallocated = s->l1_size > 0 && s->l1_table[0] != 0;
     if (qemu_in_coroutine()) {
-        qemu_co_mutex_unlock(&s->lock);
+        qcow2_co_unlock(s);
     }
 
     if (!preallocated) {
@@ -6176,6 +6442,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_measure                       = qcow2_measure,
     .bdrv_co_get_info                   = qcow2_co_get_info,
     .bdrv_get_specific_info             = qcow2_get_specific_info,
+    .bdrv_get_specific_stats            = qcow2_get_specific_stats,
 
     .bdrv_co_save_vmstate               = qcow2_co_save_vmstate,
     .bdrv_co_load_vmstate               = qcow2_co_load_vmstate,
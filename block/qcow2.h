@@ -71,6 +71,12 @@
 /* Maximum of parallel sub-request per guest request */
 #define QCOW2_MAX_WORKERS 8
 
+/* Maximum number of clusters compressed and allocated together */
+#define QCOW2_COMPRESS_BATCH 8
+
+/* Size of the range that data clusters are reserved in (see qcow2-refcount.c) */
+#define QCOW2_ALLOC_BATCH_SIZE (4 * MiB)
+
 /* indicate that the refcount of the referenced cluster is exactly one. */
 #define QCOW_OFLAG_COPIED     (1ULL << 63)
 /* indicate that the cluster is compressed (they never have the copied flag) */
@@ -150,6 +156,9 @@
 #define QCOW2_OPT_L2_CACHE_ENTRY_SIZE "l2-cache-entry-size"
 #define QCOW2_OPT_REFCOUNT_CACHE_SIZE "refcount-cache-size"
 #define QCOW2_OPT_CACHE_CLEAN_INTERVAL "cache-clean-interval"
+#define QCOW2_OPT_MAX_THREADS "max-threads"
+#define QCOW2_OPT_HOT_CACHE "hot-cache"
+#define QCOW2_OPT_ALLOC_BATCH "alloc-batch"
 
 typedef struct QCowHeader {
     uint32_t magic;
@@ -322,7 +331,23 @@ typedef struct Qcow2BitmapHeaderExt {
     uint64_t bitmap_directory_offset;
 } QEMU_PACKED Qcow2BitmapHeaderExt;
 
-#define QCOW2_MAX_THREADS 4
+/*
+ * Followed by nb_l2_slices guest offsets and nb_refcount_blocks host offsets,
+ * see qcow2-hot-cache.c
+ */
+typedef struct Qcow2HotCacheHeaderExt {
+    uint32_t nb_l2_slices;
+    uint32_t nb_refcount_blocks;
+} QEMU_PACKED Qcow2HotCacheHeaderExt;
+
+/*
+ * Upper limit for the size of the hot cache header extension, so that it
+ * doesn't take up the space in the header cluster that other extensions
+ * and the backing file name may need later
+ */
+#define QCOW2_HOT_CACHE_EXT_MAX_SIZE (4 * KiB)
+
+#define QCOW2_DEFAULT_THREADS 4
 
 typedef struct BDRVQcow2State {
     int cluster_bits;
@@ -345,9 +370,25 @@ typedef struct BDRVQcow2State {
 
     Qcow2Cache *l2_table_cache;
     Qcow2Cache *refcount_block_cache;
+    /*
+     * Index of the last L2 slice looked up, for sequential readahead.
+     * Written with s->lock held, but also read without it.  It may wrap
+     * on 32-bit hosts, which only affects the readahead heuristic.
+     */
+    unsigned long l2_readahead_slice;
     QEMUTimer *cache_clean_timer;
     unsigned cache_clean_interval;
 
+    /*
+     * Metadata tables to load into the caches after opening the image, from
+     * the hot cache header extension.  The first nb_hot_l2_slices entries
+     * are L2 slices, the rest refcount blocks.
+     */
+    bool hot_cache;
+    uint64_t *hot_tables;
+    uint32_t nb_hot_l2_slices;
+    uint32_t nb_hot_refcount_blocks;
+
     QLIST_HEAD(, QCowL2Meta) cluster_allocs;
 
     uint64_t *refcount_table;
@@ -357,8 +398,26 @@ typedef struct BDRVQcow2State {
     uint64_t free_cluster_index;
     uint64_t free_byte_offset;
 
+    /*
+     * Clusters with a refcount of 1 that aren't used yet and are handed out
+     * to allocating writes by qcow2_alloc_data_clusters()
+     */
+    bool alloc_batch;
+    uint64_t alloc_batch_offset;
+    uint64_t alloc_batch_clusters;
+
     CoMutex lock;
 
+    /*
+     * Cached lookups in qcow2_try_get_host_offset() don't take s->lock.
+     * Instead, anything that may change the L1 table or the L2 table cache
+     * counts itself in meta_writers while it does (holding s->lock always
+     * counts), and increments meta_gen when it is done.  A lookup is valid
+     * if there were no writers while it ran and meta_gen didn't change.
+     */
+    unsigned meta_writers;
+    unsigned meta_gen;
+
     Qcow2CryptoHeaderExtension crypto_header; /* QCow2 header extension */
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
     QCryptoBlock *crypto; /* Disk encryption format driver */
@@ -408,8 +467,15 @@ typedef struct BDRVQcow2State {
     char *image_backing_format;
     char *image_data_file;
 
+    /* Compression and encryption jobs run in the thread pool */
+    CoMutex threads_lock;
     CoQueue thread_task_queue;
+    int max_threads;
     int nb_threads;
+    int nb_threads_queued;
+    uint64_t thread_jobs;
+    uint64_t thread_busy_ns;
+    uint64_t thread_wait_ns;
 
     BdrvChild *data_file;
 
@@ -598,6 +664,37 @@ typedef enum QCow2MetadataOverlap {
 
 #define INV_OFFSET (-1ULL)
 
+/*
+ * Like seqlock_write_begin() and seqlock_write_end(), but for any number of
+ * concurrent writers
+ */
+static inline void qcow2_meta_write_begin(BDRVQcow2State *s)
+{
+    qatomic_inc(&s->meta_writers);
+    /* Write meta_writers before the metadata */
+    smp_wmb();
+}
+
+static inline void qcow2_meta_write_end(BDRVQcow2State *s)
+{
+    /* Write the metadata before meta_gen */
+    smp_wmb();
+    qatomic_inc(&s->meta_gen);
+    qatomic_dec(&s->meta_writers);
+}
+
+static inline void coroutine_fn qcow2_co_lock(BDRVQcow2State *s)
+{
+    qemu_co_mutex_lock(&s->lock);
+    qcow2_meta_write_begin(s);
+}
+
+static inline void coroutine_fn qcow2_co_unlock(BDRVQcow2State *s)
+{
+    qcow2_meta_write_end(s);
+    qemu_co_mutex_unlock(&s->lock);
+}
+
 static inline bool has_subclusters(BDRVQcow2State *s)
 {
     return s->incompatible_features & QCOW2_INCOMPAT_EXTL2;
@@ -873,6 +970,11 @@ int64_t GRAPH_RDLOCK coroutine_fn
 qcow2_alloc_clusters_at(BlockDriverState *bs, uint64_t offset,
                         int64_t nb_clusters);
 
+int64_t GRAPH_RDLOCK coroutine_fn
+qcow2_alloc_data_clusters(BlockDriverState *bs, uint64_t offset,
+                          uint64_t *nb_clusters);
+int GRAPH_RDLOCK qcow2_release_alloc_batch(BlockDriverState *bs);
+
 int64_t coroutine_fn GRAPH_RDLOCK qcow2_alloc_bytes(BlockDriverState *bs, int size);
 void GRAPH_RDLOCK qcow2_free_clusters(BlockDriverState *bs,
                                       int64_t offset, int64_t size,
@@ -932,6 +1034,11 @@ qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
                       unsigned int *bytes, uint64_t *host_offset,
                       QCow2SubclusterType *subcluster_type);
 
+int GRAPH_RDLOCK
+qcow2_try_get_host_offset(BlockDriverState *bs, uint64_t offset,
+                          unsigned int *bytes, uint64_t *host_offset,
+                          QCow2SubclusterType *subcluster_type);
+
 int coroutine_fn GRAPH_RDLOCK
 qcow2_alloc_host_offset(BlockDriverState *bs, uint64_t offset,
                         unsigned int *bytes, uint64_t *host_offset,
@@ -1020,7 +1127,22 @@ qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 
 void qcow2_cache_put(Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
+void *qcow2_cache_peek(Qcow2Cache *c, uint64_t offset, bool count_use);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
+void qcow2_cache_get_stats(Qcow2Cache *c, uint64_t *hits, uint64_t *misses);
+void qcow2_cache_prefetch(BlockDriverState *bs, Qcow2Cache *c,
+                          uint64_t index);
+uint64_t *qcow2_cache_get_hot_tables(Qcow2Cache *c, int *nb_tables);
+int qcow2_cache_get_size(Qcow2Cache *c);
+
+/* qcow2-hot-cache.c functions */
+int coroutine_fn GRAPH_RDLOCK
+qcow2_hot_cache_read_ext(BlockDriverState *bs, uint64_t offset, uint32_t len);
+void *qcow2_hot_cache_build_ext(BlockDriverState *bs, size_t max_len,
+                                size_t *len);
+void qcow2_hot_cache_record(BlockDriverState *bs);
+void qcow2_hot_cache_prefetch(BlockDriverState *bs);
+void qcow2_hot_cache_free(BlockDriverState *bs);
 
 /* qcow2-bitmap.c functions */
 int coroutine_fn GRAPH_RDLOCK
@@ -29,6 +29,7 @@
 #include "qemu/main-loop.h"
 #include "qemu/queue.h"
 #include "qemu/thread.h"
+#include "qemu/timer.h"
 #include "sysemu/qtest.h"
 #include "qapi/error.h"
 #include "qapi/qapi-visit-block-core.h"
@@ -62,6 +63,16 @@ static void timer_cb(ThrottleGroupMember *tgm, ThrottleDirection direction);
  * blk_set_aio_context()). Therefore in this file a thread will
  * access some other ThrottleGroupMember's timers only after verifying that
  * that ThrottleGroupMember has throttled requests in the queue.
+ *
+ * Taking the lock for every request does not scale when many members
+ * submit I/O from different threads, so while no request in the group is
+ * waiting, members are handed a slice of credit: operations and bytes that
+ * are accounted in the buckets in advance and that the member then spends
+ * without the lock (see throttle_group_take_credit()).  As soon as one
+ * request has to wait, no member can spend its credit anymore and all
+ * requests go through the round-robin scheduler, so the fairness between
+ * members is the same as without credit except for the requests that were
+ * already in flight.
  */
 struct ThrottleGroup {
     Object parent_obj;
@@ -77,6 +88,14 @@ struct ThrottleGroup {
     bool any_timer_armed[THROTTLE_MAX];
     QEMUClockType clock_type;
 
+    /* Number of requests waiting in the members' queues; written with the
+     * lock held, read with atomic operations by throttle_group_take_credit().
+     */
+    unsigned waiters[THROTTLE_MAX];
+    /* ts.cfg.op_size for throttle_group_take_credit(), capped at
+     * CREDIT_BYTES_MAX so that it can be read atomically on all hosts */
+    unsigned long op_size;
+
     /* This field is protected by the global QEMU mutex */
     QTAILQ_ENTRY(ThrottleGroup) list;
 };
@@ -85,6 +104,22 @@ struct ThrottleGroup {
 static QTAILQ_HEAD(, ThrottleGroup) throttle_groups =
     QTAILQ_HEAD_INITIALIZER(throttle_groups);
 
+/* The credit of a ThrottleGroupMember packs a number of operations in the
+ * upper bits and a number of bytes in the lower bits, so that a request can
+ * take both with a single compare-and-swap.
+ */
+#define CREDIT_BITS         (sizeof(unsigned long) * 8)
+#define CREDIT_BYTES_BITS   (CREDIT_BITS * 5 / 8)
+#define CREDIT_BYTES_MAX    ((1UL << CREDIT_BYTES_BITS) - 1)
+#define CREDIT_OPS_MAX      ((1UL << (CREDIT_BITS - CREDIT_BYTES_BITS)) - 1)
+#define CREDIT(ops, bytes)  (((unsigned long)(ops) << CREDIT_BYTES_BITS) | \
+                             (bytes))
+#define CREDIT_OPS(c)       ((c) >> CREDIT_BYTES_BITS)
+#define CREDIT_BYTES(c)     ((c) & CREDIT_BYTES_MAX)
+
+/* A slice of credit is worth this much time at the configured rates */
+#define CREDIT_SLICE_NS     (1 * SCALE_MS)
+
 
 /* This function reads throttle_groups and must be called under the global
  * mutex.
@@ -350,6 +385,123 @@ static void coroutine_mixed_fn schedule_next_request(ThrottleGroupMember *tgm,
     }
 }
 
+/* Spend credit of a ThrottleGroupMember on an I/O request.  Return whether
+ * the request can be submitted right away, in which case it is already
+ * accounted.
+ *
+ * This does not take tg->lock.
+ *
+ * @tgm:       the current ThrottleGroupMember
+ * @bytes:     the number of bytes for this I/O
+ * @direction: the ThrottleDirection
+ */
+static bool throttle_group_take_credit(ThrottleGroupMember *tgm,
+                                       int64_t bytes,
+                                       ThrottleDirection direction)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+    unsigned long op_size = qatomic_read(&tg->op_size);
+    unsigned long old, cur, ops = 1;
+
+    if (qatomic_read(&tg->waiters[direction]) || bytes > CREDIT_BYTES_MAX) {
+        return false;
+    }
+
+    /* Round up, throttle_account() would count a fraction of an op */
+    if (op_size && bytes > op_size) {
+        ops = DIV_ROUND_UP(bytes, op_size);
+    }
+
+    cur = qatomic_read(&tgm->credit[direction]);
+    do {
+        old = cur;
+        if (CREDIT_OPS(old) < ops || CREDIT_BYTES(old) < bytes) {
+            return false;
+        }
+        cur = qatomic_cmpxchg(&tgm->credit[direction], old,
+                              old - CREDIT(ops, bytes));
+    } while (cur != old);
+
+    return true;
+}
+
+/* Give a ThrottleGroupMember a slice of credit if no request in the group is
+ * waiting and the buckets have room for it.
+ *
+ * This assumes that tg->lock is held.
+ *
+ * @tgm:       the current ThrottleGroupMember
+ * @direction: the ThrottleDirection
+ */
+static void throttle_group_grant_credit(ThrottleGroupMember *tgm,
+                                        ThrottleDirection direction)
+{
+    static const BucketType ops_buckets[THROTTLE_MAX][2] = {
+        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
+        { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
+    };
+    static const BucketType bytes_buckets[THROTTLE_MAX][2] = {
+        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
+        { THROTTLE_BPS_TOTAL, THROTTLE_BPS_WRITE }
+    };
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+    LeakyBucket *buckets = tg->ts.cfg.buckets;
+    unsigned long old, ops = CREDIT_OPS_MAX, bytes = CREDIT_BYTES_MAX;
+    int i;
+
+    if (tg->waiters[direction] || tg->any_timer_armed[direction] ||
+        qatomic_read(&tgm->io_limits_disabled)) {
+        return;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(ops_buckets[THROTTLE_READ]); i++) {
+        uint64_t avg = buckets[ops_buckets[direction][i]].avg;
+        if (avg) {
+            ops = MIN(ops, avg * CREDIT_SLICE_NS / NANOSECONDS_PER_SECOND);
+        }
+        avg = buckets[bytes_buckets[direction][i]].avg;
+        if (avg) {
+            bytes = MIN(bytes, avg * CREDIT_SLICE_NS / NANOSECONDS_PER_SECOND);
+        }
+    }
+
+    /* With limits this low the lock is not going to be contended anyway */
+    if (!ops || !bytes) {
+        return;
+    }
+
+    /* Only throttle_group_take_credit() can run concurrently and it only
+     * decreases the credit, so there is no overflow if this passes */
+    old = qatomic_read(&tgm->credit[direction]);
+    if (ops > CREDIT_OPS_MAX - CREDIT_OPS(old) ||
+        bytes > CREDIT_BYTES_MAX - CREDIT_BYTES(old)) {
+        return;
+    }
+
+    if (throttle_try_account(&tg->ts, direction,
+                             qemu_clock_get_ns(tg->clock_type), ops, bytes)) {
+        qatomic_add(&tgm->credit[direction], CREDIT(ops, bytes));
+    }
+}
+
+/* Drop the credit of all members of a group, after the configuration has
+ * changed and the buckets have been emptied.
+ *
+ * This assumes that tg->lock is held.
+ */
+static void throttle_group_reset_credit(ThrottleGroup *tg)
+{
+    ThrottleGroupMember *tgm;
+    ThrottleDirection dir;
+
+    qatomic_set(&tg->op_size, MIN(tg->ts.cfg.op_size, CREDIT_BYTES_MAX));
+    QLIST_FOREACH(tgm, &tg->head, round_robin) {
+        for (dir = THROTTLE_READ; dir < THROTTLE_MAX; dir++) {
+            qatomic_set(&tgm->credit[dir], 0);
+        }
+    }
+}
+
 /* Check if an I/O request needs to be throttled, wait and set a timer
  * if necessary, and schedule the next request using a round robin
  * algorithm.
@@ -369,6 +521,10 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     assert(bytes >= 0);
     assert(direction < THROTTLE_MAX);
 
+    if (throttle_group_take_credit(tgm, bytes, direction)) {
+        return;
+    }
+
     qemu_mutex_lock(&tg->lock);
 
     /* First we check if this I/O has to be throttled. */
@@ -377,14 +533,21 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
 
     /* Wait if there's a timer set or queued requests of this type */
     if (must_wait || tgm->pending_reqs[direction]) {
+        int64_t start_ns = get_clock();
+
         tgm->pending_reqs[direction]++;
+        qatomic_inc(&tg->waiters[direction]);
         qemu_mutex_unlock(&tg->lock);
         qemu_co_mutex_lock(&tgm->throttled_reqs_lock);
         qemu_co_queue_wait(&tgm->throttled_reqs[direction],
                            &tgm->throttled_reqs_lock);
         qemu_co_mutex_unlock(&tgm->throttled_reqs_lock);
         qemu_mutex_lock(&tg->lock);
+        qatomic_dec(&tg->waiters[direction]);
         tgm->pending_reqs[direction]--;
+
+        stat64_add(&tgm->throttled_ops[direction], 1);
+        stat64_add(&tgm->throttled_ns[direction], get_clock() - start_ns);
     }
 
     /* The I/O will be executed, so do the accounting */
@@ -393,6 +556,9 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
     /* Schedule the next request */
     schedule_next_request(tgm, direction);
 
+    /* Let the following requests of this member skip the lock */
+    throttle_group_grant_credit(tgm, direction);
+
     qemu_mutex_unlock(&tg->lock);
 }
 
@@ -478,6 +644,7 @@ void throttle_group_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg)
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
     qemu_mutex_lock(&tg->lock);
     throttle_config(ts, tg->clock_type, cfg);
+    throttle_group_reset_credit(tg);
     qemu_mutex_unlock(&tg->lock);
 
     throttle_group_restart_tgm(tgm);
@@ -499,6 +666,22 @@ void throttle_group_get_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg)
     qemu_mutex_unlock(&tg->lock);
 }
 
+/* Get the number of requests of a ThrottleGroupMember that had to wait for
+ * the group's limits, and the total time they waited.
+ *
+ * @tgm:       a ThrottleGroupMember that is a member of the group
+ * @direction: the ThrottleDirection
+ * @ops:       the number of requests that waited will be written here
+ * @ns:        the total time waited, in nanoseconds, will be written here
+ */
+void throttle_group_get_stats(ThrottleGroupMember *tgm,
+                              ThrottleDirection direction,
+                              uint64_t *ops, uint64_t *ns)
+{
+    *ops = stat64_get(&tgm->throttled_ops[direction]);
+    *ns = stat64_get(&tgm->throttled_ns[direction]);
+}
+
 /* ThrottleTimers callback. This wakes up a request that was waiting
  * because it had been throttled.
  *
@@ -559,6 +742,7 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
             tg->tokens[dir] = tgm;
         }
         qemu_co_queue_init(&tgm->throttled_reqs[dir]);
+        qatomic_set(&tgm->credit[dir], 0);
     }
 
     QLIST_INSERT_HEAD(&tg->head, tgm, round_robin);
@@ -792,6 +976,7 @@ static void throttle_group_obj_complete(UserCreatable *obj, Error **errp)
         return;
     }
     throttle_config(&tg->ts, tg->clock_type, &cfg);
+    qatomic_set(&tg->op_size, MIN(cfg.op_size, CREDIT_BYTES_MAX));
     QTAILQ_INSERT_TAIL(&throttle_groups, tg, list);
     tg->is_initialized = true;
 }
@@ -903,6 +1088,7 @@ static void throttle_group_set_limits(Object *obj, Visitor *v,
         goto unlock;
     }
     throttle_config(&tg->ts, tg->clock_type, &cfg);
+    throttle_group_reset_credit(tg);
 
 unlock:
     qemu_mutex_unlock(&tg->lock);
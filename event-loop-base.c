@@ -38,6 +38,12 @@ static EventLoopBaseParamInfo thread_pool_min_info = {
 static EventLoopBaseParamInfo thread_pool_max_info = {
     "thread-pool-max", offsetof(EventLoopBase, thread_pool_max),
 };
+static EventLoopBaseParamInfo io_uring_queue_depth_info = {
+    "io-uring-queue-depth", offsetof(EventLoopBase, io_uring_queue_depth),
+};
+static EventLoopBaseParamInfo io_uring_sqpoll_idle_info = {
+    "io-uring-sqpoll-idle", offsetof(EventLoopBase, io_uring_sqpoll_idle),
+};
 
 static void event_loop_base_get_param(Object *obj, Visitor *v,
         const char *name, void *opaque, Error **errp)
@@ -117,6 +123,14 @@ static void event_loop_base_class_init(ObjectClass *klass, void *class_data)
                               event_loop_base_get_param,
                               event_loop_base_set_param,
                               NULL, &thread_pool_max_info);
+    object_class_property_add(klass, "io-uring-queue-depth", "int",
+                              event_loop_base_get_param,
+                              event_loop_base_set_param,
+                              NULL, &io_uring_queue_depth_info);
+    object_class_property_add(klass, "io-uring-sqpoll-idle", "int",
+                              event_loop_base_get_param,
+                              event_loop_base_set_param,
+                              NULL, &io_uring_sqpoll_idle_info);
 }
 
 static const TypeInfo event_loop_base_info = {
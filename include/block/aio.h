@@ -204,6 +204,19 @@ struct AioContext {
 
     int thread_pool_min;
     int thread_pool_max;
+
+    /*
+     * Number of users whose events are not signalled through file
+     * descriptors and must be found by running the poll handlers, e.g.
+     * io_uring IOPOLL rings with requests in flight.  While non-zero,
+     * aio_poll() busy-polls instead of sleeping.  Only accessed from the
+     * home thread.
+     */
+    unsigned int busy_poll_users;
+
+    /* io_uring ring parameters, see aio_context_set_io_uring_params() */
+    unsigned int io_uring_queue_depth;
+    unsigned int io_uring_sqpoll_idle;
     /* Thread pool for performing work and receiving completion callbacks.
      * Has its own locking.
      */
@@ -215,6 +228,9 @@ struct AioContext {
 #ifdef CONFIG_LINUX_IO_URING
     LuringState *linux_io_uring;
 
+    /* State for O_DIRECT requests using an IOPOLL io_uring ring */
+    LuringState *linux_io_uring_iopoll;
+
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
     AioHandlerSList submit_list;
@@ -514,6 +530,12 @@ LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
 
 /* Return the LuringState bound to this AioContext */
 LuringState *aio_get_linux_io_uring(AioContext *ctx);
+
+/* Setup the LuringState with a completion-polling (IOPOLL) ring */
+LuringState *aio_setup_linux_io_uring_iopoll(AioContext *ctx, Error **errp);
+
+/* Return the IOPOLL LuringState bound to this AioContext */
+LuringState *aio_get_linux_io_uring_iopoll(AioContext *ctx);
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
@@ -721,4 +743,44 @@ void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch);
  */
 void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
                                         int64_t max, Error **errp);
+
+/**
+ * aio_context_set_io_uring_params:
+ * @ctx: the aio context
+ * @queue_depth: number of io_uring submission queue entries, 0 means that
+ *               the engine will use its default
+ * @sqpoll_idle: idle time of the kernel submission polling thread in
+ *               milliseconds, 0 disables submission queue polling
+ *
+ * The parameters are used when the context's io_uring ring is created;
+ * a ring that already exists is not resized.
+ */
+void aio_context_set_io_uring_params(AioContext *ctx, int64_t queue_depth,
+                                     int64_t sqpoll_idle, Error **errp);
+
+/**
+ * aio_busy_poll_inc:
+ * @ctx: the aio context
+ *
+ * Register a user whose events can only be detected by its ->io_poll()
+ * handler.  Until the matching aio_busy_poll_dec(), aio_poll() keeps running
+ * the poll handlers instead of sleeping in the file descriptor monitor.
+ * Must be called from the home thread of @ctx.
+ */
+static inline void aio_busy_poll_inc(AioContext *ctx)
+{
+    ctx->busy_poll_users++;
+}
+
+/**
+ * aio_busy_poll_dec:
+ * @ctx: the aio context
+ *
+ * Undo aio_busy_poll_inc().
+ */
+static inline void aio_busy_poll_dec(AioContext *ctx)
+{
+    assert(ctx->busy_poll_users > 0);
+    ctx->busy_poll_users--;
+}
 #endif
@@ -34,6 +34,12 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
 /* Function should be called prior any actual copy request */
 void block_copy_set_copy_opts(BlockCopyState *s, bool use_copy_range,
                               bool compress);
+/*
+ * Skip zero clusters and reference clusters already written to the target
+ * instead of writing them again.  Only applies to buffered copies.  Function
+ * should be called prior any actual copy request.
+ */
+void block_copy_set_dedup(BlockCopyState *s, bool dedup);
 void block_copy_set_progress_meter(BlockCopyState *s, ProgressMeter *pm);
 
 void block_copy_state_free(BlockCopyState *s);
@@ -59,10 +65,15 @@ int coroutine_fn block_copy(BlockCopyState *s, int64_t offset, int64_t bytes,
  * must be > 0.
  *
  * @max_chunk means maximum length for one IO operation. Zero means unlimited.
+ *
+ * If @adaptive is true, the number of parallel coroutines and the length of
+ * IO operations are tuned at runtime based on the observed throughput and
+ * latency, with @max_workers and @max_chunk as upper limits.
  */
 BlockCopyCallState *block_copy_async(BlockCopyState *s,
                                      int64_t offset, int64_t bytes,
                                      int max_workers, int64_t max_chunk,
+                                     bool adaptive,
                                      BlockCopyAsyncCallbackFunc cb,
                                      void *cb_opaque);
 
@@ -100,5 +111,9 @@ void block_copy_call_cancel(BlockCopyCallState *call_state);
 BdrvDirtyBitmap *block_copy_dirty_bitmap(BlockCopyState *s);
 int64_t block_copy_cluster_size(BlockCopyState *s);
 void block_copy_set_skip_unallocated(BlockCopyState *s, bool skip);
+void block_copy_get_dedup_stats(BlockCopyState *s, uint64_t *dedup_bytes,
+                                uint64_t *zero_bytes);
+void block_copy_get_adaptive_limits(BlockCopyState *s, int *workers,
+                                    int64_t *chunk);
 
 #endif /* BLOCK_COPY_H */
@@ -28,6 +28,7 @@
 #include "block/block-common.h"
 #include "block/block-global-state.h"
 #include "block/snapshot.h"
+#include "qemu/interval-tree.h"
 #include "qemu/iov.h"
 #include "qemu/rcu.h"
 #include "qemu/stats64.h"
@@ -83,13 +84,32 @@ typedef struct BdrvTrackedRequest {
     int64_t overlap_offset;
     int64_t overlap_bytes;
 
+    struct BdrvTrackedRequestShard *shard;
     QLIST_ENTRY(BdrvTrackedRequest) list;
+    /* Indexes [overlap_offset, overlap_offset + overlap_bytes) */
+    IntervalTreeNode node;
     Coroutine *co; /* owner, used for deadlock detection */
     CoQueue wait_queue; /* coroutines blocked on this request */
 
     struct BdrvTrackedRequest *waiting_for;
 } BdrvTrackedRequest;
 
+#define BDRV_TRACKED_SHARDS 16
+
+/*
+ * Tracked requests of a node are spread over shards by the thread that starts
+ * them, so that IOThreads submitting to the same node don't contend on one
+ * lock.  Starting and completing a request only takes the lock of its shard;
+ * serialising requests, which need to see all requests, take the locks of all
+ * shards in index order.
+ */
+typedef struct BdrvTrackedRequestShard {
+    QemuMutex lock;
+    QLIST_HEAD(, BdrvTrackedRequest) requests;
+    /* The same requests, for overlap lookups */
+    IntervalTreeRoot tree;
+} BdrvTrackedRequestShard;
+
 
 struct BlockDriver {
     /*
@@ -1235,9 +1255,10 @@ struct BlockDriverState {
 
     unsigned int write_gen;               /* Current data generation */
 
+    BdrvTrackedRequestShard tracked_shards[BDRV_TRACKED_SHARDS];
+
     /* Protected by reqs_lock.  */
     QemuMutex reqs_lock;
-    QLIST_HEAD(, BdrvTrackedRequest) tracked_requests;
     CoQueue flush_queue;                  /* Serializing flush queue */
     bool active_flush_req;                /* Flush request in flight? */
 
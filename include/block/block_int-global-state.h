@@ -90,6 +90,7 @@ void stream_start(const char *job_id, BlockDriverState *bs,
  * @filter_node_name: The node name that should be assigned to the filter
  * driver that the commit job inserts into the graph above @top. NULL means
  * that a node name should be autogenerated.
+ * @copy_offload: Whether to try copy offloading from @top to @base.
  * @errp: Error object.
  *
  */
@@ -98,7 +99,8 @@ void commit_start(const char *job_id, BlockDriverState *bs,
                   int creation_flags, int64_t speed,
                   BlockdevOnError on_error, const char *backing_file_str,
                   bool backing_mask_protocol,
-                  const char *filter_node_name, Error **errp);
+                  const char *filter_node_name, bool copy_offload,
+                  Error **errp);
 /**
  * commit_active_start:
  * @job_id: The id of the newly-created job, or %NULL to use the
@@ -115,6 +117,7 @@ void commit_start(const char *job_id, BlockDriverState *bs,
  * @cb: Completion function for the job.
  * @opaque: Opaque pointer value passed to @cb.
  * @auto_complete: Auto complete the job.
+ * @copy_offload: Whether to try copy offloading from @bs to @base.
  * @errp: Error object.
  *
  */
@@ -123,7 +126,8 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
                               int64_t speed, BlockdevOnError on_error,
                               const char *filter_node_name,
                               BlockCompletionFunc *cb, void *opaque,
-                              bool auto_complete, Error **errp);
+                              bool auto_complete, bool copy_offload,
+                              Error **errp);
 /*
  * mirror_start:
  * @job_id: The id of the newly-created job, or %NULL to use the
@@ -147,6 +151,9 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
  * driver that the mirror job inserts into the graph above @bs. NULL means that
  * a node name should be autogenerated.
  * @copy_mode: When to trigger writes to the target.
+ * @background_scan: Whether to look for allocated data while copying instead
+ * of before.
+ * @copy_offload: Whether to try copy offloading from @bs to @target.
  * @errp: Error object.
  *
  * Start a mirroring operation on @bs.  Clusters that are allocated
@@ -163,7 +170,8 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
                   bool unmap, const char *filter_node_name,
-                  MirrorCopyMode copy_mode, Error **errp);
+                  MirrorCopyMode copy_mode, bool background_scan,
+                  bool copy_offload, Error **errp);
 
 /*
  * backup_job_create:
@@ -80,6 +80,7 @@ static inline int coroutine_fn GRAPH_RDLOCK bdrv_co_pwrite(BdrvChild *child,
 void coroutine_fn bdrv_make_request_serialising(BdrvTrackedRequest *req,
                                                 uint64_t align);
 BdrvTrackedRequest *coroutine_fn bdrv_co_get_self_request(BlockDriverState *bs);
+bool bdrv_has_tracked_requests(BlockDriverState *bs);
 
 BlockDriver *bdrv_probe_all(const uint8_t *buf, int buf_size,
                             const char *filename);
@@ -66,12 +66,33 @@ void laio_attach_aio_context(LinuxAioState *s, AioContext *new_context);
 #endif
 /* io_uring.c - Linux io_uring implementation */
 #ifdef CONFIG_LINUX_IO_URING
-LuringState *luring_init(Error **errp);
+LuringState *luring_init(unsigned int entries, unsigned int sqpoll_idle,
+                         bool iopoll, Error **errp);
 void luring_cleanup(LuringState *s);
 
-/* luring_co_submit: submit I/O requests in the thread's current AioContext. */
-int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
-                                  QEMUIOVector *qiov, int type);
+/*
+ * luring_co_submit: submit I/O requests in the thread's current AioContext.
+ * @fixed_fd is what luring_register_fd() returned for @fd.  With @iopoll,
+ * the context's IOPOLL ring is used; it only accepts reads and writes on
+ * O_DIRECT file descriptors.
+ */
+int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, int fixed_fd,
+                                  uint64_t offset, QEMUIOVector *qiov,
+                                  int type, int flags, bool iopoll);
+
+/*
+ * Registered buffers and files are an optimization: they are registered with
+ * every io_uring ring where possible and silently ignored otherwise.  Buffers
+ * stay pinned until they are unregistered, so callers of
+ * luring_register_buf() must keep RAM discards disabled.
+ * luring_register_fd() returns the fixed file slot to pass to
+ * luring_co_submit(), or -1.  luring_unregister_fd() must be called with
+ * that slot before closing the file descriptor.
+ */
+void luring_register_buf(void *host, size_t size);
+void luring_unregister_buf(void *host, size_t size);
+int luring_register_fd(int fd);
+void luring_unregister_fd(int fixed_fd);
 void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
 #endif
@@ -26,6 +26,7 @@
 #define THROTTLE_GROUPS_H
 
 #include "qemu/coroutine.h"
+#include "qemu/stats64.h"
 #include "qemu/throttle.h"
 #include "qom/object.h"
 
@@ -49,6 +50,18 @@ typedef struct ThrottleGroupMember {
      */
     unsigned int restart_pending;
 
+    /* Operations and bytes already accounted in the group's buckets that
+     * this member may submit without taking the ThrottleGroup lock, packed
+     * as described in throttle-groups.c.  Accessed with atomic operations.
+     */
+    unsigned long credit[THROTTLE_MAX];
+
+    /* Number of requests that had to wait and the total time they spent
+     * waiting, in nanoseconds.
+     */
+    Stat64       throttled_ops[THROTTLE_MAX];
+    Stat64       throttled_ns[THROTTLE_MAX];
+
     /* The following fields are protected by the ThrottleGroup lock.
      * See the ThrottleGroup documentation for details.
      * throttle_state tells us if I/O limits are configured. */
@@ -69,6 +82,9 @@ void throttle_group_unref(ThrottleState *ts);
 
 void throttle_group_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg);
 void throttle_group_get_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg);
+void throttle_group_get_stats(ThrottleGroupMember *tgm,
+                              ThrottleDirection direction,
+                              uint64_t *ops, uint64_t *ns);
 
 void throttle_group_register_tgm(ThrottleGroupMember *tgm,
                                 const char *groupname,
@@ -57,6 +57,13 @@ struct RAMBlock {
      */
     off_t bitmap_offset;
     uint64_t pages_offset;
+    /*
+     * Compressed mapped-ram only: size of the data stored in the
+     * migration file for each MULTIFD_PACKET_SIZE region of the block,
+     * 0 if the region was never written.
+     */
+    uint32_t *file_index;
+    off_t index_offset;
 
     /* Bitmap of already received pages.  Only used on destination side. */
     unsigned long *receivedmap;
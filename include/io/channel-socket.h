@@ -49,6 +49,12 @@ struct QIOChannelSocket {
     socklen_t remoteAddrLen;
     ssize_t zero_copy_queued;
     ssize_t zero_copy_sent;
+    /*
+     * If set, a zero copy send that fails with ENOBUFS because the
+     * process can't lock more memory is retried as a copying send
+     * instead of failing.
+     */
+    bool zero_copy_fallback;
 };
 
 
@@ -261,5 +267,35 @@ QIOChannelSocket *
 qio_channel_socket_accept(QIOChannelSocket *ioc,
                           Error **errp);
 
+/**
+ * qio_channel_socket_enable_zero_copy:
+ * @ioc: the socket channel object
+ *
+ * Try to enable MSG_ZEROCOPY sends on the socket.  On success the
+ * channel gains QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY.  Sockets set
+ * up with qio_channel_socket_connect_sync() already have it enabled
+ * when the host supports it.
+ *
+ * Returns: true if zero copy sends are available on @ioc
+ */
+bool qio_channel_socket_enable_zero_copy(QIOChannelSocket *ioc);
+
+/**
+ * qio_channel_socket_zero_copy_reap:
+ * @ioc: the socket channel object
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Consume the zero copy completion notifications that the kernel
+ * has already queued on the socket, without waiting for more.
+ * Afterwards @ioc->zero_copy_sent tells how many of the
+ * @ioc->zero_copy_queued sends have completed, so that their
+ * buffers may be reused.  Unlike qio_channel_flush() this never
+ * blocks.
+ *
+ * Returns: 0 on success, -1 on error
+ */
+int qio_channel_socket_zero_copy_reap(QIOChannelSocket *ioc,
+                                      Error **errp);
+
 
 #endif /* QIO_CHANNEL_SOCKET_H */
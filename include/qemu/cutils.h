@@ -220,6 +220,15 @@ static inline bool buffer_is_zero(const void *buf, size_t len)
 #define buffer_is_zero  buffer_is_zero_ool
 #endif
 
+/*
+ * Return the number of leading values among @n big-endian 64-bit values,
+ * taken from @p every @stride (1 or 2) values, that are equal to
+ * @first + i * @delta, where i is the index of the value.
+ */
+size_t be64_run_length(const uint64_t *p, size_t n, size_t stride,
+                       uint64_t first, uint64_t delta);
+bool test_be64_run_length_next_accel(void);
+
 /*
  * Implementation of ULEB128 (http://en.wikipedia.org/wiki/LEB128)
  * Input is limited to 14-bit numbers
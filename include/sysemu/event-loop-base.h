@@ -36,5 +36,9 @@ struct EventLoopBase {
     /* AioContext thread pool parameters */
     int64_t thread_pool_min;
     int64_t thread_pool_max;
+
+    /* AioContext io_uring parameters */
+    int64_t io_uring_queue_depth;
+    int64_t io_uring_sqpoll_idle;
 };
 #endif
@@ -29,6 +29,9 @@ typedef struct KVMSlot
     /* Dirty bitmap cache for the slot */
     unsigned long *dirty_bmap;
     unsigned long dirty_bmap_size;
+    /* Range of pages in dirty_bmap collected from the dirty rings */
+    unsigned long dirty_start;
+    unsigned long dirty_end;
     /* Cache of the address space ID */
     int as_id;
     /* Cache of the offset in ram address space */
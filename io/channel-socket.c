@@ -164,15 +164,7 @@ int qio_channel_socket_connect_sync(QIOChannelSocket *ioc,
         return -1;
     }
 
-#ifdef QEMU_MSG_ZEROCOPY
-    int ret, v = 1;
-    ret = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v));
-    if (ret == 0) {
-        /* Zero copy available on host */
-        qio_channel_set_feature(QIO_CHANNEL(ioc),
-                                QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
-    }
-#endif
+    qio_channel_socket_enable_zero_copy(ioc);
 
     qio_channel_set_feature(QIO_CHANNEL(ioc),
                             QIO_CHANNEL_FEATURE_READ_MSG_PEEK);
@@ -611,7 +603,13 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
         case EINTR:
             goto retry;
         case ENOBUFS:
-            if (flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY) {
+            if (sflags && sioc->zero_copy_fallback) {
+                /* Send a copy of the data instead */
+                trace_qio_channel_socket_zero_copy_fallback(sioc);
+                sflags = 0;
+                goto retry;
+            }
+            if (sflags) {
                 error_setg_errno(errp, errno,
                                  "Process can't lock enough memory for using MSG_ZEROCOPY");
                 return -1;
@@ -624,7 +622,7 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
         return -1;
     }
 
-    if (flags & QIO_CHANNEL_WRITE_FLAG_ZERO_COPY) {
+    if (sflags) {
         sioc->zero_copy_queued++;
     }
 
@@ -724,11 +722,31 @@ static ssize_t qio_channel_socket_writev(QIOChannel *ioc,
 #endif /* WIN32 */
 
 
+bool qio_channel_socket_enable_zero_copy(QIOChannelSocket *ioc)
+{
 #ifdef QEMU_MSG_ZEROCOPY
-static int qio_channel_socket_flush(QIOChannel *ioc,
-                                    Error **errp)
+    int v = 1;
+
+    if (setsockopt(ioc->fd, SOL_SOCKET, SO_ZEROCOPY, &v, sizeof(v)) == 0) {
+        /* Zero copy available on host */
+        qio_channel_set_feature(QIO_CHANNEL(ioc),
+                                QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY);
+        return true;
+    }
+#endif
+    return false;
+}
+
+#ifdef QEMU_MSG_ZEROCOPY
+/*
+ * Process zero copy notifications from the socket error queue.  With
+ * @wait, block until every queued send has completed; otherwise stop as
+ * soon as the error queue is empty.
+ */
+static int qio_channel_socket_zero_copy_poll(QIOChannelSocket *sioc,
+                                             bool wait, Error **errp)
 {
-    QIOChannelSocket *sioc = QIO_CHANNEL_SOCKET(ioc);
+    QIOChannel *ioc = QIO_CHANNEL(sioc);
     struct msghdr msg = {};
     struct sock_extended_err *serr;
     struct cmsghdr *cm;
@@ -747,10 +765,13 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
     ret = 1;
 
     while (sioc->zero_copy_sent < sioc->zero_copy_queued) {
-        received = recvmsg(sioc->fd, &msg, MSG_ERRQUEUE);
+        received = recvmsg(sioc->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
         if (received < 0) {
             switch (errno) {
             case EAGAIN:
+                if (!wait) {
+                    return ret;
+                }
                 /* Nothing on errqueue, wait until something is available */
                 qio_channel_wait(ioc, G_IO_ERR);
                 continue;
@@ -800,6 +821,25 @@ static int qio_channel_socket_flush(QIOChannel *ioc,
     return ret;
 }
 
+static int qio_channel_socket_flush(QIOChannel *ioc,
+                                    Error **errp)
+{
+    return qio_channel_socket_zero_copy_poll(QIO_CHANNEL_SOCKET(ioc), true,
+                                             errp);
+}
+
+int qio_channel_socket_zero_copy_reap(QIOChannelSocket *ioc, Error **errp)
+{
+    return qio_channel_socket_zero_copy_poll(ioc, false, errp) < 0 ? -1 : 0;
+}
+
+#else /* !QEMU_MSG_ZEROCOPY */
+
+int qio_channel_socket_zero_copy_reap(QIOChannelSocket *ioc, Error **errp)
+{
+    return 0;
+}
+
 #endif /* QEMU_MSG_ZEROCOPY */
 
 static int
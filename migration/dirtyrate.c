@@ -394,6 +394,155 @@ static uint32_t get_ramblock_vfn_hash(struct RamblockDirtyInfo *info,
     return hash;
 }
 
+typedef struct DirtyRateHashChunk {
+    struct RamblockDirtyInfo *info;
+    uint64_t start;             /* first sample index handled */
+    uint64_t end;               /* one past the last sample index */
+    uint64_t dirty_count;       /* dirty samples found when comparing */
+} DirtyRateHashChunk;
+
+/*
+ * Helper threads hashing sampled pages.  The threads are created the
+ * first time a round needs them and live until the end of the
+ * measurement, so that both the record and the compare round of all
+ * RAMBlocks are served by the same threads.
+ */
+typedef struct DirtyRateHashPool {
+    QemuThread threads[DIRTYRATE_MAX_HASH_THREADS - 1];
+    unsigned int nr_threads;
+    QemuSemaphore start_sem;    /* posted once per woken thread per round */
+    QemuSemaphore done_sem;     /* posted by each thread at end of round */
+    bool quit;
+    bool compare;               /* compare against hash_result[] */
+    GArray *chunks;             /* DirtyRateHashChunk of the current round */
+    unsigned int next_chunk;    /* next chunk to be picked up */
+} DirtyRateHashPool;
+
+static void dirtyrate_hash_chunk(DirtyRateHashChunk *c, bool compare)
+{
+    struct RamblockDirtyInfo *info = c->info;
+    uint32_t hash;
+    uint64_t i;
+
+    for (i = c->start; i < c->end; i++) {
+        hash = get_ramblock_vfn_hash(info, info->sample_page_vfn[i]);
+        if (!compare) {
+            info->hash_result[i] = hash;
+        } else if (hash != info->hash_result[i]) {
+            trace_calc_page_dirty_rate(info->idstr, hash, info->hash_result[i]);
+            c->dirty_count++;
+        }
+    }
+}
+
+static void dirtyrate_hash_pool_work(DirtyRateHashPool *pool)
+{
+    unsigned int i;
+
+    while ((i = qatomic_fetch_inc(&pool->next_chunk)) < pool->chunks->len) {
+        dirtyrate_hash_chunk(&g_array_index(pool->chunks, DirtyRateHashChunk,
+                                            i),
+                             pool->compare);
+    }
+}
+
+static void *dirtyrate_hash_thread(void *opaque)
+{
+    DirtyRateHashPool *pool = opaque;
+
+    for (;;) {
+        qemu_sem_wait(&pool->start_sem);
+        if (pool->quit) {
+            break;
+        }
+        dirtyrate_hash_pool_work(pool);
+        qemu_sem_post(&pool->done_sem);
+    }
+
+    return NULL;
+}
+
+static void dirtyrate_hash_pool_init(DirtyRateHashPool *pool)
+{
+    memset(pool, 0, sizeof(*pool));
+    qemu_sem_init(&pool->start_sem, 0);
+    qemu_sem_init(&pool->done_sem, 0);
+    pool->chunks = g_array_new(false, false, sizeof(DirtyRateHashChunk));
+}
+
+static void dirtyrate_hash_pool_destroy(DirtyRateHashPool *pool)
+{
+    unsigned int i;
+
+    pool->quit = true;
+    for (i = 0; i < pool->nr_threads; i++) {
+        qemu_sem_post(&pool->start_sem);
+    }
+    for (i = 0; i < pool->nr_threads; i++) {
+        qemu_thread_join(&pool->threads[i]);
+    }
+
+    qemu_sem_destroy(&pool->start_sem);
+    qemu_sem_destroy(&pool->done_sem);
+    g_array_free(pool->chunks, true);
+}
+
+/*
+ * Queue all sampled pages of @info for the next dirtyrate_hash_pool_run(),
+ * in chunks of DIRTYRATE_HASH_PAGES_PER_THREAD pages.
+ */
+static void dirtyrate_hash_pool_add(DirtyRateHashPool *pool,
+                                    struct RamblockDirtyInfo *info)
+{
+    DirtyRateHashChunk c = { .info = info };
+
+    for (c.start = 0; c.start < info->sample_pages_count; c.start = c.end) {
+        c.end = MIN(c.start + DIRTYRATE_HASH_PAGES_PER_THREAD,
+                    info->sample_pages_count);
+        g_array_append_val(pool->chunks, c);
+    }
+}
+
+/*
+ * Hash all queued sampled pages, either recording the results or
+ * comparing them against the recorded ones and adding the dirty samples
+ * found to each RamblockDirtyInfo.  The calling thread picks up chunks,
+ * too, and only as many helpers are woken as there are chunks left for
+ * them, so that small sample sets are still hashed inline.
+ *
+ * The caller holds the RCU read lock for the whole call, which keeps
+ * the RAMBlocks alive while the helpers read from them.
+ */
+static void dirtyrate_hash_pool_run(DirtyRateHashPool *pool, bool compare)
+{
+    unsigned int nr_workers, i;
+
+    nr_workers = MIN(DIRTYRATE_MAX_HASH_THREADS - 1,
+                     pool->chunks->len ? pool->chunks->len - 1 : 0);
+    for (i = pool->nr_threads; i < nr_workers; i++) {
+        qemu_thread_create(&pool->threads[i], MIGRATION_THREAD_DIRTY_HASH,
+                           dirtyrate_hash_thread, pool, QEMU_THREAD_JOINABLE);
+    }
+    pool->nr_threads = MAX(pool->nr_threads, nr_workers);
+
+    pool->compare = compare;
+    pool->next_chunk = 0;
+    for (i = 0; i < nr_workers; i++) {
+        qemu_sem_post(&pool->start_sem);
+    }
+    dirtyrate_hash_pool_work(pool);
+    for (i = 0; i < nr_workers; i++) {
+        qemu_sem_wait(&pool->done_sem);
+    }
+
+    for (i = 0; compare && i < pool->chunks->len; i++) {
+        DirtyRateHashChunk *c = &g_array_index(pool->chunks,
+                                               DirtyRateHashChunk, i);
+        c->info->sample_dirty_count += c->dirty_count;
+    }
+    g_array_set_size(pool->chunks, 0);
+}
+
 static bool save_ramblock_hash(struct RamblockDirtyInfo *info)
 {
     unsigned int sample_pages_count;
@@ -424,8 +573,6 @@ static bool save_ramblock_hash(struct RamblockDirtyInfo *info)
     for (i = 0; i < sample_pages_count; i++) {
         info->sample_page_vfn[i] = g_rand_int_range(rand, 0,
                                                     info->ramblock_pages - 1);
-        info->hash_result[i] = get_ramblock_vfn_hash(info,
-                                                     info->sample_page_vfn[i]);
     }
     g_rand_free(rand);
 
@@ -482,6 +629,7 @@ static bool skip_sample_ramblock(RAMBlock *block)
 
 static bool record_ramblock_hash_info(struct RamblockDirtyInfo **block_dinfo,
                                       struct DirtyRateConfig config,
+                                      DirtyRateHashPool *pool,
                                       int *block_count)
 {
     struct RamblockDirtyInfo *info = NULL;
@@ -515,8 +663,10 @@ static bool record_ramblock_hash_info(struct RamblockDirtyInfo **block_dinfo,
         if (!save_ramblock_hash(info)) {
             goto out;
         }
+        dirtyrate_hash_pool_add(pool, info);
         index++;
     }
+    dirtyrate_hash_pool_run(pool, false);
     ret = true;
 
 out:
@@ -525,20 +675,6 @@ out:
     return ret;
 }
 
-static void calc_page_dirty_rate(struct RamblockDirtyInfo *info)
-{
-    uint32_t hash;
-    int i;
-
-    for (i = 0; i < info->sample_pages_count; i++) {
-        hash = get_ramblock_vfn_hash(info, info->sample_page_vfn[i]);
-        if (hash != info->hash_result[i]) {
-            trace_calc_page_dirty_rate(info->idstr, hash, info->hash_result[i]);
-            info->sample_dirty_count++;
-        }
-    }
-}
-
 static struct RamblockDirtyInfo *
 find_block_matched(RAMBlock *block, int count,
                   struct RamblockDirtyInfo *infos)
@@ -566,11 +702,16 @@ find_block_matched(RAMBlock *block, int count,
 }
 
 static bool compare_page_hash_info(struct RamblockDirtyInfo *info,
-                                  int block_count)
+                                   DirtyRateHashPool *pool,
+                                   int block_count)
 {
+    g_autofree struct RamblockDirtyInfo **matched = NULL;
     struct RamblockDirtyInfo *block_dinfo = NULL;
     RAMBlock *block = NULL;
+    int nr_matched = 0;
+    int i;
 
+    matched = g_new(struct RamblockDirtyInfo *, block_count);
     RAMBLOCK_FOREACH_MIGRATABLE(block) {
         if (skip_sample_ramblock(block)) {
             continue;
@@ -579,8 +720,13 @@ static bool compare_page_hash_info(struct RamblockDirtyInfo *info,
         if (block_dinfo == NULL) {
             continue;
         }
-        calc_page_dirty_rate(block_dinfo);
-        update_dirtyrate_stat(block_dinfo);
+        dirtyrate_hash_pool_add(pool, block_dinfo);
+        matched[nr_matched++] = block_dinfo;
+    }
+
+    dirtyrate_hash_pool_run(pool, true);
+    for (i = 0; i < nr_matched; i++) {
+        update_dirtyrate_stat(matched[i]);
     }
 
     if (DirtyStat.page_sampling.total_sample_count == 0) {
@@ -689,13 +835,17 @@ static void calculate_dirtyrate_dirty_ring(struct DirtyRateConfig config)
 static void calculate_dirtyrate_sample_vm(struct DirtyRateConfig config)
 {
     struct RamblockDirtyInfo *block_dinfo = NULL;
+    DirtyRateHashPool pool;
     int block_count = 0;
     int64_t initial_time;
 
+    dirtyrate_hash_pool_init(&pool);
+
     rcu_read_lock();
     initial_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
     DirtyStat.start_time = qemu_clock_get_ms(QEMU_CLOCK_HOST) / 1000;
-    if (!record_ramblock_hash_info(&block_dinfo, config, &block_count)) {
+    if (!record_ramblock_hash_info(&block_dinfo, config, &pool,
+                                   &block_count)) {
         goto out;
     }
     rcu_read_unlock();
@@ -704,7 +854,7 @@ static void calculate_dirtyrate_sample_vm(struct DirtyRateConfig config)
                                              initial_time);
 
     rcu_read_lock();
-    if (!compare_page_hash_info(block_dinfo, block_count)) {
+    if (!compare_page_hash_info(block_dinfo, &pool, block_count)) {
         goto out;
     }
 
@@ -712,6 +862,7 @@ static void calculate_dirtyrate_sample_vm(struct DirtyRateConfig config)
 
 out:
     rcu_read_unlock();
+    dirtyrate_hash_pool_destroy(&pool);
     free_ramblock_dirty_info(block_dinfo, block_count);
 }
 
@@ -39,10 +39,18 @@
 #define MAX_CALC_TIME_MS                       60000
 
 /*
- * Take 1/16 pages in 1G as the maxmum sample page count
+ * Take 1/4 pages in 1G as the maxmum sample page count
  */
 #define MIN_SAMPLE_PAGE_COUNT                     128
-#define MAX_SAMPLE_PAGE_COUNT                     16384
+#define MAX_SAMPLE_PAGE_COUNT                     65536
+
+/*
+ * Sampled pages are hashed in chunks of DIRTYRATE_HASH_PAGES_PER_THREAD
+ * pages by the measuring thread and up to DIRTYRATE_MAX_HASH_THREADS - 1
+ * helper threads, which are created once per measurement.
+ */
+#define DIRTYRATE_MAX_HASH_THREADS                8
+#define DIRTYRATE_HASH_PAGES_PER_THREAD           4096
 
 struct DirtyRateConfig {
     uint64_t sample_pages_per_gigabytes; /* sample pages per GB */
@@ -9,10 +9,12 @@
 #include "exec/ramblock.h"
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
+#include "qemu/iov.h"
 #include "qapi/error.h"
 #include "channel.h"
 #include "file.h"
 #include "migration.h"
+#include "ram.h"
 #include "io/channel-file.h"
 #include "io/channel-socket.h"
 #include "io/channel-util.h"
@@ -250,6 +252,47 @@ int file_write_ramblock_iov(QIOChannel *ioc, const struct iovec *iov,
     return (ret < 0) ? ret : 0;
 }
 
+/*
+ * Write the (possibly compressed) contents of the MULTIFD_PACKET_SIZE
+ * region covering @pages at the region's fixed offset in the file and
+ * record its size in the RAMBlock index.  Used by compressed
+ * mapped-ram, where each packet carries exactly one region.
+ */
+int file_write_ramblock_region(QIOChannel *ioc, const struct iovec *iov,
+                               int niov, MultiFDPages_t *pages, Error **errp)
+{
+    RAMBlock *block = pages->block;
+    ram_addr_t start = QEMU_ALIGN_DOWN(pages->offset[0], MULTIFD_PACKET_SIZE);
+    ram_addr_t len = MIN(MULTIFD_PACKET_SIZE, block->used_length - start);
+    size_t size = iov_size(iov, niov);
+    ram_addr_t offset;
+
+    if (size > len) {
+        error_setg(errp, "region at " RAM_ADDR_FMT " of ramblock %s "
+                   "does not fit its slot (%zu > " RAM_ADDR_FMT ")",
+                   start, block->idstr, size, len);
+        return -1;
+    }
+
+    if (qio_channel_pwritev(ioc, iov, niov, block->pages_offset + start,
+                            errp) < 0) {
+        return -1;
+    }
+
+    /*
+     * Regions are unique within a packet and packets for the same
+     * region are never in flight at the same time, so there is no
+     * concurrent update of this slot.
+     */
+    block->file_index[start / MULTIFD_PACKET_SIZE] = size;
+    for (offset = start; offset < start + len;
+         offset += multifd_ram_page_size()) {
+        ramblock_set_file_bmap_atomic(block, offset, true);
+    }
+
+    return 0;
+}
+
 int multifd_file_recv_data(MultiFDRecvParams *p, Error **errp)
 {
     MultiFDRecvData *data = p->data;
@@ -30,6 +30,7 @@
 
 #define  MIGRATION_THREAD_SNAPSHOT          "mig/snapshot"
 #define  MIGRATION_THREAD_DIRTY_RATE        "mig/dirtyrate"
+#define  MIGRATION_THREAD_DIRTY_HASH        "mig/dirtyhash"
 
 #define  MIGRATION_THREAD_SRC_MAIN          "mig/src/main"
 #define  MIGRATION_THREAD_SRC_MULTIFD       "mig/src/send_%d"
@@ -41,6 +42,8 @@
 #define  MIGRATION_THREAD_DST_FAULT         "mig/dst/fault"
 #define  MIGRATION_THREAD_DST_LISTEN        "mig/dst/listen"
 #define  MIGRATION_THREAD_DST_PREEMPT       "mig/dst/preempt"
+#define  MIGRATION_THREAD_DST_LAZY_FAULT    "mig/dst/lazyfault"
+#define  MIGRATION_THREAD_DST_LAZY_LOAD     "mig/dst/lazyload"
 
 struct PostcopyBlocktimeContext;
 
@@ -298,6 +298,18 @@ static inline bool multifd_queue_full(MultiFDPages_t *pages)
     return pages->num == multifd_ram_page_count();
 }
 
+/*
+ * Compressed mapped-ram stores each MULTIFD_PACKET_SIZE region as a
+ * single extent, so a packet must not span two regions.
+ */
+static inline bool multifd_queue_region_change(MultiFDPages_t *pages,
+                                               ram_addr_t offset)
+{
+    return migrate_mapped_ram_compressed() &&
+        offset / MULTIFD_PACKET_SIZE !=
+        pages->offset[0] / MULTIFD_PACKET_SIZE;
+}
+
 static inline void multifd_enqueue(MultiFDPages_t *pages, ram_addr_t offset)
 {
     pages->offset[pages->num++] = offset;
@@ -327,11 +339,13 @@ retry:
      * Not empty, meanwhile we need a flush.  It can because of either:
      *
      * (1) The page is not on the same ramblock of previous ones, or,
-     * (2) The queue is full.
+     * (2) The queue is full, or,
+     * (3) The page starts a new compressed mapped-ram region.
      *
      * After flush, always retry.
      */
-    if (pages->block != block || multifd_queue_full(pages)) {
+    if (pages->block != block || multifd_queue_full(pages) ||
+        multifd_queue_region_change(pages, offset)) {
         if (!multifd_send(&multifd_ram_send)) {
             return false;
         }
@@ -81,12 +81,23 @@ out:
     stat64_add(&mig_stats.zero_pages, pages->num - pages->normal_num);
 }
 
+/**
+ * multifd_recv_zero_page_process: Place zero pages on the destination.
+ *
+ * A page that was never received before is still the untouched,
+ * freshly allocated guest memory, so it is left alone and only marked
+ * as received; this keeps first-pass zero pages from being faulted in.
+ * Pages that were received before are only written if they are not
+ * already zero, so re-sent zero pages do not dirty host memory either.
+ *
+ * @param p A pointer to the recv params.
+ */
 void multifd_recv_zero_page_process(MultiFDRecvParams *p)
 {
     for (int i = 0; i < p->zero_num; i++) {
         void *page = p->host + p->zero[i];
         if (ramblock_recv_bitmap_test_byte_offset(p->block, p->zero[i])) {
-            memset(page, 0, multifd_ram_page_size());
+            ram_handle_zero(page, multifd_ram_page_size());
         } else {
             ramblock_recv_bitmap_set_offset(p->block, p->zero[i]);
         }
@@ -17,8 +17,10 @@
 #include "exec/target_page.h"
 #include "qapi/error.h"
 #include "migration.h"
+#include "migration-stats.h"
 #include "trace.h"
 #include "options.h"
+#include "file.h"
 #include "multifd.h"
 
 struct zstd_data {
@@ -88,6 +90,56 @@ static void multifd_zstd_send_cleanup(MultiFDSendParams *p, Error **errp)
     p->iov = NULL;
 }
 
+/*
+ * Compressed mapped-ram: compress the whole MULTIFD_PACKET_SIZE region
+ * containing the queued pages as one independent zstd frame, so that
+ * the destination can decompress any region on its own.  Regions that
+ * do not shrink are stored as is.
+ */
+static int multifd_zstd_send_prepare_mapped_ram(MultiFDSendParams *p,
+                                                Error **errp)
+{
+    MultiFDPages_t *pages = &p->data->u.ram;
+    struct zstd_data *z = p->compress_data;
+    ram_addr_t start = QEMU_ALIGN_DOWN(pages->offset[0], MULTIFD_PACKET_SIZE);
+    size_t len = MIN(MULTIFD_PACKET_SIZE, pages->block->used_length - start);
+    size_t ret;
+
+    z->in.src = pages->block->host + start;
+    z->in.size = len;
+    z->in.pos = 0;
+    z->out.dst = z->zbuff;
+    z->out.size = z->zbuff_len;
+    z->out.pos = 0;
+
+    do {
+        ret = ZSTD_compressStream2(z->zcs, &z->out, &z->in, ZSTD_e_end);
+    } while (ret > 0 && !ZSTD_isError(ret) && z->out.size > z->out.pos);
+    if (ZSTD_isError(ret)) {
+        error_setg(errp, "multifd %u: compressStream error %s",
+                   p->id, ZSTD_getErrorName(ret));
+        return -1;
+    }
+    if (ret > 0) {
+        error_setg(errp, "multifd %u: compressStream buffer too small",
+                   p->id);
+        return -1;
+    }
+
+    if (z->out.pos < len) {
+        p->iov[0].iov_base = z->zbuff;
+        p->iov[0].iov_len = z->out.pos;
+    } else {
+        p->iov[0].iov_base = pages->block->host + start;
+        p->iov[0].iov_len = len;
+    }
+    p->iovs_num = 1;
+    p->next_packet_size = p->iov[0].iov_len;
+
+    stat64_add(&mig_stats.normal_pages, pages->num);
+    return 0;
+}
+
 static int multifd_zstd_send_prepare(MultiFDSendParams *p, Error **errp)
 {
     MultiFDPages_t *pages = &p->data->u.ram;
@@ -95,6 +147,10 @@ static int multifd_zstd_send_prepare(MultiFDSendParams *p, Error **errp)
     int ret;
     uint32_t i;
 
+    if (migrate_mapped_ram()) {
+        return multifd_zstd_send_prepare_mapped_ram(p, errp);
+    }
+
     if (!multifd_send_prepare_common(p)) {
         goto out;
     }
@@ -193,6 +249,47 @@ static void multifd_zstd_recv_cleanup(MultiFDRecvParams *p)
     p->compress_data = NULL;
 }
 
+static int multifd_zstd_recv_mapped_ram(MultiFDRecvParams *p, Error **errp)
+{
+    MultiFDRecvData *data = p->data;
+    struct zstd_data *z = p->compress_data;
+    size_t ret;
+
+    if (!data->compressed_size) {
+        return multifd_file_recv_data(p, errp);
+    }
+
+    if (data->compressed_size > z->zbuff_len) {
+        error_setg(errp, "multifd %u: compressed region too large (%zu)",
+                   p->id, data->compressed_size);
+        return -1;
+    }
+
+    ret = qio_channel_pread(p->c, (char *)z->zbuff, data->compressed_size,
+                            data->file_offset, errp);
+    if (ret != data->compressed_size) {
+        error_prepend(errp,
+                      "multifd recv (%u): read 0x%zx, expected 0x%zx",
+                      p->id, ret, data->compressed_size);
+        return -1;
+    }
+
+    ret = ZSTD_decompressDCtx(z->zds, data->opaque, data->size,
+                              z->zbuff, data->compressed_size);
+    if (ZSTD_isError(ret)) {
+        error_setg(errp, "multifd %u: decompress returned %s",
+                   p->id, ZSTD_getErrorName(ret));
+        return -1;
+    }
+    if (ret != data->size) {
+        error_setg(errp, "multifd %u: region size received %zu "
+                   "size expected %zu", p->id, ret, data->size);
+        return -1;
+    }
+
+    return 0;
+}
+
 static int multifd_zstd_recv(MultiFDRecvParams *p, Error **errp)
 {
     uint32_t in_size = p->next_packet_size;
@@ -204,6 +301,10 @@ static int multifd_zstd_recv(MultiFDRecvParams *p, Error **errp)
     int ret;
     int i;
 
+    if (migrate_mapped_ram()) {
+        return multifd_zstd_recv_mapped_ram(p, errp);
+    }
+
     if (flags != MULTIFD_FLAG_ZSTD) {
         error_setg(errp, "multifd %u: flags received %x flags expected %x",
                    p->id, flags, MULTIFD_FLAG_ZSTD);
@@ -609,7 +609,10 @@ static void *multifd_send_thread(void *opaque)
                 break;
             }
 
-            if (migrate_mapped_ram()) {
+            if (migrate_mapped_ram_compressed()) {
+                ret = file_write_ramblock_region(p->c, p->iov, p->iovs_num,
+                                                 &p->data->u.ram, &local_err);
+            } else if (migrate_mapped_ram()) {
                 ret = file_write_ramblock_iov(p->c, p->iov, p->iovs_num,
                                               &p->data->u.ram, &local_err);
             } else {
@@ -88,6 +88,11 @@ struct MultiFDRecvData {
     size_t size;
     /* for preadv */
     off_t file_offset;
+    /*
+     * Compressed mapped-ram: number of compressed bytes stored at
+     * file_offset, or 0 if the region was stored uncompressed.
+     */
+    size_t compressed_size;
 };
 
 typedef enum {
@@ -196,6 +196,8 @@ Property migration_properties[] = {
                         MIGRATION_CAPABILITY_SWITCHOVER_ACK),
     DEFINE_PROP_MIG_CAP("x-dirty-limit", MIGRATION_CAPABILITY_DIRTY_LIMIT),
     DEFINE_PROP_MIG_CAP("mapped-ram", MIGRATION_CAPABILITY_MAPPED_RAM),
+    DEFINE_PROP_MIG_CAP("mapped-ram-lazy",
+                        MIGRATION_CAPABILITY_MAPPED_RAM_LAZY),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -248,6 +250,13 @@ bool migrate_mapped_ram(void)
     return s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM];
 }
 
+bool migrate_mapped_ram_lazy(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM_LAZY];
+}
+
 bool migrate_ignore_shared(void)
 {
     MigrationState *s = migrate_get_current();
@@ -599,6 +608,20 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
         }
     }
 
+    if (new_caps[MIGRATION_CAPABILITY_MAPPED_RAM_LAZY]) {
+        if (!new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+            error_setg(errp, "Capability 'mapped-ram-lazy' requires "
+                       "capability 'mapped-ram'");
+            return false;
+        }
+
+        if (!ram_mapped_ram_lazy_available()) {
+            error_setg(errp, "Lazy mapped-ram loading is not supported "
+                       "by host kernel");
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -702,10 +725,28 @@ bool migrate_direct_io(void)
      * multifd is needed to keep the unaligned portion of the stream
      * isolated to the main migration thread while multifd channels
      * process the aligned data with O_DIRECT enabled.
+     *
+     * Compressed mapped-ram writes variable-sized extents, which do not
+     * satisfy the O_DIRECT alignment restrictions.
      */
     return s->parameters.direct_io &&
         s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM] &&
-        s->capabilities[MIGRATION_CAPABILITY_MULTIFD];
+        s->capabilities[MIGRATION_CAPABILITY_MULTIFD] &&
+        !migrate_mapped_ram_compressed();
+}
+
+bool migrate_mapped_ram_compressed(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    /*
+     * Compressed mapped-ram stores each MULTIFD_PACKET_SIZE region of
+     * a RAMBlock as an independent zstd frame at the region's fixed
+     * offset, so it needs the multifd threads to do the compression.
+     */
+    return s->capabilities[MIGRATION_CAPABILITY_MAPPED_RAM] &&
+        s->capabilities[MIGRATION_CAPABILITY_MULTIFD] &&
+        s->parameters.multifd_compression == MULTIFD_COMPRESSION_ZSTD;
 }
 
 uint64_t migrate_downtime_limit(void)
@@ -1115,9 +1156,12 @@ bool migrate_params_check(MigrationParameters *params, Error **errp)
 #endif
 
     if (migrate_mapped_ram() &&
-        (migrate_multifd_compression() || migrate_tls())) {
+        ((migrate_multifd_compression() &&
+          migrate_multifd_compression() != MULTIFD_COMPRESSION_ZSTD) ||
+         migrate_tls())) {
         error_setg(errp,
-                   "Mapped-ram only available for non-compressed non-TLS multifd migration");
+                   "Mapped-ram only available for non-TLS multifd migration "
+                   "without compression or with zstd compression");
         return false;
     }
 
@@ -31,12 +31,14 @@
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 #include "qemu/madvise.h"
+#include "qemu/memalign.h"
 #include "qemu/main-loop.h"
 #include "xbzrle.h"
 #include "ram.h"
 #include "migration.h"
 #include "migration-stats.h"
 #include "migration/register.h"
+#include "migration/blocker.h"
 #include "migration/misc.h"
 #include "qemu-file.h"
 #include "postcopy-ram.h"
@@ -65,6 +67,8 @@
 #include "hw/boards.h" /* for machine_dump_guest_core() */
 
 #if defined(__linux__)
+#include <sys/eventfd.h>
+#include "io/channel-file.h"
 #include "qemu/userfaultfd.h"
 #endif /* defined(__linux__) */
 
@@ -2026,7 +2030,12 @@ static int ram_save_target_page_multifd(RAMState *rs, PageSearchStatus *pss)
      * While using multifd live migration, we still need to handle zero
      * page checking on the migration main thread.
      */
-    if (migrate_zero_page_detection() == ZERO_PAGE_DETECTION_LEGACY) {
+    if (migrate_zero_page_detection() == ZERO_PAGE_DETECTION_LEGACY &&
+        !migrate_mapped_ram_compressed()) {
+        /*
+         * Compressed mapped-ram rewrites whole regions, so zero pages
+         * must go through multifd too to refresh their region.
+         */
         if (save_zero_page(rs, pss, offset)) {
             return 1;
         }
@@ -2361,6 +2370,8 @@ static void ram_bitmaps_destroy(void)
         block->bmap = NULL;
         g_free(block->file_bmap);
         block->file_bmap = NULL;
+        g_free(block->file_index);
+        block->file_index = NULL;
     }
 }
 
@@ -2750,6 +2761,11 @@ static void ram_list_init_bitmaps(void)
             if (migrate_mapped_ram()) {
                 block->file_bmap = bitmap_new(pages);
             }
+            if (migrate_mapped_ram_compressed()) {
+                block->file_index = g_new0(uint32_t,
+                                           DIV_ROUND_UP(block->max_length,
+                                                        MULTIFD_PACKET_SIZE));
+            }
             block->clear_bmap_shift = shift;
             block->clear_bmap = bitmap_new(clear_bmap_size(pages, shift));
         }
@@ -2901,6 +2917,8 @@ void qemu_guest_free_page_hint(void *addr, size_t len)
 }
 
 #define MAPPED_RAM_HDR_VERSION 1
+/* Pages are stored as compressed regions, see MappedRamRegionHeader */
+#define MAPPED_RAM_HDR_VERSION_COMPRESSED 2
 struct MappedRamHeader {
     uint32_t version;
     /*
@@ -2921,14 +2939,37 @@ struct MappedRamHeader {
 } QEMU_PACKED;
 typedef struct MappedRamHeader MappedRamHeader;
 
+/*
+ * Follows MappedRamHeader for MAPPED_RAM_HDR_VERSION_COMPRESSED.  The
+ * pages area is split in regions of region_size bytes, each stored at
+ * its fixed offset in the pages area, either as a zstd frame or
+ * uncompressed.  The index holds one big-endian uint32_t per region
+ * with the number of bytes stored: 0 if the region was never written,
+ * the region size if it was stored uncompressed.  The unused tail of
+ * each region's slot is never written, so the file stays sparse.
+ */
+struct MappedRamRegionHeader {
+    uint64_t region_size;
+    /* The offset in the migration file where the region index is stored */
+    uint64_t index_offset;
+} QEMU_PACKED;
+typedef struct MappedRamRegionHeader MappedRamRegionHeader;
+
 static void mapped_ram_setup_ramblock(QEMUFile *file, RAMBlock *block)
 {
     g_autofree MappedRamHeader *header = NULL;
-    size_t header_size, bitmap_size;
+    MappedRamRegionHeader region_header;
+    bool compressed = migrate_mapped_ram_compressed();
+    size_t header_size, bitmap_size, index_size = 0;
     long num_pages;
 
     header = g_new0(MappedRamHeader, 1);
     header_size = sizeof(MappedRamHeader);
+    if (compressed) {
+        header_size += sizeof(MappedRamRegionHeader);
+        index_size = DIV_ROUND_UP(block->used_length, MULTIFD_PACKET_SIZE) *
+                     sizeof(uint32_t);
+    }
 
     num_pages = block->used_length >> TARGET_PAGE_BITS;
     bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
@@ -2939,16 +2980,26 @@ static void mapped_ram_setup_ramblock(QEMUFile *file, RAMBlock *block)
      * iterative phase, respectively.
      */
     block->bitmap_offset = qemu_get_offset(file) + header_size;
-    block->pages_offset = ROUND_UP(block->bitmap_offset +
-                                   bitmap_size,
+    block->index_offset = block->bitmap_offset + bitmap_size;
+    block->pages_offset = ROUND_UP(block->index_offset +
+                                   index_size,
                                    MAPPED_RAM_FILE_OFFSET_ALIGNMENT);
 
-    header->version = cpu_to_be32(MAPPED_RAM_HDR_VERSION);
+    header->version = cpu_to_be32(compressed ?
+                                  MAPPED_RAM_HDR_VERSION_COMPRESSED :
+                                  MAPPED_RAM_HDR_VERSION);
     header->page_size = cpu_to_be64(TARGET_PAGE_SIZE);
     header->bitmap_offset = cpu_to_be64(block->bitmap_offset);
     header->pages_offset = cpu_to_be64(block->pages_offset);
 
-    qemu_put_buffer(file, (uint8_t *) header, header_size);
+    qemu_put_buffer(file, (uint8_t *) header, sizeof(MappedRamHeader));
+
+    if (compressed) {
+        region_header.region_size = cpu_to_be64(MULTIFD_PACKET_SIZE);
+        region_header.index_offset = cpu_to_be64(block->index_offset);
+        qemu_put_buffer(file, (uint8_t *)&region_header,
+                        sizeof(MappedRamRegionHeader));
+    }
 
     /* prepare offset for next ramblock */
     qemu_set_offset(file, block->pages_offset + block->used_length, SEEK_SET);
@@ -2969,10 +3020,10 @@ static bool mapped_ram_read_header(QEMUFile *file, MappedRamHeader *header,
     /* migration stream is big-endian */
     header->version = be32_to_cpu(header->version);
 
-    if (header->version > MAPPED_RAM_HDR_VERSION) {
+    if (header->version > MAPPED_RAM_HDR_VERSION_COMPRESSED) {
         error_setg(errp, "Migration mapped-ram capability version not "
-                   "supported (expected <= %d, got %d)", MAPPED_RAM_HDR_VERSION,
-                   header->version);
+                   "supported (expected <= %d, got %d)",
+                   MAPPED_RAM_HDR_VERSION_COMPRESSED, header->version);
         return false;
     }
 
@@ -2983,6 +3034,37 @@ static bool mapped_ram_read_header(QEMUFile *file, MappedRamHeader *header,
     return true;
 }
 
+static bool mapped_ram_read_region_header(QEMUFile *file,
+                                          MappedRamRegionHeader *header,
+                                          Error **errp)
+{
+    size_t ret, header_size = sizeof(MappedRamRegionHeader);
+
+    if (!migrate_mapped_ram_compressed()) {
+        error_setg(errp, "Compressed mapped-ram migration file requires "
+                   "multifd with zstd compression");
+        return false;
+    }
+
+    ret = qemu_get_buffer(file, (uint8_t *)header, header_size);
+    if (ret != header_size) {
+        error_setg(errp, "Could not read whole mapped-ram region header "
+                   "(expected %zd, got %zd bytes)", header_size, ret);
+        return false;
+    }
+
+    header->region_size = be64_to_cpu(header->region_size);
+    header->index_offset = be64_to_cpu(header->index_offset);
+
+    if (header->region_size != MULTIFD_PACKET_SIZE) {
+        error_setg(errp, "Unsupported mapped-ram region size %" PRIu64,
+                   header->region_size);
+        return false;
+    }
+
+    return true;
+}
+
 /*
  * Each of ram_save_setup, ram_save_iterate and ram_save_complete has
  * long-running RCU critical section.  When rcu-reclaims in the code
@@ -3104,6 +3186,25 @@ static void ram_save_file_bmap(QEMUFile *f)
          */
         g_free(block->file_bmap);
         block->file_bmap = NULL;
+
+        if (block->file_index) {
+            long num_regions = DIV_ROUND_UP(block->used_length,
+                                            MULTIFD_PACKET_SIZE);
+            g_autofree uint32_t *index = g_new(uint32_t, num_regions);
+            long i;
+
+            /* migration stream is big-endian */
+            for (i = 0; i < num_regions; i++) {
+                index[i] = cpu_to_be32(block->file_index[i]);
+            }
+            qemu_put_buffer_at(f, (uint8_t *)index,
+                               num_regions * sizeof(uint32_t),
+                               block->index_offset);
+            ram_transferred_add(num_regions * sizeof(uint32_t));
+
+            g_free(block->file_index);
+            block->file_index = NULL;
+        }
     }
 }
 
@@ -3891,13 +3992,14 @@ void colo_flush_ram_cache(void)
 }
 
 static size_t ram_load_multifd_pages(void *host_addr, size_t size,
-                                     uint64_t offset)
+                                     uint64_t offset, size_t compressed_size)
 {
     MultiFDRecvData *data = multifd_get_recv_data();
 
     data->opaque = host_addr;
     data->file_offset = offset;
     data->size = size;
+    data->compressed_size = compressed_size;
 
     if (!multifd_recv()) {
         return 0;
@@ -3937,7 +4039,7 @@ static bool read_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
 
             if (migrate_multifd()) {
                 read = ram_load_multifd_pages(host, size,
-                                              block->pages_offset + offset);
+                                              block->pages_offset + offset, 0);
             } else {
                 read = qemu_get_buffer_at(f, host, size,
                                           block->pages_offset + offset);
@@ -3961,11 +4063,514 @@ err:
     return false;
 }
 
+static bool read_ramblock_mapped_ram_compressed(QEMUFile *f, RAMBlock *block,
+                                                ram_addr_t length,
+                                                MappedRamRegionHeader *header,
+                                                Error **errp)
+{
+    g_autofree uint32_t *index = NULL;
+    long num_regions = DIV_ROUND_UP(length, header->region_size);
+    size_t index_size = num_regions * sizeof(uint32_t);
+    ram_addr_t offset, len;
+    size_t stored;
+    void *host;
+    long i;
+
+    index = g_malloc(index_size);
+    if (qemu_get_buffer_at(f, (uint8_t *)index, index_size,
+                           header->index_offset) != index_size) {
+        error_setg(errp, "Error reading mapped-ram region index");
+        return false;
+    }
+
+    /* Each region is read and decompressed by one multifd channel */
+    for (i = 0; i < num_regions; i++) {
+        stored = be32_to_cpu(index[i]);
+        if (!stored) {
+            continue;
+        }
+
+        offset = i * header->region_size;
+        len = MIN(header->region_size, length - offset);
+        if (stored > len) {
+            error_setg(errp, "(%s) invalid size %zu for region at "
+                       RAM_ADDR_FMT, block->idstr, stored, offset);
+            return false;
+        }
+
+        host = host_from_ram_block_offset(block, offset);
+        if (!host) {
+            error_setg(errp, "page outside of ramblock %s range",
+                       block->idstr);
+            return false;
+        }
+
+        if (!ram_load_multifd_pages(host, len, block->pages_offset + offset,
+                                    stored == len ? 0 : stored)) {
+            qemu_file_get_error_obj(f, errp);
+            error_prepend(errp, "(%s) failed to read region " RAM_ADDR_FMT
+                          ": ", block->idstr, offset);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#if defined(__linux__)
+/*
+ * Lazy loading of mapped-ram files: instead of reading all of guest RAM
+ * before the VM can run, the pages are discarded and registered with
+ * userfaultfd.  Missing-page faults are served from the file by a fault
+ * thread while a background thread streams in the rest of the pages.
+ */
+typedef struct MappedRamLazyBlock {
+    RAMBlock *block;
+    /* Pages present in the file, in units of target pages */
+    unsigned long *file_bmap;
+    /* Host pages already claimed by the fault or the load thread */
+    unsigned long *claimed;
+    long num_host_pages;
+} MappedRamLazyBlock;
+
+typedef struct MappedRamLazyLoad {
+    GArray *blocks;
+    /* Our own reference to the migration file, which is closed on exit */
+    int fd;
+    int uffd;
+    int quit_fd;
+    /* Large enough to hold the biggest host page of any block */
+    size_t buf_size;
+    QemuThread fault_thread;
+    QemuThread load_thread;
+    Error *blocker;
+    uint64_t faults;
+    int64_t start_time;
+} MappedRamLazyLoad;
+
+static MappedRamLazyLoad *mapped_ram_lazy;
+
+bool ram_mapped_ram_lazy_available(void)
+{
+    uint64_t uffd_features;
+
+    return uffd_query_features(&uffd_features) == 0;
+}
+
+static void mapped_ram_lazy_add_block(RAMBlock *block, unsigned long *bitmap)
+{
+    MappedRamLazyBlock lb = {
+        .block = block,
+        .file_bmap = bitmap,
+        .num_host_pages = block->used_length / block->page_size,
+    };
+
+    if (!mapped_ram_lazy) {
+        mapped_ram_lazy = g_new0(MappedRamLazyLoad, 1);
+        mapped_ram_lazy->blocks = g_array_new(false, false,
+                                              sizeof(MappedRamLazyBlock));
+        mapped_ram_lazy->fd = -1;
+        mapped_ram_lazy->uffd = -1;
+        mapped_ram_lazy->quit_fd = -1;
+    }
+
+    lb.claimed = bitmap_new(lb.num_host_pages);
+    mapped_ram_lazy->buf_size = MAX(mapped_ram_lazy->buf_size,
+                                    block->page_size);
+    g_array_append_val(mapped_ram_lazy->blocks, lb);
+}
+
+static void mapped_ram_lazy_free(void)
+{
+    MappedRamLazyLoad *lazy = mapped_ram_lazy;
+    int i;
+
+    if (!lazy) {
+        return;
+    }
+
+    for (i = 0; i < lazy->blocks->len; i++) {
+        MappedRamLazyBlock *lb = &g_array_index(lazy->blocks,
+                                                MappedRamLazyBlock, i);
+
+        g_free(lb->file_bmap);
+        g_free(lb->claimed);
+    }
+    g_array_free(lazy->blocks, true);
+
+    if (lazy->quit_fd >= 0) {
+        close(lazy->quit_fd);
+    }
+    if (lazy->uffd >= 0) {
+        uffd_close_fd(lazy->uffd);
+    }
+    if (lazy->fd >= 0) {
+        close(lazy->fd);
+    }
+    g_free(lazy);
+    mapped_ram_lazy = NULL;
+}
+
+/*
+ * Claim a host page for loading.  Whoever claims a page first places it;
+ * its UFFDIO_COPY also wakes up any vCPU faulting on it in the meantime.
+ */
+static bool mapped_ram_lazy_claim(MappedRamLazyBlock *lb, long page)
+{
+    unsigned long mask = BIT_MASK(page);
+    unsigned long *p = lb->claimed + BIT_WORD(page);
+
+    return !(qatomic_fetch_or(p, mask) & mask);
+}
+
+static void mapped_ram_lazy_pread(MappedRamLazyLoad *lazy,
+                                  MappedRamLazyBlock *lb, uint8_t *buf,
+                                  size_t size, ram_addr_t offset)
+{
+    off_t pos = lb->block->pages_offset + offset;
+    ssize_t ret;
+
+    while (size) {
+        ret = pread(lazy->fd, buf, size, pos);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            /*
+             * The pages are gone from the source already and a vCPU may
+             * be waiting for this one: there is no way to carry on.
+             */
+            error_report("(%s) lazy mapped-ram load failed to read page "
+                         RAM_ADDR_FMT " from file offset %" PRIx64 ": %s",
+                         lb->block->idstr, offset, (uint64_t)pos,
+                         ret < 0 ? strerror(errno) : "unexpected end of file");
+            exit(EXIT_FAILURE);
+        }
+        buf += ret;
+        pos += ret;
+        offset += ret;
+        size -= ret;
+    }
+}
+
+/*
+ * Load @npages claimed host pages starting at host page @page into guest
+ * memory.  Pages not present in the file are zero on the source.
+ */
+static void mapped_ram_lazy_load_pages(MappedRamLazyLoad *lazy,
+                                       MappedRamLazyBlock *lb, long page,
+                                       long npages, uint8_t *buf)
+{
+    RAMBlock *block = lb->block;
+    unsigned long start = page * (block->page_size >> TARGET_PAGE_BITS);
+    unsigned long end = start +
+                        npages * (block->page_size >> TARGET_PAGE_BITS);
+    unsigned long set_bit_idx, clear_bit_idx = start;
+    ram_addr_t offset = (ram_addr_t)page * block->page_size;
+    void *host = block->host + offset;
+    size_t size = npages * block->page_size;
+    bool present = false;
+    int ret;
+
+    while (clear_bit_idx < end) {
+        set_bit_idx = find_next_bit(lb->file_bmap, end, clear_bit_idx);
+        memset(buf + ((clear_bit_idx - start) << TARGET_PAGE_BITS), 0,
+               (set_bit_idx - clear_bit_idx) << TARGET_PAGE_BITS);
+        if (set_bit_idx >= end) {
+            break;
+        }
+
+        clear_bit_idx = find_next_zero_bit(lb->file_bmap, end,
+                                           set_bit_idx + 1);
+        mapped_ram_lazy_pread(lazy, lb,
+                              buf + ((set_bit_idx - start) << TARGET_PAGE_BITS),
+                              (clear_bit_idx - set_bit_idx) << TARGET_PAGE_BITS,
+                              set_bit_idx << TARGET_PAGE_BITS);
+        present = true;
+    }
+
+    /* UFFDIO_ZEROPAGE is not supported for huge pages */
+    if (!present && block->page_size == qemu_real_host_page_size()) {
+        ret = uffd_zero_page(lazy->uffd, host, size, false);
+    } else {
+        ret = uffd_copy_page(lazy->uffd, host, buf, size, false);
+    }
+    if (ret) {
+        error_report("(%s) lazy mapped-ram load failed to place page "
+                     RAM_ADDR_FMT ": %s", block->idstr, offset,
+                     strerror(-ret));
+        exit(EXIT_FAILURE);
+    }
+}
+
+static MappedRamLazyBlock *mapped_ram_lazy_find_block(MappedRamLazyLoad *lazy,
+                                                      RAMBlock *block)
+{
+    int i;
+
+    for (i = 0; i < lazy->blocks->len; i++) {
+        MappedRamLazyBlock *lb = &g_array_index(lazy->blocks,
+                                                MappedRamLazyBlock, i);
+        if (lb->block == block) {
+            return lb;
+        }
+    }
+    return NULL;
+}
+
+static void *mapped_ram_lazy_fault_thread(void *opaque)
+{
+    MappedRamLazyLoad *lazy = opaque;
+    struct pollfd pfd[2] = {
+        { .fd = lazy->uffd, .events = POLLIN },
+        { .fd = lazy->quit_fd, .events = POLLIN },
+    };
+    struct uffd_msg msgs[16];
+    uint8_t *buf = qemu_memalign(qemu_real_host_page_size(), lazy->buf_size);
+    int i, n;
+
+    rcu_register_thread();
+
+    while (true) {
+        if (poll(pfd, ARRAY_SIZE(pfd), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_report("%s: poll failed: %s", __func__, strerror(errno));
+            break;
+        }
+        if (pfd[1].revents) {
+            break;
+        }
+
+        n = uffd_read_events(lazy->uffd, msgs, ARRAY_SIZE(msgs));
+        if (n < 0) {
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            void *addr = (void *)(uintptr_t)msgs[i].arg.pagefault.address;
+            MappedRamLazyBlock *lb = NULL;
+            ram_addr_t offset;
+            RAMBlock *block;
+            long page;
+
+            if (msgs[i].event != UFFD_EVENT_PAGEFAULT) {
+                continue;
+            }
+
+            WITH_RCU_READ_LOCK_GUARD() {
+                block = qemu_ram_block_from_host(addr, false, &offset);
+                if (block) {
+                    lb = mapped_ram_lazy_find_block(lazy, block);
+                }
+            }
+            if (!lb) {
+                error_report("%s: unexpected fault at %p", __func__, addr);
+                continue;
+            }
+
+            trace_mapped_ram_lazy_load_fault(block->idstr, offset);
+            lazy->faults++;
+
+            page = offset / block->page_size;
+            if (mapped_ram_lazy_claim(lb, page)) {
+                mapped_ram_lazy_load_pages(lazy, lb, page, 1, buf);
+            }
+        }
+    }
+
+    rcu_unregister_thread();
+    qemu_vfree(buf);
+    return NULL;
+}
+
+static void *mapped_ram_lazy_load_thread(void *opaque)
+{
+    MappedRamLazyLoad *lazy = opaque;
+    size_t buf_size = MAX(lazy->buf_size, MAPPED_RAM_LOAD_BUF_SIZE);
+    uint8_t *buf = qemu_memalign(qemu_real_host_page_size(), buf_size);
+    uint64_t one = 1;
+    long page, n, max;
+    int i;
+
+    for (i = 0; i < lazy->blocks->len; i++) {
+        MappedRamLazyBlock *lb = &g_array_index(lazy->blocks,
+                                                MappedRamLazyBlock, i);
+
+        max = buf_size / lb->block->page_size;
+        for (page = 0; page < lb->num_host_pages; page += n) {
+            if (!mapped_ram_lazy_claim(lb, page)) {
+                n = 1;
+                continue;
+            }
+            /* Extend the run until a page faulted in by a vCPU */
+            for (n = 1; n < max && page + n < lb->num_host_pages; n++) {
+                if (!mapped_ram_lazy_claim(lb, page + n)) {
+                    break;
+                }
+            }
+            mapped_ram_lazy_load_pages(lazy, lb, page, n, buf);
+        }
+    }
+    qemu_vfree(buf);
+
+    if (write(lazy->quit_fd, &one, sizeof(one)) != sizeof(one)) {
+        error_report("%s: failed to stop the fault thread", __func__);
+    }
+    qemu_thread_join(&lazy->fault_thread);
+
+    for (i = 0; i < lazy->blocks->len; i++) {
+        MappedRamLazyBlock *lb = &g_array_index(lazy->blocks,
+                                                MappedRamLazyBlock, i);
+
+        uffd_unregister_memory(lazy->uffd, lb->block->host,
+                               lb->block->used_length);
+    }
+
+    trace_mapped_ram_lazy_load_complete(lazy->faults,
+                            qemu_clock_get_ms(QEMU_CLOCK_REALTIME) -
+                            lazy->start_time);
+
+    bql_lock();
+    for (i = 0; i < lazy->blocks->len; i++) {
+        memory_region_unref(g_array_index(lazy->blocks,
+                                          MappedRamLazyBlock, i).block->mr);
+    }
+    migrate_del_blocker(&lazy->blocker);
+    ram_block_discard_disable(false);
+    mapped_ram_lazy_free();
+    bql_unlock();
+
+    return NULL;
+}
+
+/*
+ * Switch the blocks recorded while parsing the mapped-ram headers over to
+ * lazy loading.  Called with the BQL held, before any device state is
+ * loaded.
+ */
+static bool mapped_ram_lazy_load_start(QEMUFile *f, Error **errp)
+{
+    MappedRamLazyLoad *lazy = mapped_ram_lazy;
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    uint64_t uffd_ioctls;
+    int i, registered = 0;
+
+    if (!lazy) {
+        return true;
+    }
+
+    if (!object_dynamic_cast(OBJECT(ioc), TYPE_QIO_CHANNEL_FILE)) {
+        error_setg(errp, "Lazy mapped-ram loading requires a file "
+                   "migration channel");
+        goto err;
+    }
+
+    if (ram_block_discard_is_disabled()) {
+        error_setg(errp, "Lazy mapped-ram loading cannot discard RAM");
+        goto err;
+    }
+
+    lazy->fd = qemu_dup(QIO_CHANNEL_FILE(ioc)->fd);
+    if (lazy->fd < 0) {
+        error_setg_errno(errp, errno, "Failed to duplicate migration file");
+        goto err;
+    }
+
+    lazy->quit_fd = eventfd(0, EFD_CLOEXEC);
+    if (lazy->quit_fd < 0) {
+        error_setg_errno(errp, errno, "Failed to create eventfd");
+        goto err;
+    }
+
+    lazy->uffd = uffd_create_fd(0, true);
+    if (lazy->uffd < 0) {
+        error_setg(errp, "Failed to create userfaultfd");
+        goto err;
+    }
+
+    error_setg(&lazy->blocker, "Lazy mapped-ram loading in progress");
+    if (migrate_add_blocker_internal(&lazy->blocker, errp) < 0) {
+        goto err;
+    }
+    ram_block_discard_disable(true);
+
+    for (; registered < lazy->blocks->len; registered++) {
+        RAMBlock *block = g_array_index(lazy->blocks, MappedRamLazyBlock,
+                                        registered).block;
+
+        if (ram_block_discard_range(block, 0, block->used_length) ||
+            uffd_register_memory(lazy->uffd, block->host, block->used_length,
+                                 UFFDIO_REGISTER_MODE_MISSING, &uffd_ioctls)) {
+            error_setg(errp, "Failed to register ramblock %s for lazy "
+                       "loading", block->idstr);
+            goto err_unregister;
+        }
+        if (!(uffd_ioctls & BIT(_UFFDIO_COPY))) {
+            error_setg(errp, "Ramblock %s does not support lazy loading",
+                       block->idstr);
+            uffd_unregister_memory(lazy->uffd, block->host,
+                                   block->used_length);
+            goto err_unregister;
+        }
+        memory_region_ref(block->mr);
+    }
+
+    trace_mapped_ram_lazy_load_start(lazy->blocks->len);
+    lazy->start_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+
+    qemu_thread_create(&lazy->fault_thread, MIGRATION_THREAD_DST_LAZY_FAULT,
+                       mapped_ram_lazy_fault_thread, lazy,
+                       QEMU_THREAD_JOINABLE);
+    qemu_thread_create(&lazy->load_thread, MIGRATION_THREAD_DST_LAZY_LOAD,
+                       mapped_ram_lazy_load_thread, lazy,
+                       QEMU_THREAD_DETACHED);
+    return true;
+
+err_unregister:
+    for (i = 0; i < registered; i++) {
+        RAMBlock *block = g_array_index(lazy->blocks, MappedRamLazyBlock,
+                                        i).block;
+
+        uffd_unregister_memory(lazy->uffd, block->host, block->used_length);
+        memory_region_unref(block->mr);
+    }
+    ram_block_discard_disable(false);
+    migrate_del_blocker(&lazy->blocker);
+err:
+    mapped_ram_lazy_free();
+    return false;
+}
+
+#else
+
+bool ram_mapped_ram_lazy_available(void)
+{
+    return false;
+}
+
+static void mapped_ram_lazy_add_block(RAMBlock *block, unsigned long *bitmap)
+{
+    g_assert_not_reached();
+}
+
+static void mapped_ram_lazy_free(void)
+{
+}
+
+static bool mapped_ram_lazy_load_start(QEMUFile *f, Error **errp)
+{
+    return true;
+}
+#endif /* defined(__linux__) */
+
 static void parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
                                       ram_addr_t length, Error **errp)
 {
     g_autofree unsigned long *bitmap = NULL;
     MappedRamHeader header;
+    MappedRamRegionHeader region_header;
     size_t bitmap_size;
     long num_pages;
 
@@ -3973,6 +4578,11 @@ static void parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
         return;
     }
 
+    if (header.version == MAPPED_RAM_HDR_VERSION_COMPRESSED &&
+        !mapped_ram_read_region_header(f, &region_header, errp)) {
+        return;
+    }
+
     block->pages_offset = header.pages_offset;
 
     /*
@@ -3988,6 +4598,22 @@ static void parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
         return;
     }
 
+    if (header.version == MAPPED_RAM_HDR_VERSION_COMPRESSED) {
+        if (migrate_mapped_ram_lazy()) {
+            error_setg(errp, "Lazy loading of compressed mapped-ram "
+                       "files is not supported");
+            return;
+        }
+
+        /* The region index supersedes the page bitmap */
+        if (!read_ramblock_mapped_ram_compressed(f, block, length,
+                                                 &region_header, errp)) {
+            return;
+        }
+        qemu_set_offset(f, block->pages_offset + length, SEEK_SET);
+        return;
+    }
+
     num_pages = length / header.page_size;
     bitmap_size = BITS_TO_LONGS(num_pages) * sizeof(unsigned long);
 
@@ -3998,7 +4624,10 @@ static void parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
         return;
     }
 
-    if (!read_ramblock_mapped_ram(f, block, num_pages, bitmap, errp)) {
+    if (migrate_mapped_ram_lazy()) {
+        /* Pages are loaded on demand once all blocks are parsed */
+        mapped_ram_lazy_add_block(block, g_steal_pointer(&bitmap));
+    } else if (!read_ramblock_mapped_ram(f, block, num_pages, bitmap, errp)) {
         return;
     }
 
@@ -4212,6 +4841,16 @@ static int ram_load_precopy(QEMUFile *f)
             if (migrate_mapped_ram()) {
                 multifd_recv_sync_main();
             }
+            if (migrate_mapped_ram_lazy()) {
+                Error *local_err = NULL;
+
+                if (ret) {
+                    mapped_ram_lazy_free();
+                } else if (!mapped_ram_lazy_load_start(f, &local_err)) {
+                    error_report_err(local_err);
+                    ret = -EINVAL;
+                }
+            }
             break;
 
         case RAM_SAVE_FLAG_ZERO:
@@ -93,5 +93,6 @@ bool ram_write_tracking_compatible(void);
 void ram_write_tracking_prepare(void);
 int ram_write_tracking_start(void);
 void ram_write_tracking_stop(void);
+bool ram_mapped_ram_lazy_available(void);
 
 #endif
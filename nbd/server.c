@@ -28,6 +28,9 @@
 #include "nbd-internal.h"
 #include "qemu/units.h"
 #include "qemu/memalign.h"
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
 
 #define NBD_META_ID_BASE_ALLOCATION 0
 #define NBD_META_ID_ALLOCATION_DEPTH 1
@@ -83,8 +86,22 @@ struct NBDRequestData {
     NBDClient *client;
     uint8_t *data;
     bool complete;
+    /*
+     * Non-zero if @data was sent with MSG_ZEROCOPY; it may only be freed
+     * once client->sioc->zero_copy_sent reaches this value.
+     */
+    ssize_t zero_copy_seq;
+    size_t zero_copy_len;
 };
 
+/* A read buffer whose zero copy send has not completed yet */
+typedef struct NBDZeroCopyBuf {
+    uint8_t *data;
+    size_t len;
+    ssize_t seq;
+    QLIST_ENTRY(NBDZeroCopyBuf) next;
+} NBDZeroCopyBuf;
+
 struct NBDExport {
     BlockExport common;
 
@@ -99,6 +116,7 @@ struct NBDExport {
     Notifier eject_notifier;
 
     bool allocation_depth;
+    bool zero_copy_send;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
 };
@@ -140,6 +158,15 @@ struct NBDClient {
     CoMutex send_lock;
     Coroutine *send_coroutine;
 
+    /*
+     * Set if read payloads are sent with MSG_ZEROCOPY.  Buffers still in
+     * use by the kernel wait in zero_copy_bufs, protected by lock.
+     */
+    bool zero_copy;
+    QLIST_HEAD(, NBDZeroCopyBuf) zero_copy_bufs;
+    size_t zero_copy_bytes;
+    size_t zero_copy_max_pending;
+
     bool read_yielding; /* protected by lock */
     bool quiescing; /* protected by lock */
 
@@ -1433,6 +1460,29 @@ static coroutine_fn int nbd_negotiate(NBDClient *client, Error **errp)
     return 0;
 }
 
+/*
+ * Free the deferred zero copy buffers that the kernel is done with.
+ * Caller must hold client->lock.
+ */
+static void nbd_zero_copy_reap(NBDClient *client)
+{
+    NBDZeroCopyBuf *zc, *next;
+
+    if (!client->zero_copy ||
+        qio_channel_socket_zero_copy_reap(client->sioc, NULL) < 0) {
+        return;
+    }
+
+    QLIST_FOREACH_SAFE(zc, &client->zero_copy_bufs, next, next) {
+        if (zc->seq <= client->sioc->zero_copy_sent) {
+            QLIST_REMOVE(zc, next);
+            qatomic_sub(&client->zero_copy_bytes, zc->len);
+            qemu_vfree(zc->data);
+            g_free(zc);
+        }
+    }
+}
+
 /* nbd_read_eof
  * Tries to read @size bytes from @ioc. This is a local implementation of
  * qio_channel_readv_all_eof. We have it here because we need it to be
@@ -1454,6 +1504,13 @@ nbd_read_eof(NBDClient *client, void *buffer, size_t size, Error **errp)
         len = qio_channel_readv(client->ioc, &iov, 1, errp);
         if (len == QIO_CHANNEL_ERR_BLOCK) {
             WITH_QEMU_LOCK_GUARD(&client->lock) {
+                /*
+                 * Zero copy completions on the socket error queue make the
+                 * socket report G_IO_ERR, which wakes us up even though
+                 * there is nothing to read.  Drain them, or an idle client
+                 * would keep the AioContext spinning.
+                 */
+                nbd_zero_copy_reap(client);
                 client->read_yielding = true;
 
                 /* Prompt main loop thread to re-run nbd_drained_poll() */
@@ -1546,6 +1603,49 @@ static int coroutine_fn nbd_receive_request(NBDClient *client, NBDRequest *reque
 
 #define MAX_NBD_REQUESTS 16
 
+/*
+ * MSG_ZEROCOPY only pays off for large sends, and the pages of every
+ * pending send count against RLIMIT_MEMLOCK, so bound the memory that
+ * may wait for completion notifications per client.
+ */
+#define NBD_ZERO_COPY_MIN_SIZE      (64 * KiB)
+#define NBD_ZERO_COPY_MAX_PENDING   (32 * MiB)
+
+/*
+ * The locked memory limit is shared with everything else in the process,
+ * so leave each client at most a quarter of it.  Sends that still run
+ * into the limit are copied, see QIOChannelSocket.zero_copy_fallback.
+ */
+static size_t nbd_zero_copy_max_pending(void)
+{
+#ifndef _WIN32
+    struct rlimit rlim;
+
+    if (getrlimit(RLIMIT_MEMLOCK, &rlim) == 0 &&
+        rlim.rlim_cur != RLIM_INFINITY) {
+        return MIN(rlim.rlim_cur / 4, NBD_ZERO_COPY_MAX_PENDING);
+    }
+#endif
+    return NBD_ZERO_COPY_MAX_PENDING;
+}
+
+/*
+ * Called when the client goes away.  The socket is shut down by now, so
+ * nothing will be transmitted from these buffers on behalf of a live
+ * connection any more.
+ */
+static void nbd_zero_copy_free_all(NBDClient *client)
+{
+    NBDZeroCopyBuf *zc, *next;
+
+    QLIST_FOREACH_SAFE(zc, &client->zero_copy_bufs, next, next) {
+        QLIST_REMOVE(zc, next);
+        qemu_vfree(zc->data);
+        g_free(zc);
+    }
+    qatomic_set(&client->zero_copy_bytes, 0);
+}
+
 /* Runs in export AioContext and main loop thread */
 void nbd_client_get(NBDClient *client)
 {
@@ -1573,6 +1673,7 @@ void nbd_client_put(NBDClient *client)
             blk_exp_unref(&client->exp->common);
         }
         g_free(client->contexts.bitmaps);
+        nbd_zero_copy_free_all(client);
         qemu_mutex_destroy(&client->lock);
         g_free(client);
     }
@@ -1645,10 +1746,19 @@ static void nbd_request_put(NBDRequestData *req)
 {
     NBDClient *client = req->client;
 
-    if (req->data) {
+    if (req->zero_copy_seq) {
+        NBDZeroCopyBuf *zc = g_new(NBDZeroCopyBuf, 1);
+
+        /* The kernel may still be reading the payload, free it later */
+        zc->data = req->data;
+        zc->len = req->zero_copy_len;
+        zc->seq = req->zero_copy_seq;
+        QLIST_INSERT_HEAD(&client->zero_copy_bufs, zc, next);
+    } else if (req->data) {
         qemu_vfree(req->data);
     }
     g_free(req);
+    nbd_zero_copy_reap(client);
 
     client->nb_requests--;
 
@@ -1821,6 +1931,13 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
         return -EEXIST;
     }
 
+    if (arg->has_multi_conn && arg->multi_conn == ON_OFF_AUTO_ON &&
+        nbd_server_max_connections() == 1) {
+        error_setg(errp, "multi-conn requires an NBD server that accepts "
+                   "more than one connection");
+        return -EINVAL;
+    }
+
     size = blk_getlength(blk);
     if (size < 0) {
         error_setg_errno(errp, -size,
@@ -1842,8 +1959,22 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     exp->nbdflags = (NBD_FLAG_HAS_FLAGS | NBD_FLAG_SEND_FLUSH |
                      NBD_FLAG_SEND_FUA | NBD_FLAG_SEND_CACHE);
 
-    if (nbd_server_max_connections() != 1) {
+    /*
+     * All connections share one BlockBackend, so a flush on any of them
+     * flushes the writes completed on all of them and reads see every
+     * completed write; that is what NBD_FLAG_CAN_MULTI_CONN promises.
+     */
+    switch (arg->has_multi_conn ? arg->multi_conn : ON_OFF_AUTO_AUTO) {
+    case ON_OFF_AUTO_ON:
         exp->nbdflags |= NBD_FLAG_CAN_MULTI_CONN;
+        break;
+    case ON_OFF_AUTO_AUTO:
+        if (nbd_server_max_connections() != 1) {
+            exp->nbdflags |= NBD_FLAG_CAN_MULTI_CONN;
+        }
+        break;
+    default:
+        break;
     }
     if (readonly) {
         exp->nbdflags |= NBD_FLAG_READ_ONLY;
@@ -1923,6 +2054,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     }
 
     exp->allocation_depth = arg->allocation_depth;
+    exp->zero_copy_send = arg->zero_copy_send;
 
     /*
      * We need to inhibit request queuing in the block layer to ensure we can
@@ -2040,6 +2172,61 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     return ret;
 }
 
+static bool nbd_client_can_zero_copy(NBDClient *client, size_t len)
+{
+    return client->zero_copy && len >= NBD_ZERO_COPY_MIN_SIZE &&
+           qatomic_read(&client->zero_copy_bytes) + len <=
+           client->zero_copy_max_pending;
+}
+
+/*
+ * Like nbd_co_send_iov(), but the last element of @iov is read payload
+ * that lives in @req->data.  If possible the payload is handed to the
+ * kernel with MSG_ZEROCOPY instead of being copied into the socket
+ * buffer; the headers in the other elements usually live on the stack
+ * and are always copied.  nbd_request_put() then keeps @req->data
+ * alive until the kernel reports that it is done with it.
+ */
+static int coroutine_fn nbd_co_send_read_iov(NBDClient *client,
+                                             NBDRequestData *req,
+                                             struct iovec *iov, unsigned niov,
+                                             Error **errp)
+{
+    struct iovec *payload = &iov[niov - 1];
+    ssize_t queued;
+    int ret;
+
+    if (!req || !nbd_client_can_zero_copy(client, payload->iov_len)) {
+        return nbd_co_send_iov(client, iov, niov, errp);
+    }
+
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    ret = qio_channel_writev_all(client->ioc, iov, niov - 1, errp);
+    if (ret == 0) {
+        trace_nbd_co_send_read_zero_copy(payload->iov_base, payload->iov_len);
+        queued = client->sioc->zero_copy_queued;
+        ret = qio_channel_writev_full_all(client->ioc, payload, 1, NULL, 0,
+                                          QIO_CHANNEL_WRITE_FLAG_ZERO_COPY,
+                                          errp);
+        /*
+         * Even a failed send may have queued part of the payload, while
+         * sends that were copied because of RLIMIT_MEMLOCK queue nothing
+         */
+        if (client->sioc->zero_copy_queued != queued) {
+            req->zero_copy_seq = client->sioc->zero_copy_queued;
+            req->zero_copy_len += payload->iov_len;
+            qatomic_add(&client->zero_copy_bytes, payload->iov_len);
+        }
+    }
+
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret < 0 ? -EIO : 0;
+}
+
 static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
                                        uint64_t cookie)
 {
@@ -2053,6 +2240,7 @@ static int coroutine_fn nbd_co_send_simple_reply(NBDClient *client,
                                                  uint32_t error,
                                                  void *data,
                                                  uint64_t len,
+                                                 NBDRequestData *req,
                                                  Error **errp)
 {
     NBDSimpleReply reply;
@@ -2071,7 +2259,7 @@ static int coroutine_fn nbd_co_send_simple_reply(NBDClient *client,
                                    nbd_err_lookup(nbd_err), len);
     set_be_simple_reply(&reply, nbd_err, request->cookie);
 
-    return nbd_co_send_iov(client, iov, 2, errp);
+    return nbd_co_send_read_iov(client, len ? req : NULL, iov, 2, errp);
 }
 
 /*
@@ -2136,6 +2324,7 @@ static int coroutine_fn nbd_co_send_chunk_read(NBDClient *client,
                                                void *data,
                                                uint64_t size,
                                                bool final,
+                                               NBDRequestData *req,
                                                Error **errp)
 {
     NBDReply hdr;
@@ -2152,7 +2341,7 @@ static int coroutine_fn nbd_co_send_chunk_read(NBDClient *client,
                  NBD_REPLY_TYPE_OFFSET_DATA, request);
     stq_be_p(&chunk.offset, offset);
 
-    return nbd_co_send_iov(client, iov, 3, errp);
+    return nbd_co_send_read_iov(client, req, iov, 3, errp);
 }
 
 static int coroutine_fn nbd_co_send_chunk_error(NBDClient *client,
@@ -2188,12 +2377,13 @@ static int coroutine_fn nbd_co_send_chunk_error(NBDClient *client,
 static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
                                                 NBDRequest *request,
                                                 uint64_t offset,
-                                                uint8_t *data,
+                                                NBDRequestData *req,
                                                 uint64_t size,
                                                 Error **errp)
 {
     int ret = 0;
     NBDExport *exp = client->exp;
+    uint8_t *data = req->data;
     size_t progress = 0;
 
     assert(size <= NBD_MAX_BUFFER_SIZE);
@@ -2239,7 +2429,8 @@ static int coroutine_fn nbd_co_send_sparse_read(NBDClient *client,
                 break;
             }
             ret = nbd_co_send_chunk_read(client, request, offset + progress,
-                                         data + progress, pnum, final, errp);
+                                         data + progress, pnum, final, req,
+                                         errp);
         }
 
         if (ret < 0) {
@@ -2826,7 +3017,7 @@ static coroutine_fn int nbd_send_generic_reply(NBDClient *client,
         return nbd_co_send_chunk_done(client, request, errp);
     } else {
         return nbd_co_send_simple_reply(client, request, ret < 0 ? -ret : 0,
-                                        NULL, 0, errp);
+                                        NULL, 0, NULL, errp);
     }
 }
 
@@ -2834,10 +3025,11 @@ static coroutine_fn int nbd_send_generic_reply(NBDClient *client,
  * Return -errno if sending fails. Other errors are reported directly to the
  * client as an error reply. */
 static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
-                                        uint8_t *data, Error **errp)
+                                        NBDRequestData *req, Error **errp)
 {
     int ret;
     NBDExport *exp = client->exp;
+    uint8_t *data = req->data;
 
     assert(request->type == NBD_CMD_READ);
     assert(request->len <= NBD_MAX_BUFFER_SIZE);
@@ -2855,7 +3047,7 @@ static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
         !(request->flags & NBD_CMD_FLAG_DF) && request->len)
     {
         return nbd_co_send_sparse_read(client, request, request->from,
-                                       data, request->len, errp);
+                                       req, request->len, errp);
     }
 
     ret = blk_co_pread(exp->common.blk, request->from, request->len, data, 0);
@@ -2867,13 +3059,13 @@ static coroutine_fn int nbd_do_cmd_read(NBDClient *client, NBDRequest *request,
     if (client->mode >= NBD_MODE_STRUCTURED) {
         if (request->len) {
             return nbd_co_send_chunk_read(client, request, request->from, data,
-                                          request->len, true, errp);
+                                          request->len, true, req, errp);
         } else {
             return nbd_co_send_chunk_done(client, request, errp);
         }
     } else {
         return nbd_co_send_simple_reply(client, request, 0,
-                                        data, request->len, errp);
+                                        data, request->len, req, errp);
     }
 }
 
@@ -2905,8 +3097,9 @@ static coroutine_fn int nbd_do_cmd_cache(NBDClient *client, NBDRequest *request,
  * client as an error reply. */
 static coroutine_fn int nbd_handle_request(NBDClient *client,
                                            NBDRequest *request,
-                                           uint8_t *data, Error **errp)
+                                           NBDRequestData *req, Error **errp)
 {
+    uint8_t *data = req->data;
     int ret;
     int flags;
     NBDExport *exp = client->exp;
@@ -2918,7 +3111,7 @@ static coroutine_fn int nbd_handle_request(NBDClient *client,
         return nbd_do_cmd_cache(client, request, errp);
 
     case NBD_CMD_READ:
-        return nbd_do_cmd_read(client, request, data, errp);
+        return nbd_do_cmd_read(client, request, req, errp);
 
     case NBD_CMD_WRITE:
         flags = 0;
@@ -3120,7 +3313,7 @@ static coroutine_fn void nbd_trip(void *opaque)
                                      error_get_pretty(export_err), &local_err);
         error_free(export_err);
     } else {
-        ret = nbd_handle_request(client, &request, req->data, &local_err);
+        ret = nbd_handle_request(client, &request, req, &local_err);
     }
     if (request.contexts && request.contexts != &client->contexts) {
         assert(request.type == NBD_CMD_BLOCK_STATUS);
@@ -3228,6 +3421,17 @@ static coroutine_fn void nbd_co_client_start(void *opaque)
     }
 
     timer_free(handshake_timer);
+
+    /* TLS channels copy the payload anyway, so only plain sockets qualify */
+    if (client->exp->zero_copy_send &&
+        client->ioc == QIO_CHANNEL(client->sioc) &&
+        qio_channel_socket_enable_zero_copy(client->sioc)) {
+        client->zero_copy_max_pending = nbd_zero_copy_max_pending();
+        client->zero_copy = client->zero_copy_max_pending >=
+                            NBD_ZERO_COPY_MIN_SIZE;
+        client->sioc->zero_copy_fallback = true;
+    }
+
     WITH_QEMU_LOCK_GUARD(&client->lock) {
         nbd_client_receive_next_request(client);
     }
@@ -1079,7 +1079,7 @@ static int img_commit(int argc, char **argv)
 
     commit_active_start("commit", bs, base_bs, JOB_DEFAULT, rate_limit,
                         BLOCKDEV_ON_ERROR_REPORT, NULL, common_block_job_cb,
-                        &cbi, false, &local_err);
+                        &cbi, false, false, &local_err);
     if (local_err) {
         goto done;
     }
@@ -0,0 +1,67 @@
+/*
+ * QEMU be64_run_length speed benchmark
+ *
+ * Scans L2 slices of contiguous qcow2 data clusters the way
+ * count_contiguous_subclusters() does, with standard (stride 1) and
+ * extended (stride 2) L2 entries.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/cutils.h"
+#include "qemu/units.h"
+
+#define CLUSTER_SIZE (2 * MiB)
+#define FIRST_ENTRY ((1ULL << 63) | (256 * MiB))    /* COPIED flag set */
+#define EXTENDED_BITMAP 0xffffffffULL               /* all allocated */
+
+static void test(const void *opaque)
+{
+    size_t max = 4096;
+    uint64_t *l2 = g_new(uint64_t, 2 * max);
+    int accel_index = 0;
+
+    do {
+        if (accel_index != 0) {
+            g_test_message("%s", "");  /* gnu_printf Werror for simple "" */
+        }
+        for (size_t stride = 1; stride <= 2; stride++) {
+            for (size_t i = 0; i < max; i++) {
+                l2[i * stride] = cpu_to_be64(FIRST_ENTRY + i * CLUSTER_SIZE);
+                if (stride == 2) {
+                    l2[i * 2 + 1] = cpu_to_be64(EXTENDED_BITMAP);
+                }
+            }
+
+            for (size_t n = 16; n <= max; n *= 4) {
+                double total = 0.0;
+
+                g_test_timer_start();
+                do {
+                    size_t run = be64_run_length(l2, n, stride, FIRST_ENTRY,
+                                                 CLUSTER_SIZE);
+                    g_assert(run == n);
+                    total += n;
+                } while (g_test_timer_elapsed() < 0.5);
+
+                g_test_message("be64_run_length #%d: stride %zu %4zu entries "
+                               "%8.0f M entries/sec",
+                               accel_index, stride, n,
+                               total / 1e6 / g_test_timer_last());
+            }
+        }
+        accel_index++;
+    } while (test_be64_run_length_next_accel());
+
+    g_free(l2);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_data_func("/cutils/be64-run/speed", NULL, test);
+    return g_test_run();
+}
@@ -0,0 +1,113 @@
+/*
+ * Tracked request overlap lookup benchmark
+ *
+ * Compares the cost of finding a conflicting tracked request by scanning a
+ * list of all in-flight requests against an interval tree lookup, as done by
+ * bdrv_find_conflicting_request(), for queue depths from 1 to 1024.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/interval-tree.h"
+#include "qemu/queue.h"
+#include "qemu/units.h"
+
+#define REQ_SIZE (4 * KiB)
+#define DISK_SIZE (1 * GiB)
+
+typedef struct Req {
+    int64_t offset;
+    int64_t bytes;
+    QLIST_ENTRY(Req) list;
+    IntervalTreeNode node;
+} Req;
+
+static QLIST_HEAD(, Req) req_list;
+static IntervalTreeRoot req_tree;
+static int conflicts;
+
+static bool req_overlaps(Req *req, int64_t offset, int64_t bytes)
+{
+    return offset < req->offset + req->bytes && req->offset < offset + bytes;
+}
+
+static Req *find_conflict_list(int64_t offset, int64_t bytes)
+{
+    Req *req;
+
+    QLIST_FOREACH(req, &req_list, list) {
+        if (req_overlaps(req, offset, bytes)) {
+            return req;
+        }
+    }
+    return NULL;
+}
+
+static Req *find_conflict_tree(int64_t offset, int64_t bytes)
+{
+    IntervalTreeNode *node;
+
+    node = interval_tree_iter_first(&req_tree, offset, offset + bytes - 1);
+    return node ? container_of(node, Req, node) : NULL;
+}
+
+static void test(const void *opaque)
+{
+    GRand *rand = g_rand_new_with_seed(1);
+
+    for (int qd = 1; qd <= 1024; qd *= 2) {
+        Req *reqs = g_new0(Req, qd);
+        double list_ops = 0, tree_ops = 0;
+        double list_time, tree_time;
+
+        QLIST_INIT(&req_list);
+        req_tree = (IntervalTreeRoot) {};
+        for (int i = 0; i < qd; i++) {
+            reqs[i].offset = g_rand_int_range(rand, 0, DISK_SIZE / REQ_SIZE) *
+                             (int64_t)REQ_SIZE;
+            reqs[i].bytes = REQ_SIZE;
+            reqs[i].node.start = reqs[i].offset;
+            reqs[i].node.last = reqs[i].offset + reqs[i].bytes - 1;
+            QLIST_INSERT_HEAD(&req_list, &reqs[i], list);
+            interval_tree_insert(&reqs[i].node, &req_tree);
+        }
+
+        /* A new serialising request has to check all requests in flight */
+        g_test_timer_start();
+        do {
+            int64_t offset = g_rand_int_range(rand, 0, DISK_SIZE / REQ_SIZE) *
+                             (int64_t)REQ_SIZE;
+
+            conflicts += !!find_conflict_list(offset, REQ_SIZE);
+            list_ops++;
+        } while (g_test_timer_elapsed() < 0.2);
+        list_time = g_test_timer_last();
+
+        g_test_timer_start();
+        do {
+            int64_t offset = g_rand_int_range(rand, 0, DISK_SIZE / REQ_SIZE) *
+                             (int64_t)REQ_SIZE;
+
+            conflicts += !!find_conflict_tree(offset, REQ_SIZE);
+            tree_ops++;
+        } while (g_test_timer_elapsed() < 0.2);
+        tree_time = g_test_timer_last();
+
+        g_test_message("QD %4d: list %8.1f ns/lookup  tree %8.1f ns/lookup",
+                       qd, list_time * 1e9 / list_ops,
+                       tree_time * 1e9 / tree_ops);
+
+        g_free(reqs);
+    }
+
+    g_rand_free(rand);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_data_func("/block/tracked-requests/lookup", NULL, test);
+    return g_test_run();
+}
@@ -2228,6 +2228,27 @@ static void test_precopy_file_mapped_ram(void)
     test_file_common(&args, true);
 }
 
+static void *migrate_mapped_ram_lazy_start(QTestState *from, QTestState *to)
+{
+    migrate_mapped_ram_start(from, to);
+    migrate_set_capability(to, "mapped-ram-lazy", true);
+
+    return NULL;
+}
+
+static void test_precopy_file_mapped_ram_lazy(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = migrate_mapped_ram_lazy_start,
+    };
+
+    test_file_common(&args, true);
+}
+
 static void *migrate_multifd_mapped_ram_start(QTestState *from, QTestState *to)
 {
     migrate_mapped_ram_start(from, to);
@@ -2267,6 +2288,45 @@ static void test_multifd_file_mapped_ram(void)
     test_file_common(&args, true);
 }
 
+#ifdef CONFIG_ZSTD
+static void *migrate_multifd_mapped_ram_zstd_start(QTestState *from,
+                                                   QTestState *to)
+{
+    migrate_multifd_mapped_ram_start(from, to);
+
+    migrate_set_parameter_str(from, "multifd-compression", "zstd");
+    migrate_set_parameter_str(to, "multifd-compression", "zstd");
+
+    return NULL;
+}
+
+static void test_multifd_file_mapped_ram_zstd_live(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = migrate_multifd_mapped_ram_zstd_start,
+    };
+
+    test_file_common(&args, false);
+}
+
+static void test_multifd_file_mapped_ram_zstd(void)
+{
+    g_autofree char *uri = g_strdup_printf("file:%s/%s", tmpfs,
+                                           FILE_TEST_FILENAME);
+    MigrateCommon args = {
+        .connect_uri = uri,
+        .listen_uri = "defer",
+        .start_hook = migrate_multifd_mapped_ram_zstd_start,
+    };
+
+    test_file_common(&args, true);
+}
+#endif /* CONFIG_ZSTD */
+
 static void *multifd_mapped_ram_dio_start(QTestState *from, QTestState *to)
 {
     migrate_multifd_mapped_ram_start(from, to);
@@ -3871,6 +3931,11 @@ int main(int argc, char **argv)
     migration_test_add("/migration/precopy/file/mapped-ram/live",
                        test_precopy_file_mapped_ram_live);
 
+    if (has_uffd) {
+        migration_test_add("/migration/precopy/file/mapped-ram/lazy",
+                           test_precopy_file_mapped_ram_lazy);
+    }
+
     migration_test_add("/migration/multifd/file/mapped-ram",
                        test_multifd_file_mapped_ram);
     migration_test_add("/migration/multifd/file/mapped-ram/live",
@@ -3879,6 +3944,13 @@ int main(int argc, char **argv)
     migration_test_add("/migration/multifd/file/mapped-ram/dio",
                        test_multifd_file_mapped_ram_dio);
 
+#ifdef CONFIG_ZSTD
+    migration_test_add("/migration/multifd/file/mapped-ram/zstd",
+                       test_multifd_file_mapped_ram_zstd);
+    migration_test_add("/migration/multifd/file/mapped-ram/zstd/live",
+                       test_multifd_file_mapped_ram_zstd_live);
+#endif
+
 #ifndef _WIN32
     migration_test_add("/migration/multifd/file/mapped-ram/fdset",
                        test_multifd_file_mapped_ram_fdset);
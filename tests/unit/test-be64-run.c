@@ -0,0 +1,122 @@
+/*
+ * be64_run_length test
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/cutils.h"
+
+#define MAX_VALUES 70
+#define FIRST 0x8000000012340000ULL
+#define DELTA 0x10000ULL
+#define OTHER 0xffffffffULL
+
+static uint64_t values[2 * MAX_VALUES];
+
+static void fill(size_t stride, uint64_t delta)
+{
+    for (size_t i = 0; i < MAX_VALUES; i++) {
+        values[i * stride] = cpu_to_be64(FIRST + i * delta);
+        if (stride == 2) {
+            values[i * 2 + 1] = cpu_to_be64(OTHER);
+        }
+    }
+}
+
+static void test_1(void)
+{
+    for (size_t stride = 1; stride <= 2; stride++) {
+        for (uint64_t delta = 0; delta <= DELTA; delta += DELTA) {
+            fill(stride, delta);
+
+            /* Full runs of any length */
+            for (size_t n = 0; n <= MAX_VALUES; n++) {
+                g_assert_cmpuint(be64_run_length(values, n, stride, FIRST,
+                                                 delta), ==, n);
+            }
+
+            /* A wrong first value */
+            g_assert_cmpuint(be64_run_length(values, MAX_VALUES, stride,
+                                             FIRST + 1, delta), ==, 0);
+
+            /* The run ends at the first value that doesn't match */
+            for (size_t o = 0; o < MAX_VALUES; o++) {
+                uint64_t saved = values[o * stride];
+
+                values[o * stride] ^= cpu_to_be64(1ULL << (o % 64));
+                g_assert_cmpuint(be64_run_length(values, MAX_VALUES, stride,
+                                                 FIRST, delta), ==, o);
+                values[o * stride] = saved;
+            }
+
+            /* Values between the ones looked at don't matter */
+            if (stride == 2) {
+                values[3] = 0;
+                g_assert_cmpuint(be64_run_length(values, MAX_VALUES, stride,
+                                                 FIRST, delta), ==,
+                                 MAX_VALUES);
+            }
+        }
+    }
+}
+
+#ifndef _WIN32
+/*
+ * The values end right before an inaccessible page, so that reading past
+ * the last value faults.  With a stride of 2, look at the odd values like
+ * qcow2 does for subcluster bitmaps.
+ */
+static void test_guard(uint64_t *end)
+{
+    for (size_t stride = 1; stride <= 2; stride++) {
+        for (size_t n = 1; n <= MAX_VALUES; n++) {
+            uint64_t *p = end - n * stride + (stride - 1);
+
+            for (size_t i = 0; i < n; i++) {
+                p[i * stride] = cpu_to_be64(FIRST + i * DELTA);
+                if (stride == 2) {
+                    p[i * 2 - 1] = cpu_to_be64(OTHER);
+                }
+            }
+            g_assert_cmpuint(be64_run_length(p, n, stride, FIRST, DELTA),
+                             ==, n);
+        }
+    }
+}
+#endif
+
+static void test_2(void)
+{
+#ifndef _WIN32
+    size_t pagesize = qemu_real_host_page_size();
+    uint8_t *buf;
+
+    buf = mmap(NULL, 2 * pagesize, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    g_assert(buf != MAP_FAILED);
+    g_assert(mprotect(buf + pagesize, pagesize, PROT_NONE) == 0);
+#endif
+
+    do {
+        test_1();
+#ifndef _WIN32
+        test_guard((uint64_t *)(buf + pagesize));
+#endif
+    } while (test_be64_run_length_next_accel());
+
+#ifndef _WIN32
+    munmap(buf, 2 * pagesize);
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/cutils/be64-run", test_2);
+
+    return g_test_run();
+}
@@ -734,6 +734,42 @@ static void test_accounting(void)
                                 (64.0 / 13)));
 }
 
+static void test_try_account(void)
+{
+    throttle_config_init(&cfg);
+    cfg.buckets[THROTTLE_OPS_TOTAL].avg = 100;
+    cfg.buckets[THROTTLE_BPS_WRITE].avg = 1000;
+
+    throttle_init(&ts);
+    throttle_config(&ts, QEMU_CLOCK_VIRTUAL, &cfg);
+
+    /* without max, a bucket holds avg / 10 before throttling */
+    g_assert(throttle_try_account(&ts, THROTTLE_READ, ts.previous_leak,
+                                  10, 4096));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_OPS_TOTAL].level, 10));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_TOTAL].level, 4096));
+
+    /* a batch that doesn't fit is not accounted at all */
+    g_assert(!throttle_try_account(&ts, THROTTLE_READ, ts.previous_leak,
+                                   1, 0));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_OPS_TOTAL].level, 10));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_TOTAL].level, 4096));
+
+    /* the write bps bucket is checked on top of the ops bucket */
+    throttle_leak_bucket(&ts.cfg.buckets[THROTTLE_OPS_TOTAL],
+                         NANOSECONDS_PER_SECOND);
+    g_assert(!throttle_try_account(&ts, THROTTLE_WRITE, ts.previous_leak,
+                                   1, 101));
+    g_assert(throttle_try_account(&ts, THROTTLE_WRITE, ts.previous_leak,
+                                  1, 100));
+    g_assert(double_cmp(ts.cfg.buckets[THROTTLE_BPS_WRITE].level, 100));
+
+    /* leaking makes room again */
+    g_assert(throttle_try_account(&ts, THROTTLE_READ,
+                                  ts.previous_leak + NANOSECONDS_PER_SECOND,
+                                  10, 0));
+}
+
 static void test_groups(void)
 {
     ThrottleConfig cfg1, cfg2;
@@ -829,6 +865,7 @@ int main(int argc, char **argv)
                     test_iops_size_is_missing_limit);
     g_test_add_func("/throttle/config_functions",   test_config_functions);
     g_test_add_func("/throttle/accounting",         test_accounting);
+    g_test_add_func("/throttle/try_account",        test_try_account);
     g_test_add_func("/throttle/groups",             test_groups);
     return g_test_run();
 }
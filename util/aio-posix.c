@@ -256,6 +256,9 @@ static bool poll_set_started(AioContext *ctx, AioHandlerList *ready_list,
 }
 
 
+static bool aio_busy_poll_once(AioContext *ctx, AioHandlerList *ready_list,
+                               int64_t *timeout);
+
 bool aio_prepare(AioContext *ctx)
 {
     AioHandlerList ready_list = QLIST_HEAD_INITIALIZER(ready_list);
@@ -264,7 +267,8 @@ bool aio_prepare(AioContext *ctx)
     poll_set_started(ctx, &ready_list, false);
     /* TODO what to do with this list? */
 
-    return false;
+    /* Busy pollers are handled in aio_dispatch(), don't let glib sleep */
+    return ctx->busy_poll_users > 0;
 }
 
 bool aio_pending(AioContext *ctx)
@@ -294,7 +298,7 @@ bool aio_pending(AioContext *ctx)
     }
     qemu_lockcnt_dec(&ctx->list_lock);
 
-    return result;
+    return result || ctx->busy_poll_users > 0;
 }
 
 static void aio_free_deleted_handlers(AioContext *ctx)
@@ -423,6 +427,13 @@ void aio_dispatch(AioContext *ctx)
     qemu_lockcnt_inc(&ctx->list_lock);
     aio_bh_poll(ctx);
     aio_dispatch_handlers(ctx);
+    if (ctx->busy_poll_users) {
+        AioHandlerList ready_list = QLIST_HEAD_INITIALIZER(ready_list);
+        int64_t timeout = 0;
+
+        aio_busy_poll_once(ctx, &ready_list, &timeout);
+        aio_dispatch_ready_handlers(ctx, &ready_list);
+    }
     aio_free_deleted_handlers(ctx);
     qemu_lockcnt_dec(&ctx->list_lock);
 
@@ -460,6 +471,42 @@ static bool run_poll_handlers_once(AioContext *ctx,
     return progress;
 }
 
+/*
+ * Handlers normally start polling when their fd fires, but busy pollers may
+ * never see that happen.  Add every handler that can poll to the list.
+ */
+static void poll_add_all_handlers(AioContext *ctx)
+{
+    AioHandler *node;
+
+    QLIST_FOREACH_RCU(node, &ctx->aio_handlers, node) {
+        if (!QLIST_IS_INSERTED(node, node_deleted) &&
+            !QLIST_IS_INSERTED(node, node_poll) &&
+            node->io_poll) {
+            trace_poll_add(ctx, node, node->pfd.fd, 0);
+            if (ctx->poll_started && node->io_poll_begin) {
+                node->io_poll_begin(node->opaque);
+            }
+            QLIST_INSERT_HEAD(&ctx->poll_aio_handlers, node, node_poll);
+        }
+    }
+}
+
+/*
+ * Run all poll handlers once for the busy pollers of @ctx, even if poll mode
+ * cannot be used.  The caller must have incremented ctx->list_lock.
+ */
+static bool aio_busy_poll_once(AioContext *ctx, AioHandlerList *ready_list,
+                               int64_t *timeout)
+{
+    RCU_READ_LOCK_GUARD();
+
+    poll_add_all_handlers(ctx);
+    return run_poll_handlers_once(ctx, ready_list,
+                                  qemu_clock_get_ns(QEMU_CLOCK_REALTIME),
+                                  timeout);
+}
+
 static bool fdmon_supports_polling(AioContext *ctx)
 {
     return ctx->fdmon_ops->need_wait != aio_poll_disabled;
@@ -483,6 +530,11 @@ static bool remove_idle_poll_handlers(AioContext *ctx,
         return false;
     }
 
+    /* Busy pollers are never woken up by their fd, keep polling them */
+    if (ctx->busy_poll_users) {
+        return false;
+    }
+
     QLIST_FOREACH_SAFE(node, &ctx->poll_aio_handlers, node_poll, tmp) {
         if (node->poll_idle_timeout == 0LL) {
             node->poll_idle_timeout = now + POLL_IDLE_INTERVAL_NS;
@@ -581,8 +633,20 @@ static bool try_poll_mode(AioContext *ctx, AioHandlerList *ready_list,
 {
     int64_t max_ns;
 
-    if (QLIST_EMPTY_RCU(&ctx->poll_aio_handlers)) {
-        return false;
+    if (ctx->busy_poll_users) {
+        /*
+         * Some events are only found by polling.  If poll mode is possible,
+         * poll until the next timer or event instead of the adaptive polling
+         * time; otherwise run the handlers once before checking the fds.
+         */
+        if (ctx->fdmon_ops->need_wait(ctx)) {
+            return aio_busy_poll_once(ctx, ready_list, timeout);
+        }
+
+        poll_add_all_handlers(ctx);
+        poll_set_started(ctx, ready_list, true);
+        max_ns = *timeout == -1 ? INT64_MAX : *timeout;
+        return run_poll_handlers(ctx, ready_list, max_ns, timeout);
     }
 
     max_ns = qemu_soonest_timeout(*timeout, ctx->poll_ns);
@@ -630,6 +694,11 @@ bool aio_poll(AioContext *ctx, bool blocking)
     progress = try_poll_mode(ctx, &ready_list, &timeout);
     assert(!(timeout && progress));
 
+    /* Busy pollers are not woken up by the fd monitor, don't sleep there */
+    if (ctx->busy_poll_users) {
+        timeout = 0;
+    }
+
     /*
      * aio_notify can avoid the expensive event_notifier_set if
      * everything (file descriptors, bottom halves, timers) will
@@ -679,8 +748,8 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
     aio_notify_accept(ctx);
 
-    /* Adjust polling time */
-    if (ctx->poll_max_ns) {
+    /* Adjust polling time, busy polling says nothing about the event rate */
+    if (ctx->poll_max_ns && !ctx->busy_poll_users) {
         int64_t block_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
 
         if (block_ns <= ctx->poll_ns) {
@@ -385,6 +385,11 @@ aio_ctx_finalize(GSource     *source)
         luring_cleanup(ctx->linux_io_uring);
         ctx->linux_io_uring = NULL;
     }
+    if (ctx->linux_io_uring_iopoll) {
+        luring_detach_aio_context(ctx->linux_io_uring_iopoll, ctx);
+        luring_cleanup(ctx->linux_io_uring_iopoll);
+        ctx->linux_io_uring_iopoll = NULL;
+    }
 #endif
 
     assert(QSLIST_EMPTY(&ctx->scheduled_coroutines));
@@ -463,19 +468,26 @@ LinuxAioState *aio_get_linux_aio(AioContext *ctx)
 #endif
 
 #ifdef CONFIG_LINUX_IO_URING
-LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp)
+static LuringState *aio_setup_luring(AioContext *ctx, LuringState **ps,
+                                     bool iopoll, Error **errp)
 {
-    if (ctx->linux_io_uring) {
-        return ctx->linux_io_uring;
+    if (*ps) {
+        return *ps;
     }
 
-    ctx->linux_io_uring = luring_init(errp);
-    if (!ctx->linux_io_uring) {
+    *ps = luring_init(ctx->io_uring_queue_depth, ctx->io_uring_sqpoll_idle,
+                      iopoll, errp);
+    if (!*ps) {
         return NULL;
     }
 
-    luring_attach_aio_context(ctx->linux_io_uring, ctx);
-    return ctx->linux_io_uring;
+    luring_attach_aio_context(*ps, ctx);
+    return *ps;
+}
+
+LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp)
+{
+    return aio_setup_luring(ctx, &ctx->linux_io_uring, false, errp);
 }
 
 LuringState *aio_get_linux_io_uring(AioContext *ctx)
@@ -483,6 +495,17 @@ LuringState *aio_get_linux_io_uring(AioContext *ctx)
     assert(ctx->linux_io_uring);
     return ctx->linux_io_uring;
 }
+
+LuringState *aio_setup_linux_io_uring_iopoll(AioContext *ctx, Error **errp)
+{
+    return aio_setup_luring(ctx, &ctx->linux_io_uring_iopoll, true, errp);
+}
+
+LuringState *aio_get_linux_io_uring_iopoll(AioContext *ctx)
+{
+    assert(ctx->linux_io_uring_iopoll);
+    return ctx->linux_io_uring_iopoll;
+}
 #endif
 
 void aio_notify(AioContext *ctx)
@@ -619,6 +642,8 @@ AioContext *aio_context_new(Error **errp)
     ctx->thread_pool_min = 0;
     ctx->thread_pool_max = THREAD_POOL_MAX_THREADS_DEFAULT;
 
+    ctx->busy_poll_users = 0;
+
     register_aiocontext(ctx);
 
     return ctx;
@@ -759,3 +784,21 @@ void aio_context_set_thread_pool_params(AioContext *ctx, int64_t min,
         thread_pool_update_params(ctx->thread_pool, ctx);
     }
 }
+
+void aio_context_set_io_uring_params(AioContext *ctx, int64_t queue_depth,
+                                     int64_t sqpoll_idle, Error **errp)
+{
+    /* io_uring rejects rings with more than 32768 entries */
+    if (queue_depth < 0 || queue_depth > 32768) {
+        error_setg(errp, "io-uring-queue-depth must be in range [0, 32768]");
+        return;
+    }
+    if (sqpoll_idle < 0 || sqpoll_idle > UINT32_MAX) {
+        error_setg(errp, "io-uring-sqpoll-idle must be in range [0, %u]",
+                   UINT32_MAX);
+        return;
+    }
+
+    ctx->io_uring_queue_depth = queue_depth;
+    ctx->io_uring_sqpoll_idle = sqpoll_idle;
+}
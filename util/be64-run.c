@@ -0,0 +1,57 @@
+/*
+ * Length of runs of big-endian 64-bit values
+ *
+ * Copyright (c) 2024 The QEMU Project Developers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/bswap.h"
+#include "qemu/host-utils.h"
+#include "host/cpuinfo.h"
+
+typedef size_t (*be64_run_fn)(const uint64_t *, size_t, size_t,
+                              uint64_t, uint64_t);
+
+static size_t be64_run_length_int(const uint64_t *p, size_t n, size_t stride,
+                                  uint64_t first, uint64_t delta)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (be64_to_cpu(p[i * stride]) != first + i * delta) {
+            break;
+        }
+    }
+    return i;
+}
+
+#include "host/be64-run.c.inc"
+
+static be64_run_fn be64_run_length_accel;
+static unsigned accel_index;
+
+size_t be64_run_length(const uint64_t *p, size_t n, size_t stride,
+                       uint64_t first, uint64_t delta)
+{
+    assert(stride == 1 || stride == 2);
+    return be64_run_length_accel(p, n, stride, first, delta);
+}
+
+bool test_be64_run_length_next_accel(void)
+{
+    if (accel_index != 0) {
+        be64_run_length_accel = accel_table[--accel_index];
+        return true;
+    }
+    return false;
+}
+
+static void __attribute__((constructor)) init_accel(void)
+{
+    accel_index = best_accel();
+    be64_run_length_accel = accel_table[accel_index];
+}
@@ -196,6 +196,13 @@ static void main_loop_update_params(EventLoopBase *base, Error **errp)
 
     aio_context_set_thread_pool_params(qemu_aio_context, base->thread_pool_min,
                                        base->thread_pool_max, errp);
+    if (*errp) {
+        return;
+    }
+
+    aio_context_set_io_uring_params(qemu_aio_context,
+                                    base->io_uring_queue_depth,
+                                    base->io_uring_sqpoll_idle, errp);
 }
 
 MainLoop *mloop;
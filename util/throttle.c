@@ -462,13 +462,15 @@ bool throttle_schedule_timer(ThrottleState *ts,
     return true;
 }
 
-/* do the accounting for this operation
+/* add units and bytes to the buckets of a direction; negative values
+ * give back what was added before
  *
  * @direction: throttle direction
- * @size:     the size of the operation
+ * @units:    the number of operation units
+ * @size:     the number of bytes
  */
-void throttle_account(ThrottleState *ts, ThrottleDirection direction,
-                      uint64_t size)
+static void throttle_add(ThrottleState *ts, ThrottleDirection direction,
+                         double units, double size)
 {
     static const BucketType bucket_types_size[THROTTLE_MAX][2] = {
         { THROTTLE_BPS_TOTAL, THROTTLE_BPS_READ },
@@ -478,32 +480,70 @@ void throttle_account(ThrottleState *ts, ThrottleDirection direction,
         { THROTTLE_OPS_TOTAL, THROTTLE_OPS_READ },
         { THROTTLE_OPS_TOTAL, THROTTLE_OPS_WRITE }
     };
-    double units = 1.0;
     unsigned i;
 
-    assert(direction < THROTTLE_MAX);
-    /* if cfg.op_size is defined and smaller than size we compute unit count */
-    if (ts->cfg.op_size && size > ts->cfg.op_size) {
-        units = (double) size / ts->cfg.op_size;
-    }
-
     for (i = 0; i < ARRAY_SIZE(bucket_types_size[THROTTLE_READ]); i++) {
         LeakyBucket *bkt;
 
         bkt = &ts->cfg.buckets[bucket_types_size[direction][i]];
-        bkt->level += size;
+        bkt->level = MAX(bkt->level + size, 0);
         if (bkt->burst_length > 1) {
-            bkt->burst_level += size;
+            bkt->burst_level = MAX(bkt->burst_level + size, 0);
         }
 
         bkt = &ts->cfg.buckets[bucket_types_units[direction][i]];
-        bkt->level += units;
+        bkt->level = MAX(bkt->level + units, 0);
         if (bkt->burst_length > 1) {
-            bkt->burst_level += units;
+            bkt->burst_level = MAX(bkt->burst_level + units, 0);
         }
     }
 }
 
+/* do the accounting for this operation
+ *
+ * @direction: throttle direction
+ * @size:     the size of the operation
+ */
+void throttle_account(ThrottleState *ts, ThrottleDirection direction,
+                      uint64_t size)
+{
+    double units = 1.0;
+
+    assert(direction < THROTTLE_MAX);
+    /* if cfg.op_size is defined and smaller than size we compute unit count */
+    if (ts->cfg.op_size && size > ts->cfg.op_size) {
+        units = (double) size / ts->cfg.op_size;
+    }
+
+    throttle_add(ts, direction, units, size);
+}
+
+/* account a batch of operations in advance, but only if the buckets have
+ * room for all of them, i.e. if an I/O submitted after the batch would not
+ * have to wait
+ *
+ * @direction: throttle direction
+ * @now:      the current clock timestamp
+ * @ops:      the number of operation units
+ * @size:     the total size of the operations
+ * @ret:      true if the batch has been accounted
+ */
+bool throttle_try_account(ThrottleState *ts, ThrottleDirection direction,
+                          int64_t now, uint64_t ops, uint64_t size)
+{
+    assert(direction < THROTTLE_MAX);
+
+    throttle_do_leak(ts, now);
+    throttle_add(ts, direction, ops, size);
+
+    if (throttle_compute_wait_for(ts, direction)) {
+        throttle_add(ts, direction, -(double) ops, -(double) size);
+        return false;
+    }
+
+    return true;
+}
+
 /* return a ThrottleConfig based on the options in a ThrottleLimits
  *
  * @arg:    the ThrottleLimits object to read from